@@ -0,0 +1,39 @@
+-- message dispatch from C++ (lua_tinker::batch)
+-- handlers are indexed by LOGIN_MODULE_MSG_ID values and get the serialized message
+local luapb = require "luapb"
+
+MSG_ID = luapb.enum("LOGIN_MODULE_MSG_ID")
+handlers = {}
+
+-- one call per batch: lua_tinker::batch::flush passes ids[first..n] and bufs[first..n]
+function dispatch(ids, bufs, first, n)
+	local handlers = handlers
+	for i = first, n do
+		local data = bufs[i]
+		-- consumed before the handler runs, so a failing handler only loses its own message
+		bufs[i] = false
+		local id = ids[i]
+		local f = handlers[id]
+		if f then
+			f(data)
+		else
+			print("dispatch: no handler for message " .. id)
+		end
+	end
+end
+
+-- one call per message, for comparison
+function onMessage(id, data)
+	local f = handlers[id]
+	if f then
+		f(data)
+	end
+end
+
+logins = 0
+handlers[MSG_ID.ID_C2S_REQUEST_LOGIN] = function(data)
+	local msg = luapb.lazy("CLoginRequest", data)
+	if msg.ServerID ~= 0 then
+		logins = logins + 1
+	end
+end
@@ -0,0 +1,32 @@
+-- cluaprobuff.exe pbbench.lua
+-- decode/encode the same message with pb.dll (lua-protobuf) and with luapb
+-- (C++ reflection with cached field plans) and compare the timings
+local pb = require "pb"
+local luapb = require "luapb"
+assert(pb.loadfile "loginmessage.pb")
+
+local N = 1000000
+local msg = { Name = "hjhasdf", ChannelID = 1032423, ServerID = 213412 }
+local data = assert(pb.encode("CLoginRequest", msg))
+assert(luapb.encode("CLoginRequest", msg) == data)
+
+local function bench(name, f)
+	local t = os.clock()
+	for i = 1, N do
+		f()
+	end
+	print(string.format("%-14s %.3f", name, os.clock() - t))
+end
+
+local t = luapb.decode("CLoginRequest", data)
+assert(t.Name == msg.Name and t.ChannelID == msg.ChannelID and t.ServerID == msg.ServerID)
+local lz = luapb.lazy("CLoginRequest", data)
+assert(lz.Name == msg.Name and lz.ServerID == msg.ServerID)
+
+bench("pb.decode", function() return pb.decode("CLoginRequest", data) end)
+bench("luapb.decode", function() return luapb.decode("CLoginRequest", data) end)
+-- handlers that only look at one field
+bench("pb.decode.f", function() return pb.decode("CLoginRequest", data).ServerID end)
+bench("luapb.lazy.f", function() return luapb.lazy("CLoginRequest", data).ServerID end)
+bench("pb.encode", function() return pb.encode("CLoginRequest", msg) end)
+bench("luapb.encode", function() return luapb.encode("CLoginRequest", msg) end)
@@ -0,0 +1,80 @@
+-- cluaprobuff.exe pblazy.lua
+-- luapb.lazy must read the same values as luapb.decode (ParseFromArray) for any bytes:
+-- occurrences with the wrong wire type are unknown fields, and data decode rejects
+-- makes the lazy read fail
+local luapb = require "luapb"
+
+local FIELDS = { "Name", "ChannelID", "ServerID" }
+
+-- nil when decode fails, otherwise the three fields
+local function viadecode(data)
+	local t = luapb.decode("CLoginRequest", data)
+	return t and { t.Name, t.ChannelID, t.ServerID }
+end
+
+local function vialazy(data)
+	local ok, r = pcall(function()
+		local m = luapb.lazy("CLoginRequest", data)
+		return { m.Name, m.ChannelID, m.ServerID }
+	end)
+	return ok and r or nil
+end
+
+local function check(data, expect)
+	local d, l = viadecode(data), vialazy(data)
+	local what = string.format("%q", data)
+	assert((d == nil) == (l == nil), what .. ": lazy and decode disagree on failure")
+	if d then
+		for i, name in ipairs(FIELDS) do
+			assert(d[i] == l[i], what .. ": " .. name .. " lazy " .. tostring(l[i]) .. " decode " .. tostring(d[i]))
+			if expect then
+				assert(l[i] == expect[i], what .. ": " .. name .. " is " .. tostring(l[i]))
+			end
+		end
+	else
+		assert(expect == nil, what .. ": failed to parse")
+	end
+end
+
+-- wrong wire types are skipped as unknown fields
+check("\29\1\0\0\0", { "", 0, 0 })                   -- ServerID as fixed32
+check("\24\9\29\1\0\0\0", { "", 0, 9 })              -- valid ServerID, then one as fixed32
+check("\17\1\0\0\0\0\0\0\0", { "", 0, 0 })           -- ChannelID as fixed64
+check("\26\1\7\24\3", { "", 0, 3 })                  -- ServerID as bytes, then a valid one
+check("\8\5", { "", 0, 0 })                          -- Name as varint
+check("\10\2hi\8\5", { "hi", 0, 0 })                 -- Name, then Name as varint
+-- unknown group, tags of up to 5 bytes truncated to 32 bits
+check("\35\8\1\36\24\4", { "", 0, 4 })
+check("\152\128\128\128\16\6", { "", 0, 6 })
+-- data decode rejects
+check("\0")                                          -- field number 0
+check("\36")                                         -- end group without a start
+check("\35\8\1")                                     -- unterminated group
+check("\152\128\128\128\128\16\6")                   -- 6-byte tag
+check("\10\1\255")                                   -- Name is not UTF-8
+check("\24")                                         -- truncated value
+
+-- mutations of a valid message
+local data = luapb.encode("CLoginRequest", { Name = "hjhasdf", ChannelID = 1032423, ServerID = 213412 })
+check(data, { "hjhasdf", 1032423, 213412 })
+math.randomseed(1)
+for i = 1, 20000 do
+	local p = math.random(1, #data)
+	local c = string.char(math.random(0, 255))
+	local s
+	if i % 3 == 0 then
+		s = data:sub(1, p - 1) .. c .. data:sub(p + 1)
+	elseif i % 3 == 1 then
+		s = data:sub(1, p) .. c .. data:sub(p + 1)
+	else
+		s = data:sub(1, p - 1) .. c .. c .. c .. data:sub(p)
+	end
+	check(s)
+end
+-- the metamethods check their argument
+local meta = getmetatable(luapb.lazy("CLoginRequest", data))
+for _, name in ipairs({ "__index", "__newindex", "__tostring" }) do
+	local ok, err = pcall(meta[name], {}, "ServerID", 1)
+	assert(not ok and err:find("luapb.lazy expected"), name)
+end
+print("pblazy ok")
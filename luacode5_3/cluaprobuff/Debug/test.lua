@@ -6,6 +6,12 @@ print("Hello world")
 function printfMsg(data)
 	local msg = assert(pb.decode("CLoginRequest", data))
 
+	print(msg.Name)
+	print(msg.ChannelID)
+	print(msg.ServerID)
+end
+
+function printfTable(msg)
 	print(msg.Name)
 	print(msg.ChannelID)
 	print(msg.ServerID)
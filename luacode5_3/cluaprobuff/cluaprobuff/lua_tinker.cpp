@@ -319,6 +319,15 @@ lua_tinker::table lua_tinker::read ( lua_State *L, int index )
    return table ( L, index );
 }
 
+template<>
+lua_tinker::buffer lua_tinker::read ( lua_State *L, int index )
+{
+   // 只接受string，指向lua string的内容，不复制
+   size_t len = 0;
+   const char* s = lua_type ( L, index ) == LUA_TSTRING ? lua_tolstring ( L, index, &len ) : NULL;
+   return buffer ( s, len );
+}
+
 /*---------------------------------------------------------------------------*/
 /* push                                                                      */
 /*---------------------------------------------------------------------------*/
@@ -444,7 +453,18 @@ void lua_tinker::push ( lua_State *L, unsigned long long ret )
 template<>
 void lua_tinker::push ( lua_State *L, lua_tinker::table ret )
 {
-   lua_pushvalue ( L, ret.m_obj->m_index );
+   lua_rawgeti ( L, LUA_REGISTRYINDEX, ret.m_obj->m_ref );
+}
+
+template<>
+void lua_tinker::push ( lua_State *L, lua_tinker::buffer ret )
+{
+   if ( ret.m_data == NULL )
+      lua_pushnil ( L );
+   else if ( ret.m_external )
+      lua_pushexternalstring ( L, ret.m_data, ret.m_size, ret.m_free, ret.m_ud );
+   else
+      lua_pushlstring ( L, ret.m_data, ret.m_size );
 }
 
 /*---------------------------------------------------------------------------*/
@@ -456,83 +476,242 @@ void lua_tinker::pop ( lua_State *L )
    lua_pop ( L, 1 );
 }
 
-template<>
-lua_tinker::table lua_tinker::pop ( lua_State *L )
+/*---------------------------------------------------------------------------*/
+/* lua function handle                                                       */
+/*---------------------------------------------------------------------------*/
+static lua_State* main_thread ( lua_State* L )
+{
+   lua_rawgeti ( L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD );
+   lua_State* main = lua_tothread ( L, -1 );
+   lua_pop ( L, 1 );
+   return main;
+}
+
+// 栈顶是函数时引用它并弹出，否则弹出并返回LUA_NOREF
+static int ref_function ( lua_State* L )
+{
+   if ( lua_isfunction ( L, -1 ) )
+   {
+      return luaL_ref ( L, LUA_REGISTRYINDEX );
+   }
+   lua_pop ( L, 1 );
+   return LUA_NOREF;
+}
+
+lua_tinker::function::function ( lua_State* L, const char* name )
+   :m_L ( main_thread ( L ) )
+{
+   const char* path = name;
+
+   // 从全局表开始，按'.'分段逐级查找
+   lua_pushglobaltable ( L );
+   for ( const char* e = strchr ( name, '.' ); e != NULL; e = strchr ( name, '.' ) )
+   {
+      if ( !lua_istable ( L, -1 ) )
+         break;
+      lua_pushlstring ( L, name, e - name );
+      lua_gettable ( L, -2 );
+      lua_remove ( L, -2 );
+      name = e + 1;
+   }
+
+   if ( lua_istable ( L, -1 ) )
+   {
+      lua_getfield ( L, -1, name );
+      lua_remove ( L, -2 );
+   }
+   else
+   {
+      lua_pop ( L, 1 );
+      lua_pushnil ( L );
+   }
+
+   m_ref = ref_function ( L );
+   if ( m_ref == LUA_NOREF )
+   {
+      print_error ( L, "lua_tinker::function() `%s' is not a function", path );
+   }
+}
+
+lua_tinker::function::function ( lua_State* L, int index )
+   :m_L ( main_thread ( L ) )
+{
+   lua_pushvalue ( L, index );
+   m_ref = ref_function ( L );
+}
+
+lua_tinker::function::function ( const function& input )
+   :m_L ( input.m_L )
+   , m_ref ( LUA_NOREF )
+{
+   if ( input.valid ( ) )
+   {
+      lua_rawgeti ( m_L, LUA_REGISTRYINDEX, input.m_ref );
+      m_ref = luaL_ref ( m_L, LUA_REGISTRYINDEX );
+   }
+}
+
+lua_tinker::function& lua_tinker::function::operator= ( const function& input )
+{
+   if ( this != &input )
+   {
+      function temp ( input );
+      if ( valid ( ) )
+      {
+         luaL_unref ( m_L, LUA_REGISTRYINDEX, m_ref );
+      }
+      m_L = temp.m_L;
+      m_ref = temp.m_ref;
+      temp.m_ref = LUA_NOREF;
+   }
+   return *this;
+}
+
+lua_tinker::function::~function ( )
 {
-   return table ( L, lua_gettop ( L ) );
+   if ( valid ( ) )
+   {
+      luaL_unref ( m_L, LUA_REGISTRYINDEX, m_ref );
+   }
 }
 
 /*---------------------------------------------------------------------------*/
-/* Tinker Class Helper                                                       */
+/* batched dispatch                                                          */
 /*---------------------------------------------------------------------------*/
-static void invoke_parent ( lua_State *L )
+// 两个数组放在batch专用的lua线程的栈上（1是ids，2是bufs），
+// add直接按栈位置写入，不用每条消息都从registry取table
+lua_tinker::batch::batch ( lua_State* L, const char* dispatcher )
+   :m_func ( L, dispatcher )
+   , m_count ( 0 )
 {
-   lua_pushstring ( L, "__parent" );
-   lua_rawget ( L, -2 );
-   if ( lua_istable ( L, -1 ) )
+   lua_State* main = m_func.m_L;
+   m_T = lua_newthread ( main );
+   m_ref = luaL_ref ( main, LUA_REGISTRYINDEX );
+   lua_newtable ( m_T );
+   lua_newtable ( m_T );
+}
+
+lua_tinker::batch::~batch ( )
+{
+   luaL_unref ( m_func.m_L, LUA_REGISTRYINDEX, m_ref );
+}
+
+void lua_tinker::batch::add ( int id, const buffer& data )
+{
+   ++m_count;
+   lua_pushinteger ( m_T, id );
+   lua_rawseti ( m_T, 1, m_count );
+   push ( m_T, data );
+   lua_rawseti ( m_T, 2, m_count );
+}
+
+int lua_tinker::batch::flush ( )
+{
+   return flush ( m_func.m_L );
+}
+
+int lua_tinker::batch::flush ( lua_State* L )
+{
+   if ( m_count == 0 )
+      return 0;
+
+   int first = 1;
+
+   lua_pushcclosure ( L, on_error, 0 );
+   int errfunc = lua_gettop ( L );
+
+   // 处理函数里可能又add了消息，直到追上m_count为止
+   while ( first <= m_count )
    {
-      lua_pushvalue ( L, 2 );
-      lua_rawget ( L, -2 );
-      if ( !lua_isnil ( L, -1 ) )
+      int n = m_count;
+      if ( m_func.valid ( ) )
       {
-         lua_remove ( L, -2 );
+         lua_rawgeti ( L, LUA_REGISTRYINDEX, m_func.m_ref );
+         lua_pushvalue ( m_T, 1 );
+         lua_pushvalue ( m_T, 2 );
+         lua_xmove ( m_T, L, 2 );
+         lua_pushinteger ( L, first );
+         lua_pushinteger ( L, n );
+         if ( lua_pcall ( L, 4, 0, errfunc ) == LUA_OK )
+         {
+            first = n + 1;
+            continue;
+         }
+         lua_pop ( L, 1 );
       }
       else
       {
-         lua_remove ( L, -1 );
-         invoke_parent ( L );
-         lua_remove ( L, -2 );
+         print_error ( L, "lua_tinker::batch::flush() attempt to call an unresolved function" );
+      }
+
+      // 出错了：跳过已经处理过（置为false）的消息，从下一条继续
+      int next = first;
+      while ( next <= n && lua_rawgeti ( m_T, 2, next ) == LUA_TBOOLEAN )
+      {
+         lua_pop ( m_T, 1 );
+         ++next;
       }
+      lua_settop ( m_T, 2 );
+
+      // 一条都没处理（派发函数本身有问题），丢弃剩下的消息，免得死循环
+      if ( next == first )
+      {
+         for ( next = first; next <= m_count; ++next )
+         {
+            lua_pushboolean ( m_T, 0 );
+            lua_rawseti ( m_T, 2, next );
+         }
+      }
+      first = next;
    }
+
+   lua_pop ( L, 1 );
+
+   int count = m_count;
+   m_count = 0;
+   return count;
 }
 
 /*---------------------------------------------------------------------------*/
+/* Tinker Class Helper                                                       */
+/*---------------------------------------------------------------------------*/
+// meta_get/meta_set都是以类table为上值的闭包，不需要lua_getmetatable
+
+// 压入类table（栈上cls处）[栈上key处的值]
+// 父类的成员在class_inh时已经展开到子类table里，一般一次rawget就命中；
+// 之后才注册到父类的成员通过类table的metatable的__index链找到
+static void get_member ( lua_State *L, int cls, int key )
+{
+   lua_pushvalue ( L, key );
+   if ( lua_rawget ( L, cls ) == LUA_TNIL )
+   {
+      lua_pop ( L, 1 );
+      lua_pushvalue ( L, key );
+      lua_gettable ( L, cls );
+   }
+}
+
 int lua_tinker::meta_get ( lua_State *L )
 {
-   // 传入表 和 索引参数
+   // 只有注册了成员变量的类才会走到这里
    // stack: 1.类(userdata) 2.变量(string) 
-   lua_getmetatable ( L, 1 );
-   // stack: 1.类(userdata) 2.变量(string) 3.meta(table)
-   lua_pushvalue ( L, 2 );
-   // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 4.变量(string)
-   lua_rawget ( L, -2 );
-   // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 4.meta[变量]value值(userdata)
+   get_member ( L, lua_upvalueindex ( 1 ), 2 );
+   // stack: 1.类(userdata) 2.变量(string) 3.meta[变量]value值
 
    // 如果存在userdata 存在该变量
    if ( lua_isuserdata ( L, -1 ) )
    {
-      user2type<var_base*>::invoke ( L, -1 )->get ( L );
-      // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 4.meta[变量]value值(userdata) 5.实际值
-      lua_remove ( L, -2 );
-      // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 4.实际值
+      const var_base* var = ( const var_base* ) lua_touserdata ( L, -1 );
+      var->get ( L, var );
+      // stack: 1.类(userdata) 2.变量(string) 3.meta[变量]value值(userdata) 4.实际值
+      return 1;
    }
    else if ( lua_isnil ( L, -1 ) )
    {
-      // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 4.nil
-      lua_remove ( L, -1 );
-      // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 
-      invoke_parent ( L );
-      // fix bug by fergus
-      // 调用父类也需调用get
-      if ( lua_isuserdata ( L, -1 ) )
-      {
-         // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 4.父类中的变量(userdata) 
-         user2type<var_base*>::invoke ( L, -1 )->get ( L );
-         // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 4.父类中的变量(userdata) 5.实际值
-         lua_remove ( L, -2 );
-         // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 4.实际值
-      }
-      else if ( lua_isnil ( L, -1 ) )
-      {
-         // stack: 1.类(userdata) 2.变量(string) 3.meta(table) 4.nil
-         lua_pushfstring ( L, "can't find '%s' class variable. (forgot registering class variable ?)", lua_tostring ( L, 2 ) );
-         lua_error ( L );
-      }
+      lua_pushfstring ( L, "can't find '%s' class variable. (forgot registering class variable ?)", lua_tostring ( L, 2 ) );
+      lua_error ( L );
    }
 
-   lua_remove ( L, -2 );
-   // stack: 1.类(userdata) 2.变量(string) 3.实际值
-
    return 1;
 }
 
@@ -540,39 +719,18 @@ int lua_tinker::meta_get ( lua_State *L )
 int lua_tinker::meta_set ( lua_State *L )
 {
    // stack: 1.类(userdata) 2.变量(string) 3.要赋的值
-   lua_getmetatable ( L, 1 );
-   // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table)
-   lua_pushvalue ( L, 2 );
-   // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table) 5.变量(string)
-   lua_rawget ( L, -2 );
-   // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table) 5.meta[变量](userdata mem_var指针)
+   get_member ( L, lua_upvalueindex ( 1 ), 2 );
+   // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.meta[变量](userdata mem_var指针)
 
    if ( lua_isuserdata ( L, -1 ) )
    {
-      user2type<var_base*>::invoke ( L, -1 )->set ( L );
-      // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table) 5.meta[变量](userdata mem_var指针)
+      const var_base* var = ( const var_base* ) lua_touserdata ( L, -1 );
+      var->set ( L, var );
    }
    else if ( lua_isnil ( L, -1 ) )
    {
-      // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table) 5.nil
-      lua_remove ( L, -1 );
-      // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table)
-      lua_pushvalue ( L, 2 );
-      // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table) 5.变量(string)
-      lua_pushvalue ( L, 4 );
-      // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table) 5.变量(string) 6.类meta(table)
-      invoke_parent ( L );
-      // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table) 5.变量(string) 6.类meta(table) 7.获取到父类的变量(userdata mem_var指针)
-      if ( lua_isuserdata ( L, -1 ) )
-      {
-         user2type<var_base*>::invoke ( L, -1 )->set ( L );
-      }
-      else if ( lua_isnil ( L, -1 ) )
-      {
-         // stack: 1.类(userdata) 2.变量(string) 3.要赋的值 4.类meta(table) 5.变量(string) 6.类meta(table) 7.nil
-         lua_pushfstring ( L, "can't find '%s' class variable. (forgot registering class variable ?)", lua_tostring ( L, 2 ) );
-         lua_error ( L );
-      }
+      lua_pushfstring ( L, "can't find '%s' class variable. (forgot registering class variable ?)", lua_tostring ( L, 2 ) );
+      lua_error ( L );
    }
    lua_settop ( L, 3 );
    // stack: 1.类(userdata) 2.变量(string) 3.要赋的值
@@ -580,78 +738,202 @@ int lua_tinker::meta_set ( lua_State *L )
 }
 
 /*---------------------------------------------------------------------------*/
-void lua_tinker::push_meta ( lua_State *L, const char* name )
-{
-   lua_getglobal ( L, name );
+// lua_tinker.get_fields(obj, "a", "b", ...)一次返回多个成员变量的值
+// 是模块函数而不是类table里的方法，不占用类的成员名字
+int lua_tinker::get_fields ( lua_State *L )
+{
+   // stack: 1.类(userdata) 2...n.变量(string)
+   int n = lua_gettop ( L );
+   luaL_checkstack ( L, n + 1, NULL );
+   // 对象的metatable就是类table，类table的__newindex都是meta_set
+   if ( !lua_isuserdata ( L, 1 ) || !lua_getmetatable ( L, 1 ) )
+      return luaL_argerror ( L, 1, "lua_tinker class object expected" );
+   lua_pushstring ( L, "__newindex" );
+   lua_rawget ( L, -2 );
+   bool isclass = lua_tocfunction ( L, -1 ) == meta_set;
+   lua_pop ( L, 1 );
+   if ( !isclass )
+      return luaL_argerror ( L, 1, "lua_tinker class object expected" );
+   int cls = n + 1;
+   for ( int i = 2; i <= n; ++i )
+   {
+      get_member ( L, cls, i );
+      if ( !lua_isuserdata ( L, -1 ) )
+      {
+         lua_pushfstring ( L, "can't find '%s' class variable. (forgot registering class variable ?)", lua_tostring ( L, i ) );
+         lua_error ( L );
+      }
+      const var_base* var = ( const var_base* ) lua_touserdata ( L, -1 );
+      var->get ( L, var );
+      lua_remove ( L, -2 );
+   }
+   lua_remove ( L, cls );
+   return n - 1;
 }
 
 /*---------------------------------------------------------------------------*/
-/* table object on stack                                                     */
-/*---------------------------------------------------------------------------*/
-lua_tinker::table_obj::table_obj ( lua_State* L, int index )
-   :m_L ( L )
-   , m_index ( index )
-   , m_ref ( 0 )
+// 给栈顶的类table设置__newindex，并确保全局的lua_tinker表里有get_fields
+void lua_tinker::class_vars ( lua_State *L )
 {
-   if ( lua_isnil ( m_L, m_index ) )
-   {
-      m_pointer = NULL;
-      lua_remove ( m_L, m_index );
-   }
-   else
+   lua_pushstring ( L, "__newindex" );
+   lua_pushvalue ( L, -2 );
+   lua_pushcclosure ( L, meta_set, 1 );
+   lua_rawset ( L, -3 );
+
+   if ( lua_getglobal ( L, "lua_tinker" ) != LUA_TTABLE )
    {
-      m_pointer = lua_topointer ( m_L, m_index );
+      lua_pop ( L, 1 );
+      lua_newtable ( L );
+      lua_pushvalue ( L, -1 );
+      lua_setglobal ( L, "lua_tinker" );
    }
+   lua_pushcclosure ( L, get_fields, 0 );
+   lua_setfield ( L, -2, "get_fields" );
+   lua_pop ( L, 1 );
 }
 
-lua_tinker::table_obj::~table_obj ( )
+/*---------------------------------------------------------------------------*/
+// 压入栈顶类table的metatable，没有就创建一个
+// 它的__call是构造函数，__index是父类table
+void lua_tinker::class_meta ( lua_State *L )
 {
-   if ( validate ( ) )
+   if ( !lua_getmetatable ( L, -1 ) )
    {
-      lua_remove ( m_L, m_index );
+      lua_newtable ( L );
+      lua_pushvalue ( L, -1 );
+      lua_setmetatable ( L, -3 );
    }
 }
 
-void lua_tinker::table_obj::inc_ref ( )
+/*---------------------------------------------------------------------------*/
+// 把父类table中的项（不包括"__"开头的元方法和内部字段）复制到子类table中没有的位置，
+// 并设置子类table的metatable的__index = 父类table，之后才加到父类的项也能找到
+static void flatten ( lua_State *L, int child, int parent )
 {
-   ++m_ref;
+   lua_pushnil ( L );
+   while ( lua_next ( L, parent ) )
+   {
+      // stack: ... key value
+      if ( lua_type ( L, -2 ) != LUA_TSTRING || strncmp ( lua_tostring ( L, -2 ), "__", 2 ) != 0 )
+      {
+         lua_pushvalue ( L, -2 );
+         lua_rawget ( L, child );
+         bool absent = lua_isnil ( L, -1 );
+         lua_pop ( L, 1 );
+         if ( absent )
+         {
+            lua_pushvalue ( L, -2 );
+            lua_insert ( L, -2 );
+            lua_rawset ( L, child );
+            continue;
+         }
+      }
+      lua_pop ( L, 1 );
+   }
+
+   lua_pushvalue ( L, child );
+   lua_tinker::class_meta ( L );
+   lua_pushstring ( L, "__index" );
+   lua_pushvalue ( L, parent );
+   lua_rawset ( L, -3 );
+   lua_pop ( L, 2 );
 }
 
-void lua_tinker::table_obj::dec_ref ( )
+/*---------------------------------------------------------------------------*/
+// stack: -2.子类table -1.父类table
+// 把父类的方法和成员变量展开到子类中，这样访问继承来的成员只需一次查找
+void lua_tinker::class_inherit ( lua_State *L )
 {
-   if ( --m_ref == 0 )
-      delete this;
+   int child = lua_gettop ( L ) - 1;
+   int parent = child + 1;
+
+   flatten ( L, child, parent );
+
+   // 在父类里记下子类，父类以后注册成员变量时要一起切换成meta_get
+   lua_pushstring ( L, "__derived" );
+   lua_rawget ( L, parent );
+   if ( !lua_istable ( L, -1 ) )
+   {
+      lua_pop ( L, 1 );
+      lua_newtable ( L );
+      lua_pushstring ( L, "__derived" );
+      lua_pushvalue ( L, -2 );
+      lua_rawset ( L, parent );
+   }
+   lua_pushvalue ( L, child );
+   lua_rawseti ( L, -2, ( lua_Integer ) lua_rawlen ( L, -2 ) + 1 );
+   lua_pop ( L, 1 );
+
+   // 父类有成员变量，子类也要走meta_get
+   lua_pushstring ( L, "__index" );
+   lua_rawget ( L, parent );
+   bool fields = lua_iscfunction ( L, -1 ) != 0;
+   lua_pop ( L, 1 );
+   if ( fields )
+   {
+      lua_pushvalue ( L, child );
+      class_fields ( L );
+      lua_pop ( L, 1 );
+   }
 }
 
-bool lua_tinker::table_obj::validate ( )
+/*---------------------------------------------------------------------------*/
+// 栈顶类table（以及它的所有子类）的__index换成meta_get
+void lua_tinker::class_fields ( lua_State *L )
 {
-   if ( m_pointer != NULL )
+   lua_pushstring ( L, "__index" );
+   lua_rawget ( L, -2 );
+   bool done = lua_iscfunction ( L, -1 ) != 0;
+   lua_pop ( L, 1 );
+   if ( done )
+      return;
+
+   lua_pushstring ( L, "__index" );
+   lua_pushvalue ( L, -2 );
+   lua_pushcclosure ( L, meta_get, 1 );
+   lua_rawset ( L, -3 );
+
+   lua_pushstring ( L, "__derived" );
+   lua_rawget ( L, -2 );
+   if ( lua_istable ( L, -1 ) )
    {
-      if ( m_pointer == lua_topointer ( m_L, m_index ) )
+      lua_Integer n = ( lua_Integer ) lua_rawlen ( L, -1 );
+      for ( lua_Integer i = 1; i <= n; ++i )
       {
-         return true;
+         lua_rawgeti ( L, -1, i );
+         class_fields ( L );
+         lua_pop ( L, 1 );
       }
-      else
-      {
-         int top = lua_gettop ( m_L );
+   }
+   lua_pop ( L, 1 );
+}
 
-         for ( int i = 1; i <= top; ++i )
-         {
-            if ( m_pointer == lua_topointer ( m_L, i ) )
-            {
-               m_index = i;
-               return true;
-            }
-         }
+/*---------------------------------------------------------------------------*/
+/* table object in registry                                                  */
+/*---------------------------------------------------------------------------*/
+lua_tinker::table_obj::table_obj ( lua_State* L, int index )
+   :m_L ( main_thread ( L ) )
+   , m_count ( 0 )
+{
+   // nil得到LUA_REFNIL，不占用registry
+   lua_pushvalue ( L, index );
+   m_ref = luaL_ref ( L, LUA_REGISTRYINDEX );
+}
 
-         m_pointer = NULL;
-         return false;
-      }
-   }
-   else
-   {
-      return false;
-   }
+lua_tinker::table_obj::~table_obj ( )
+{
+   luaL_unref ( m_L, LUA_REGISTRYINDEX, m_ref );
+}
+
+void lua_tinker::table_obj::inc_ref ( )
+{
+   ++m_count;
+}
+
+void lua_tinker::table_obj::dec_ref ( )
+{
+   if ( --m_count == 0 )
+      delete this;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -661,36 +943,31 @@ lua_tinker::table::table ( lua_State* L )
 {
    lua_newtable ( L );
 
-   m_obj = new table_obj ( L, lua_gettop ( L ) );
+   m_obj = new table_obj ( L, -1 );
+   lua_pop ( L, 1 );
 
    m_obj->inc_ref ( );
 }
 
 lua_tinker::table::table ( lua_State* L, const char* name )
 {
-   lua_getglobal ( L, name );
-
-   if ( lua_istable ( L, -1 ) == 0 )
+   if ( lua_getglobal ( L, name ) != LUA_TTABLE )
    {
       lua_pop ( L, 1 );
 
       lua_newtable ( L );
+      lua_pushvalue ( L, -1 );
       lua_setglobal ( L, name );
-      lua_getglobal ( L, name );
    }
 
-   m_obj = new table_obj ( L, lua_gettop ( L ) );
+   m_obj = new table_obj ( L, -1 );
+   lua_pop ( L, 1 );
 
    m_obj->inc_ref ( );
 }
 
 lua_tinker::table::table ( lua_State* L, int index )
 {
-   if ( index < 0 )
-   {
-      index = lua_gettop ( L ) + index + 1;
-   }
-
    m_obj = new table_obj ( L, index );
 
    m_obj->inc_ref ( );
@@ -703,6 +980,14 @@ lua_tinker::table::table ( const table& input )
    m_obj->inc_ref ( );
 }
 
+lua_tinker::table& lua_tinker::table::operator= ( const table& input )
+{
+   input.m_obj->inc_ref ( );
+   m_obj->dec_ref ( );
+   m_obj = input.m_obj;
+   return *this;
+}
+
 lua_tinker::table::~table ( )
 {
    m_obj->dec_ref ( );
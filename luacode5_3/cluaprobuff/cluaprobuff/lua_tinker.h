@@ -10,6 +10,19 @@
 #define _LUA_TINKER_H_
 
 #include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <unordered_map>
+#if __cplusplus >= 201703L || ( defined ( _MSVC_LANG ) && _MSVC_LANG >= 201703L )
+#define LUA_TINKER_CPP17
+#include <optional>
+#include <string_view>
+#endif
 #include "lua.h"
 #include "lauxlib.h"
 #include <string.h>
@@ -35,10 +48,44 @@ namespace lua_tinker
       virtual void to_lua ( lua_State *L ) = 0;
    };
 
+   // binary buffer
+   // 指针+长度，二进制安全（可以包含'\0'，不用strlen），用来传递序列化后的消息等
+   // 压栈时默认复制成lua string；external()创建的不复制，lua string直接引用这块内存
+   // 从lua读出时指向lua string的内容，和const char*一样只在该string还被lua引用时有效
+   struct buffer
+   {
+      buffer ( ) : m_data ( NULL ), m_size ( 0 ), m_external ( false ), m_free ( NULL ), m_ud ( NULL ) {}
+      buffer ( const void* data, size_t size ) : m_data ( ( const char* ) data ), m_size ( size ), m_external ( false ), m_free ( NULL ), m_ud ( NULL ) {}
+
+      // 不复制（见lua_pushexternalstring）：data[size]必须是'\0'，并且在lua回收这个string之前保持有效且不变；
+      // frel不是NULL时，lua不再需要它时调用frel(ud, data, size + 1, 0)
+      // 不超过LUAI_MAXSHORTLEN的短字符串仍然会复制
+      static buffer external ( const void* data, size_t size, lua_Alloc frel = NULL, void* ud = NULL )
+      {
+         buffer b ( data, size );
+         b.m_external = true;
+         b.m_free = frel;
+         b.m_ud = ud;
+         return b;
+      }
+
+      const char* data ( ) const { return m_data; }
+      size_t size ( ) const { return m_size; }
+
+      const char*     m_data;
+      size_t          m_size;
+      bool            m_external; // 是否不复制
+      lua_Alloc       m_free;     // external时释放data的函数
+      void*           m_ud;
+   };
+
    // type trait
    template<typename T> struct class_name;
    struct table;
 
+   // 压入类型T的类table（即对象的metatable）
+   template<typename T> void push_meta ( lua_State *L );
+
    // 编译期间的if，如果C是true就是A类型，false就是B类型
    template<bool C, typename A, typename B> struct if_ {};
    template<typename A, typename B>        struct if_ < true, A, B > { typedef A type; };
@@ -99,6 +146,20 @@ namespace lua_tinker
    template<> struct is_obj < long long > { static const bool value = false; };
    template<> struct is_obj < unsigned long long > { static const bool value = false; };
    template<> struct is_obj < table > { static const bool value = false; };
+   template<> struct is_obj < buffer > { static const bool value = false; };
+
+   // 按值转换成lua string/table的STL类型，具体转换见后面stl_conv的特化
+   template<typename A>
+   struct stl_conv { static const bool value = false; };
+
+   // 判断是否是STL值类型（包括它的引用，不包括指针，指针仍然作为对象传入）
+   template<typename A>
+   struct is_stl { static const bool value = stl_conv<typename class_type<A>::type>::value && !is_ptr<A>::value; };
+
+   // 函数参数读取时的类型
+   // const std::vector<int>&这样的参数读成值，临时对象一直活到函数调用结束
+   template<typename A>
+   struct arg_type { typedef typename if_<is_stl<A>::value && is_ref<A>::value, typename class_type<A>::type, A>::type type; };
 
    /////////////////////////////////
    // 数组引用 sizeof(no_type) == 1  sizeof(yes_type) == 2
@@ -169,11 +230,12 @@ namespace lua_tinker
       }
    };
 
-   // 存储指针的类
+   // 存储指针的类（userdata的开头）
+   // 没有虚函数：值对象直接构造在同一块userdata里user的后面，m_p指向它；
+   // 指针和引用只保存m_p
    struct user
    {
       user ( void* p ) : m_p ( p ) {}
-      virtual ~user ( ) {}
       void* m_p;
    };
 
@@ -202,70 +264,66 @@ namespace lua_tinker
       }
    };
 
-   // 将lua栈上索引的枚举值或者userdata转换为相对应的类型
+   // 将lua栈上索引的string/table转换为STL值
+   template<typename T>
+   struct lua2stl { static T invoke ( lua_State *L, int index ) { T t; stl_conv<T>::read ( L, index, t ); return t; } };
+
+   // 将lua栈上索引的枚举值、STL值或者userdata转换为相对应的类型
    template<typename T>
    T lua2type ( lua_State *L, int index )
    {
       return  if_<is_enum<T>::value
          , lua2enum<T>
+         , typename if_<is_stl<T>::value && !is_ref<T>::value
+         , lua2stl<T>
          , lua2object<T>
+         >::type
       >::type::invoke ( L, index );
    }
 
    // val转换到user
+   // T对象构造在userdata中user之后（按T的对齐要求对齐），整个对象只有一次分配
    template<typename T>
-   struct val2user : user
+   struct val2user
    {
-      val2user ( ) : user ( new T ) {}
-
-      template<typename T1>
-      val2user ( T1 t1 ) : user ( new T ( t1 ) ) {}
+      static const size_t align = std::alignment_of<T>::value;
 
-      template<typename T1, typename T2>
-      val2user ( T1 t1, T2 t2 ) : user ( new T ( t1, t2 ) ) {}
+      // userdata的大小，对齐要求超过user时留出调整的余量
+      static size_t size ( ) { return sizeof ( user ) + sizeof ( T ) + ( align > std::alignment_of<user>::value ? align : 0 ); }
 
-      template<typename T1, typename T2, typename T3>
-      val2user ( T1 t1, T2 t2, T3 t3 ) : user ( new T ( t1, t2, t3 ) ) {}
+      // user后面存放T对象的位置
+      static void* storage ( user* u ) { return ( void* ) ( ( ( size_t ) ( u + 1 ) + align - 1 ) & ~( align - 1 ) ); }
 
-      template<typename T1, typename T2, typename T3, typename T4>
-      val2user ( T1 t1, T2 t2, T3 t3, T4 t4 ) : user ( new T ( t1, t2, t3, t4 ) ) {}
-
-      template<typename T1, typename T2, typename T3, typename T4, typename T5>
-      val2user ( T1 t1, T2 t2, T3 t3, T4 t4, T5 t5 ) : user ( new T ( t1, t2, t3, t4, t5 ) ) {}
-
-      // 只有lua调用new在C++堆上分配内存才会被__gc
-      ~val2user ( ) { delete ( ( T* ) m_p ); }
-   };
-
-   // ptr转化到user
-   template<typename T>
-   struct ptr2user : user
-   {
-      // 指针传入不会被__gc
-      ptr2user ( T* t ) : user ( ( void* ) t ) {}
-   };
+      // 压入新userdata并在其中构造T，构造成功后才设置m_p，
+      // 这样构造函数抛出异常时__gc不会去析构它
+      template<typename... Args>
+      static void create ( lua_State *L, Args&&... args )
+      {
+         user* u = new( lua_newuserdata ( L, size ( ) ) ) user ( NULL );
+         u->m_p = new( storage ( u ) ) T ( std::forward<Args> ( args )... );
+      }
 
-   // ref转化到user
-   template<typename T>
-   struct ref2user : user
-   {
-      // 引用传入不会被__gc
-      ref2user ( T& t ) : user ( &t ) {}
+      // 只有构造在userdata中的对象才会被__gc
+      static void destroy ( user* u )
+      {
+         if ( u->m_p == storage ( u ) )
+            ( ( T* ) u->m_p )->~T ( );
+      }
    };
 
    // to lua
    // 值传入lua 
-   // 方法：val2user<T> 分配在lua上，而T类型input分配在C++堆上，通过val2user<T>中的指针指向
+   // 方法：T对象移动构造到lua分配的userdata里
    template<typename T>
-   struct val2lua { static void invoke ( lua_State *L, T& input ){ new( lua_newuserdata ( L, sizeof ( val2user<T> ) ) ) val2user<T> ( input ); } };
+   struct val2lua { static void invoke ( lua_State *L, T& input ){ val2user<T>::create ( L, std::move ( input ) ); } };
    // 指针传入lua 
-   // 方法：ptr2user<T> 分配在lua上，而T指针input存在C++中，通过ptr2user<T>中的指针指向
+   // 方法：user分配在lua上，而T指针input存在C++中，通过user中的指针指向，不会被__gc
    template<typename T>
-   struct ptr2lua { static void invoke ( lua_State *L, T* input ){ if ( input ) new( lua_newuserdata ( L, sizeof ( ptr2user<T> ) ) ) ptr2user<T> ( input ); else lua_pushnil ( L ); } };
+   struct ptr2lua { static void invoke ( lua_State *L, T* input ){ if ( input ) new( lua_newuserdata ( L, sizeof ( user ) ) ) user ( ( void* ) input ); else lua_pushnil ( L ); } };
    template<typename T>
-   // 指针传入lua 
-   // 方法：ref2user<T> 分配在lua上，而T引用input存在C++中，通过ref2user<T>中的指针指向
-   struct ref2lua { static void invoke ( lua_State *L, T& input ){ new( lua_newuserdata ( L, sizeof ( ref2user<T> ) ) ) ref2user<T> ( input ); } };
+   // 引用传入lua 
+   // 方法：user分配在lua上，而T引用input存在C++中，通过user中的指针指向，不会被__gc
+   struct ref2lua { static void invoke ( lua_State *L, T& input ){ new( lua_newuserdata ( L, sizeof ( user ) ) ) user ( ( void* ) &input ); } };
 
    // 枚举传入lua
    template<typename T>
@@ -286,19 +344,26 @@ namespace lua_tinker
          >::type::invoke ( L, val );
 
          // set C++对象传入lua 设置metatable
-         push_meta ( L, class_name<typename class_type<T>::type>::name ( ) );
+         push_meta<typename class_type<T>::type> ( L );
          lua_setmetatable ( L, -2 );
       }
    };
 
+   // STL值传入lua，转换成string/table
+   template<typename T>
+   struct stl2lua { static void invoke ( lua_State *L, const typename class_type<T>::type& val ) { stl_conv<typename class_type<T>::type>::push ( L, val ); } };
+
    // 类型传入lua
    template<typename T>
    void type2lua ( lua_State *L, T val )
    {
       if_<is_enum<T>::value
          , enum2lua<T>
+         , typename if_<is_stl<T>::value
+         , stl2lua<T>
          , object2lua<T>
-      >::type::invoke ( L, val );
+         >::type
+      >::type::invoke ( L, std::forward<T> ( val ) );
    }
 
    // get value from cclosure
@@ -330,10 +395,11 @@ namespace lua_tinker
    template<>  long long           read ( lua_State *L, int index );
    template<>  unsigned long long  read ( lua_State *L, int index );
    template<>  table               read ( lua_State *L, int index );
+   template<>  buffer              read ( lua_State *L, int index );
 
    // push a value to lua stack 
    template<typename T>
-   void push ( lua_State *L, T ret )                  { type2lua<T> ( L, ret ); }
+   void push ( lua_State *L, T ret )                  { type2lua<T> ( L, std::forward<T> ( ret ) ); }
 
    template<>  void push ( lua_State *L, char ret );
    template<>  void push ( lua_State *L, unsigned char ret );
@@ -352,400 +418,588 @@ namespace lua_tinker
    template<>  void push ( lua_State *L, long long ret );
    template<>  void push ( lua_State *L, unsigned long long ret );
    template<>  void push ( lua_State *L, table ret );
+   template<>  void push ( lua_State *L, buffer ret );
 
    // pop a value from lua stack
    template<typename T>
    T pop ( lua_State *L ) { T t = read<T> ( L, -1 ); lua_pop ( L, 1 ); return t; }
 
    template<>  void    pop ( lua_State *L );
-   template<>  table   pop ( lua_State *L );
 
-   // functor (with return value)
-   // C函数
-   // upvalue_<>(L)获取函数指针
-   // 执行该函数，并压入栈
-   template<typename RVal, typename T1 = void, typename T2 = void, typename T3 = void, typename T4 = void, typename T5 = void>
-   struct functor
-   {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, upvalue_<RVal ( *)( T1, T2, T3, T4, T5 )> ( L )( read<T1> ( L, 1 ), read<T2> ( L, 2 ), read<T3> ( L, 3 ), read<T4> ( L, 4 ), read<T5> ( L, 5 ) ) ); return 1; }
-   };
+   // 读到已有的变量里
+   // STL值会复用变量已有的空间：std::string/std::vector保留容量，容器先clear再填充
+   template<typename T>
+   struct read_assign { static void invoke ( lua_State *L, int index, T& out ) { out = read<T> ( L, index ); } };
+   template<typename T>
+   struct read_stl { static void invoke ( lua_State *L, int index, T& out ) { stl_conv<T>::read ( L, index, out ); } };
 
-   template<typename RVal, typename T1, typename T2, typename T3, typename T4>
-   struct functor < RVal, T1, T2, T3, T4 >
+   template<typename T>
+   void read_into ( lua_State *L, int index, T& out )
    {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, upvalue_<RVal ( *)( T1, T2, T3, T4 )> ( L )( read<T1> ( L, 1 ), read<T2> ( L, 2 ), read<T3> ( L, 3 ), read<T4> ( L, 4 ) ) ); return 1; }
-   };
+      if_<is_stl<T>::value
+         , read_stl<T>
+         , read_assign<T>
+      >::type::invoke ( L, index, out );
+   }
 
-   template<typename RVal, typename T1, typename T2, typename T3>
-   struct functor < RVal, T1, T2, T3 >
-   {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, upvalue_<RVal ( *)( T1, T2, T3 )> ( L )( read<T1> ( L, 1 ), read<T2> ( L, 2 ), read<T3> ( L, 3 ) ) ); return 1; }
-   };
+   // 压入容器的元素：STL值按引用转换，其它类型按值压入
+   template<typename T>
+   struct push_copy { static void invoke ( lua_State *L, const T& val ) { push<T> ( L, val ); } };
 
-   template<typename RVal, typename T1, typename T2>
-   struct functor < RVal, T1, T2 >
+   template<typename T>
+   void push_item ( lua_State *L, const T& val )
    {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, upvalue_<RVal ( *)( T1, T2 )> ( L )( read<T1> ( L, 1 ), read<T2> ( L, 2 ) ) ); return 1; }
-   };
+      if_<is_stl<T>::value
+         , stl2lua<T>
+         , push_copy<T>
+      >::type::invoke ( L, val );
+   }
 
-   template<typename RVal, typename T1>
-   struct functor < RVal, T1 >
-   {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, upvalue_<RVal ( *)( T1 )> ( L )( read<T1> ( L, 1 ) ) ); return 1; }
-   };
+   // 编译期整数序列，用来把参数包展开成栈上的索引
+   // 自己实现，不依赖C++14的std::index_sequence
+   template<int... Is>
+   struct index_seq {};
+   template<int N, int... Is>
+   struct make_index_seq : make_index_seq < N - 1, N - 1, Is... > {};
+   template<int... Is>
+   struct make_index_seq < 0, Is... > { typedef index_seq<Is...> type; };
+
+   // STL conversion
+   // 字符串对应lua string；序列容器、std::pair、std::tuple对应数组table；
+   // map对应以key为键的table，std::optional为空时对应nil
+   // 压栈时用lua_createtable按元素个数预分配，再lua_rawseti/lua_rawset填充
+   // 非table读出空容器，和数字读出0一样不报错
+
+   // 数组table中的元素个数
+   inline int stl_len ( lua_State *L, int index )
+   {
+      return lua_istable ( L, index ) ? ( int ) lua_rawlen ( L, index ) : 0;
+   }
 
-   template<typename RVal>
-   struct functor < RVal >
+   // 压入序列容器C
+   template<typename C>
+   void push_seq ( lua_State *L, const C& c )
    {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, upvalue_<RVal ( *)( )> ( L )( ) ); return 1; }
-   };
+      luaL_checkstack ( L, 2, "lua_tinker: container too deep" );
+      lua_createtable ( L, ( int ) c.size ( ), 0 );
+      int i = 0;
+      for ( typename C::const_iterator it = c.begin ( ); it != c.end ( ); ++it )
+      {
+         push_item<typename C::value_type> ( L, *it );
+         lua_rawseti ( L, -2, ++i );
+      }
+   }
 
-   // functor (without return value)
-   // C函数
-   // upvalue_<>(L)获取函数指针
-   // 执行该函数，不用压入栈
-   template<typename T1, typename T2, typename T3, typename T4, typename T5>
-   struct functor < void, T1, T2, T3, T4, T5 >
+   // 压入map类容器C
+   template<typename C>
+   void push_map ( lua_State *L, const C& c )
    {
-      static int invoke ( lua_State *L ) { upvalue_<void ( *)( T1, T2, T3, T4, T5 )> ( L )( read<T1> ( L, 1 ), read<T2> ( L, 2 ), read<T3> ( L, 3 ), read<T4> ( L, 4 ), read<T5> ( L, 5 ) ); return 0; }
-   };
+      luaL_checkstack ( L, 3, "lua_tinker: container too deep" );
+      lua_createtable ( L, 0, ( int ) c.size ( ) );
+      for ( typename C::const_iterator it = c.begin ( ); it != c.end ( ); ++it )
+      {
+         push_item<typename C::key_type> ( L, it->first );
+         push_item<typename C::mapped_type> ( L, it->second );
+         lua_rawset ( L, -3 );
+      }
+   }
 
-   template<typename T1, typename T2, typename T3, typename T4>
-   struct functor < void, T1, T2, T3, T4 >
+   // 读出map类容器C
+   template<typename C>
+   void read_map ( lua_State *L, int index, C& out )
    {
-      static int invoke ( lua_State *L ) { upvalue_<void ( *)( T1, T2, T3, T4 )> ( L )( read<T1> ( L, 1 ), read<T2> ( L, 2 ), read<T3> ( L, 3 ), read<T4> ( L, 4 ) ); return 0; }
-   };
+      out.clear ( );
+      if ( !lua_istable ( L, index ) )
+         return;
 
-   template<typename T1, typename T2, typename T3>
-   struct functor < void, T1, T2, T3 >
-   {
-      static int invoke ( lua_State *L ) { upvalue_<void ( *)( T1, T2, T3 )> ( L )( read<T1> ( L, 1 ), read<T2> ( L, 2 ), read<T3> ( L, 3 ) ); return 0; }
-   };
+      luaL_checkstack ( L, 3, "lua_tinker: container too deep" );
+      index = lua_absindex ( L, index );
+      typename C::key_type key;
+      lua_pushnil ( L );
+      while ( lua_next ( L, index ) )
+      {
+         // 用key的副本转换，避免lua_tolstring改变key打乱lua_next
+         lua_pushvalue ( L, -2 );
+         read_into ( L, -1, key );
+         lua_pop ( L, 1 );
+         read_into ( L, -1, out[key] );
+         lua_pop ( L, 1 );
+      }
+   }
 
-   template<typename T1, typename T2>
-   struct functor < void, T1, T2 >
+   template<typename Ch, typename Tr, typename A>
+   struct stl_conv < std::basic_string<Ch, Tr, A> >
    {
-      static int invoke ( lua_State *L ) { upvalue_<void ( *)( T1, T2 )> ( L )( read<T1> ( L, 1 ), read<T2> ( L, 2 ) ); return 0; }
+      static const bool value = true;
+      static void push ( lua_State *L, const std::basic_string<Ch, Tr, A>& v ) { lua_pushlstring ( L, ( const char* ) v.data ( ), v.size ( ) * sizeof ( Ch ) ); }
+      static void read ( lua_State *L, int index, std::basic_string<Ch, Tr, A>& out )
+      {
+         size_t len = 0;
+         const char* s = lua_type ( L, index ) == LUA_TSTRING || lua_type ( L, index ) == LUA_TNUMBER ? lua_tolstring ( L, index, &len ) : NULL;
+         if ( s )
+            out.assign ( ( const Ch* ) s, len / sizeof ( Ch ) );
+         else
+            out.clear ( );
+      }
    };
 
-   template<typename T1>
-   struct functor < void, T1 >
+   template<typename V, typename A>
+   struct stl_conv < std::vector<V, A> >
    {
-      static int invoke ( lua_State *L ) { upvalue_<void ( *)( T1 )> ( L )( read<T1> ( L, 1 ) ); return 0; }
+      static const bool value = true;
+      static void push ( lua_State *L, const std::vector<V, A>& v ) { push_seq ( L, v ); }
+      static void read ( lua_State *L, int index, std::vector<V, A>& out )
+      {
+         // resize不会缩小容量，复用的vector不重新分配
+         int n = stl_len ( L, index );
+         out.resize ( n );
+         luaL_checkstack ( L, 1, "lua_tinker: container too deep" );
+         for ( int i = 0; i < n; ++i )
+         {
+            lua_rawgeti ( L, index, i + 1 );
+            read_into ( L, -1, out[i] );
+            lua_pop ( L, 1 );
+         }
+      }
    };
 
-   template<>
-   struct functor < void >
+   // std::vector<bool>的元素不能取引用
+   template<typename A>
+   struct stl_conv < std::vector<bool, A> >
    {
-      static int invoke ( lua_State *L ) { upvalue_<void ( *)( )> ( L )( ); return 0; }
+      static const bool value = true;
+      static void push ( lua_State *L, const std::vector<bool, A>& v ) { push_seq ( L, v ); }
+      static void read ( lua_State *L, int index, std::vector<bool, A>& out )
+      {
+         int n = stl_len ( L, index );
+         out.resize ( n );
+         for ( int i = 0; i < n; ++i )
+         {
+            lua_rawgeti ( L, index, i + 1 );
+            out[i] = lua_toboolean ( L, -1 ) != 0;
+            lua_pop ( L, 1 );
+         }
+      }
    };
 
-   // functor (non-managed)
-   template<typename T1>
-   struct functor < int, lua_State*, T1 >
+   template<typename V, size_t N>
+   struct stl_conv < std::array<V, N> >
    {
-      static int invoke ( lua_State *L ) { return upvalue_<int ( *)( lua_State*, T1 )> ( L )( L, read<T1> ( L, 1 ) ); }
+      static const bool value = true;
+      static void push ( lua_State *L, const std::array<V, N>& v ) { push_seq ( L, v ); }
+      static void read ( lua_State *L, int index, std::array<V, N>& out )
+      {
+         // 不是table时各元素读nil
+         bool t = lua_istable ( L, index );
+         luaL_checkstack ( L, 1, "lua_tinker: container too deep" );
+         for ( size_t i = 0; i < N; ++i )
+         {
+            if ( t )
+               lua_rawgeti ( L, index, i + 1 );
+            else
+               lua_pushnil ( L );
+            read_into ( L, -1, out[i] );
+            lua_pop ( L, 1 );
+         }
+      }
    };
 
-   template<>
-   struct functor < int, lua_State* >
+   template<typename K, typename V, typename C, typename A>
+   struct stl_conv < std::map<K, V, C, A> >
    {
-      static int invoke ( lua_State *L ) { return upvalue_<int ( *)( lua_State* )> ( L )( L ); }
+      static const bool value = true;
+      static void push ( lua_State *L, const std::map<K, V, C, A>& v ) { push_map ( L, v ); }
+      static void read ( lua_State *L, int index, std::map<K, V, C, A>& out ) { read_map ( L, index, out ); }
    };
 
-   // push_functor
-   // 将栈上数据（函数指针）压入functor<>::invoke闭包
-   // 并压入该函数
-   template<typename RVal>
-   void push_functor ( lua_State *L, RVal ( *func )( ) )
-   {
-      ( void ) func;
-      lua_pushcclosure ( L, functor<RVal>::invoke, 1 );
-   }
-
-   template<typename RVal, typename T1>
-   void push_functor ( lua_State *L, RVal ( *func )( T1 ) )
-   {
-      ( void ) func;
-      lua_pushcclosure ( L, functor<RVal, T1>::invoke, 1 );
-   }
-
-   template<typename RVal, typename T1, typename T2>
-   void push_functor ( lua_State *L, RVal ( *func )( T1, T2 ) )
+   // clear不释放桶数组，复用时不重新分配
+   template<typename K, typename V, typename H, typename E, typename A>
+   struct stl_conv < std::unordered_map<K, V, H, E, A> >
    {
-      ( void ) func;
-      lua_pushcclosure ( L, functor<RVal, T1, T2>::invoke, 1 );
-   }
+      static const bool value = true;
+      static void push ( lua_State *L, const std::unordered_map<K, V, H, E, A>& v ) { push_map ( L, v ); }
+      static void read ( lua_State *L, int index, std::unordered_map<K, V, H, E, A>& out ) { read_map ( L, index, out ); }
+   };
 
-   template<typename RVal, typename T1, typename T2, typename T3>
-   void push_functor ( lua_State *L, RVal ( *func )( T1, T2, T3 ) )
+   // {first, second}
+   template<typename A, typename B>
+   struct stl_conv < std::pair<A, B> >
    {
-      ( void ) func;
-      lua_pushcclosure ( L, functor<RVal, T1, T2, T3>::invoke, 1 );
-   }
+      static const bool value = true;
+      static void push ( lua_State *L, const std::pair<A, B>& v )
+      {
+         luaL_checkstack ( L, 2, "lua_tinker: container too deep" );
+         lua_createtable ( L, 2, 0 );
+         push_item<A> ( L, v.first );
+         lua_rawseti ( L, -2, 1 );
+         push_item<B> ( L, v.second );
+         lua_rawseti ( L, -2, 2 );
+      }
+      static void read ( lua_State *L, int index, std::pair<A, B>& out )
+      {
+         bool t = lua_istable ( L, index );
+         luaL_checkstack ( L, 1, "lua_tinker: container too deep" );
+         t ? ( void ) lua_rawgeti ( L, index, 1 ) : lua_pushnil ( L );
+         read_into ( L, -1, out.first );
+         lua_pop ( L, 1 );
+         t ? ( void ) lua_rawgeti ( L, index, 2 ) : lua_pushnil ( L );
+         read_into ( L, -1, out.second );
+         lua_pop ( L, 1 );
+      }
+   };
 
-   template<typename RVal, typename T1, typename T2, typename T3, typename T4>
-   void push_functor ( lua_State *L, RVal ( *func )( T1, T2, T3, T4 ) )
+   // 作为值时是数组table；作为函数返回值时仍然是多返回值（见push_ret）
+   template<typename... Ts>
+   struct stl_conv < std::tuple<Ts...> >
    {
-      ( void ) func;
-      lua_pushcclosure ( L, functor<RVal, T1, T2, T3, T4>::invoke, 1 );
-   }
+      static const bool value = true;
 
-   template<typename RVal, typename T1, typename T2, typename T3, typename T4, typename T5>
-   void push_functor ( lua_State *L, RVal ( *func )( T1, T2, T3, T4, T5 ) )
-   {
-      ( void ) func;
-      lua_pushcclosure ( L, functor<RVal, T1, T2, T3, T4, T5>::invoke, 1 );
-   }
+      template<int... Is>
+      static void push ( lua_State *L, const std::tuple<Ts...>& v, index_seq<Is...> )
+      {
+         int dummy[] = { 0, ( push_item<Ts> ( L, std::get<Is> ( v ) ), lua_rawseti ( L, -2, Is + 1 ), 0 )... };
+         ( void ) dummy;
+      }
+      static void push ( lua_State *L, const std::tuple<Ts...>& v )
+      {
+         luaL_checkstack ( L, 2, "lua_tinker: container too deep" );
+         lua_createtable ( L, ( int ) sizeof...( Ts ), 0 );
+         push ( L, v, typename make_index_seq<sizeof...( Ts )>::type ( ) );
+      }
 
-   // member variable
-   struct var_base
-   {
-      virtual ~var_base ( ) {};
-      virtual void get ( lua_State *L ) = 0;
-      virtual void set ( lua_State *L ) = 0;
+      template<int... Is>
+      static void read ( lua_State *L, int index, std::tuple<Ts...>& out, index_seq<Is...> )
+      {
+         bool t = lua_istable ( L, index );
+         int dummy[] = { 0, ( t ? ( void ) lua_rawgeti ( L, index, Is + 1 ) : lua_pushnil ( L ), read_into ( L, -1, std::get<Is> ( out ) ), lua_pop ( L, 1 ), 0 )... };
+         ( void ) dummy;
+      }
+      static void read ( lua_State *L, int index, std::tuple<Ts...>& out )
+      {
+         luaL_checkstack ( L, 1, "lua_tinker: container too deep" );
+         read ( L, index, out, typename make_index_seq<sizeof...( Ts )>::type ( ) );
+      }
    };
 
-   template<typename T, typename V>
-   struct mem_var : var_base
+#if defined(LUA_TINKER_CPP17)
+   // 读出的string_view指向lua字符串，和const char*一样只在该值还被lua引用时有效
+   template<typename Ch, typename Tr>
+   struct stl_conv < std::basic_string_view<Ch, Tr> >
    {
-      V T::*_var;
-      mem_var ( V T::*val ) : _var ( val ) {}
-      void get ( lua_State *L )  { push<typename if_<is_obj<V>::value, V&, V>::type> ( L, read<T*> ( L, 1 )->*( _var ) ); }
-      void set ( lua_State *L )  { read<T*> ( L, 1 )->*( _var ) = read<V> ( L, 3 ); }
+      static const bool value = true;
+      static void push ( lua_State *L, const std::basic_string_view<Ch, Tr>& v ) { lua_pushlstring ( L, ( const char* ) v.data ( ), v.size ( ) * sizeof ( Ch ) ); }
+      static void read ( lua_State *L, int index, std::basic_string_view<Ch, Tr>& out )
+      {
+         size_t len = 0;
+         const char* s = lua_type ( L, index ) == LUA_TSTRING ? lua_tolstring ( L, index, &len ) : NULL;
+         out = s ? std::basic_string_view<Ch, Tr> ( ( const Ch* ) s, len / sizeof ( Ch ) ) : std::basic_string_view<Ch, Tr> ( );
+      }
    };
 
-   // class member functor (with return value)
-   template<typename RVal, typename T, typename T1 = void, typename T2 = void, typename T3 = void, typename T4 = void, typename T5 = void>
-   struct mem_functor
+   template<typename V>
+   struct stl_conv < std::optional<V> >
    {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, ( read<T*> ( L, 1 )->*upvalue_<RVal ( T::* )( T1, T2, T3, T4, T5 )> ( L ) )( read<T1> ( L, 2 ), read<T2> ( L, 3 ), read<T3> ( L, 4 ), read<T4> ( L, 5 ), read<T5> ( L, 6 ) ) );; return 1; }
+      static const bool value = true;
+      static void push ( lua_State *L, const std::optional<V>& v )
+      {
+         if ( v )
+            push_item<V> ( L, *v );
+         else
+            lua_pushnil ( L );
+      }
+      static void read ( lua_State *L, int index, std::optional<V>& out )
+      {
+         if ( lua_isnil ( L, index ) )
+         {
+            out.reset ( );
+            return;
+         }
+         if ( !out )
+            out.emplace ( );
+         read_into ( L, index, *out );
+      }
    };
+#endif
 
-   template<typename RVal, typename T, typename T1, typename T2, typename T3, typename T4>
-   struct mem_functor < RVal, T, T1, T2, T3, T4 >
-   {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, ( read<T*> ( L, 1 )->*upvalue_<RVal ( T::* )( T1, T2, T3, T4 )> ( L ) )( read<T1> ( L, 2 ), read<T2> ( L, 3 ), read<T3> ( L, 4 ), read<T4> ( L, 5 ) ) ); return 1; }
-   };
+   // 返回值压栈，返回压入的个数
+   // std::tuple的每个元素分别压栈，作为多返回值
+   template<typename RVal>
+   struct push_ret { static int invoke ( lua_State *L, RVal ret ) { push<RVal> ( L, std::forward<RVal> ( ret ) ); return 1; } };
 
-   template<typename RVal, typename T, typename T1, typename T2, typename T3>
-   struct mem_functor < RVal, T, T1, T2, T3 >
+   template<typename... Ts>
+   struct push_ret < std::tuple<Ts...> >
    {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, ( read<T*> ( L, 1 )->*upvalue_<RVal ( T::* )( T1, T2, T3 )> ( L ) )( read<T1> ( L, 2 ), read<T2> ( L, 3 ), read<T3> ( L, 4 ) ) ); return 1; }
-   };
+      static int invoke ( lua_State *L, const std::tuple<Ts...>& ret ) { return invoke ( L, ret, typename make_index_seq<sizeof...( Ts )>::type ( ) ); }
 
-   template<typename RVal, typename T, typename T1, typename T2>
-   struct mem_functor < RVal, T, T1, T2 >
-   {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, ( read<T*> ( L, 1 )->*upvalue_<RVal ( T::* )( T1, T2 )> ( L ) )( read<T1> ( L, 2 ), read<T2> ( L, 3 ) ) ); return 1; }
+      template<int... Is>
+      static int invoke ( lua_State *L, const std::tuple<Ts...>& ret, index_seq<Is...> )
+      {
+         int dummy[] = { 0, ( push<Ts> ( L, std::get<Is> ( ret ) ), 0 )... };
+         ( void ) dummy;
+         return sizeof...( Ts );
+      }
    };
 
-   template<typename RVal, typename T, typename T1>
-   struct mem_functor < RVal, T, T1 >
+   // caller
+   // 从栈上Base开始依次读出参数Args...，调用f（或者obj->*f），返回值压栈
+   template<typename RVal, int Base, typename... Args>
+   struct caller
    {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, ( read<T*> ( L, 1 )->*upvalue_<RVal ( T::* )( T1 )> ( L ) )( read<T1> ( L, 2 ) ) ); return 1; }
-   };
+      template<typename F, int... Is>
+      static int call ( lua_State *L, F& f, index_seq<Is...> ) { return push_ret<RVal>::invoke ( L, f ( read<typename arg_type<Args>::type> ( L, Base + Is )... ) ); }
 
-   template<typename RVal, typename T>
-   struct mem_functor < RVal, T >
-   {
-      static int invoke ( lua_State *L ) { push<RVal> ( L, ( read<T*> ( L, 1 )->*upvalue_<RVal ( T::* )( )> ( L ) )( ) ); return 1; }
+      template<typename T, typename F, int... Is>
+      static int call ( lua_State *L, T* obj, F f, index_seq<Is...> ) { return push_ret<RVal>::invoke ( L, ( obj->*f )( read<typename arg_type<Args>::type> ( L, Base + Is )... ) ); }
    };
 
-   // class member functor (without return value)
-   template<typename T, typename T1, typename T2, typename T3, typename T4, typename T5>
-   struct mem_functor < void, T, T1, T2, T3, T4, T5 >
+   // without return value
+   template<int Base, typename... Args>
+   struct caller < void, Base, Args... >
    {
-      static int invoke ( lua_State *L )  { ( read<T*> ( L, 1 )->*upvalue_<void( T::* )( T1, T2, T3, T4, T5 )> ( L ) )( read<T1> ( L, 2 ), read<T2> ( L, 3 ), read<T3> ( L, 4 ), read<T4> ( L, 5 ), read<T5> ( L, 6 ) ); return 0; }
-   };
+      template<typename F, int... Is>
+      static int call ( lua_State *L, F& f, index_seq<Is...> ) { ( void ) L; f ( read<typename arg_type<Args>::type> ( L, Base + Is )... ); return 0; }
 
-   template<typename T, typename T1, typename T2, typename T3, typename T4>
-   struct mem_functor < void, T, T1, T2, T3, T4 >
-   {
-      static int invoke ( lua_State *L )  { ( read<T*> ( L, 1 )->*upvalue_<void( T::* )( T1, T2, T3, T4 )> ( L ) )( read<T1> ( L, 2 ), read<T2> ( L, 3 ), read<T3> ( L, 4 ), read<T4> ( L, 5 ) ); return 0; }
+      template<typename T, typename F, int... Is>
+      static int call ( lua_State *L, T* obj, F f, index_seq<Is...> ) { ( void ) L; ( obj->*f )( read<typename arg_type<Args>::type> ( L, Base + Is )... ); return 0; }
    };
 
-   template<typename T, typename T1, typename T2, typename T3>
-   struct mem_functor < void, T, T1, T2, T3 >
+   // non-managed
+   // int f(lua_State*, ...)自己操作栈，返回值就是返回给lua的个数
+   template<int Base, typename... Args>
+   struct caller < int, Base, lua_State*, Args... >
    {
-      static int invoke ( lua_State *L )  { ( read<T*> ( L, 1 )->*upvalue_<void( T::* )( T1, T2, T3 )> ( L ) )( read<T1> ( L, 2 ), read<T2> ( L, 3 ), read<T3> ( L, 4 ) ); return 0; }
-   };
+      template<typename F, int... Is>
+      static int call ( lua_State *L, F& f, index_seq<Is...> ) { return f ( L, read<typename arg_type<Args>::type> ( L, Base + Is )... ); }
 
-   template<typename T, typename T1, typename T2>
-   struct mem_functor < void, T, T1, T2 >
-   {
-      static int invoke ( lua_State *L )  { ( read<T*> ( L, 1 )->*upvalue_<void( T::* )( T1, T2 )> ( L ) )( read<T1> ( L, 2 ), read<T2> ( L, 3 ) ); return 0; }
+      template<typename T, typename F, int... Is>
+      static int call ( lua_State *L, T* obj, F f, index_seq<Is...> ) { return ( obj->*f )( L, read<typename arg_type<Args>::type> ( L, Base + Is )... ); }
    };
 
-   template<typename T, typename T1>
-   struct mem_functor < void, T, T1 >
+   // 参数个数（non-managed不算lua_State*）
+   template<typename RVal, typename... Args>
+   struct arity { typedef typename make_index_seq<sizeof...( Args )>::type type; };
+   template<typename... Args>
+   struct arity < int, lua_State*, Args... > { typedef typename make_index_seq<sizeof...( Args )>::type type; };
+
+   // functor
+   // C函数
+   // upvalue_<>(L)获取函数指针，参数从栈上1开始
+   // 执行该函数，并压入返回值
+   // F是压入时函数指针的原样类型（可能带noexcept），按同样的类型读回来
+   template<typename F, typename RVal, typename... Args>
+   struct functor
    {
-      static int invoke ( lua_State *L )  { ( read<T*> ( L, 1 )->*upvalue_<void( T::* )( T1 )> ( L ) )( read<T1> ( L, 2 ) ); return 0; }
+      static int invoke ( lua_State *L )
+      {
+         F func = upvalue_<F> ( L );
+         return caller<RVal, 1, Args...>::call ( L, func, typename arity<RVal, Args...>::type ( ) );
+      }
    };
 
-   template<typename T>
-   struct mem_functor < void, T >
+   // class member functor
+   // 对象在栈上1，参数从栈上2开始
+   // F是成员函数指针的原样类型（可能带const、noexcept）
+   template<typename F, typename RVal, typename T, typename... Args>
+   struct mem_functor
    {
-      static int invoke ( lua_State *L )  { ( read<T*> ( L, 1 )->*upvalue_<void( T::* )( )> ( L ) )( ); return 0; }
+      static int invoke ( lua_State *L )
+      {
+         return caller<RVal, 2, Args...>::call ( L, read<T*> ( L, 1 ), upvalue_<F> ( L ), typename arity<RVal, Args...>::type ( ) );
+      }
    };
 
-   // class member functor (non-managed)
-   template<typename T, typename T1>
-   struct mem_functor < int, T, lua_State*, T1 >
+   // callable object functor
+   // lambda、std::function等可调用对象F存在上值userdata里，参数从栈上1开始
+   // 用作类方法时，第一个参数就是对象本身
+   template<typename F, typename RVal, typename... Args>
+   struct obj_functor
    {
-      static int invoke ( lua_State *L ) { return ( read<T*> ( L, 1 )->*upvalue_<int( T::* )( lua_State*, T1 )> ( L ) )( L, read<T1> ( L, 2 ) ); }
+      static int invoke ( lua_State *L )
+      {
+         F& func = *( F* ) lua_touserdata ( L, lua_upvalueindex ( 1 ) );
+         return caller<RVal, 1, Args...>::call ( L, func, typename arity<RVal, Args...>::type ( ) );
+      }
    };
 
-   template<typename T>
-   struct mem_functor < int, T, lua_State* >
+   // 可调用对象不一定是POD，userdata需要__gc来析构
+   template<typename F>
+   int callable_gc ( lua_State *L )
    {
-      static int invoke ( lua_State *L ) { return ( read<T*> ( L, 1 )->*upvalue_<int( T::* )( lua_State* )> ( L ) )( L ); }
-   };
+      ( ( F* ) lua_touserdata ( L, 1 ) )->~F ( );
+      return 0;
+   }
 
    // push_functor
-   template<typename RVal, typename T>
-   void push_functor ( lua_State *L, RVal ( T::*func )( ) )
+   // 将栈上数据（函数指针）压入functor<>::invoke闭包
+   // 并压入该函数
+   template<typename RVal, typename... Args>
+   void push_functor ( lua_State *L, RVal ( *func )( Args... ) )
    {
       ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T>::invoke, 1 );
+      lua_pushcclosure ( L, functor<decltype ( func ), RVal, Args...>::invoke, 1 );
    }
 
-   template<typename RVal, typename T>
-   void push_functor ( lua_State *L, RVal ( T::*func )( ) const )
+   template<typename RVal, typename T, typename... Args>
+   void push_functor ( lua_State *L, RVal ( T::*func )( Args... ) )
    {
       ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T>::invoke, 1 );
+      lua_pushcclosure ( L, mem_functor<decltype ( func ), RVal, T, Args...>::invoke, 1 );
    }
 
-   template<typename RVal, typename T, typename T1>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1 ) )
+   template<typename RVal, typename T, typename... Args>
+   void push_functor ( lua_State *L, RVal ( T::*func )( Args... ) const )
    {
       ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1>::invoke, 1 );
+      lua_pushcclosure ( L, mem_functor<decltype ( func ), RVal, T, Args...>::invoke, 1 );
    }
 
-   template<typename RVal, typename T, typename T1>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1 ) const )
+#if defined(__cpp_noexcept_function_type)
+   // C++17起noexcept是函数类型的一部分
+   template<typename RVal, typename... Args>
+   void push_functor ( lua_State *L, RVal ( *func )( Args... ) noexcept )
    {
       ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1>::invoke, 1 );
+      lua_pushcclosure ( L, functor<decltype ( func ), RVal, Args...>::invoke, 1 );
    }
 
-   template<typename RVal, typename T, typename T1, typename T2>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1, T2 ) )
+   template<typename RVal, typename T, typename... Args>
+   void push_functor ( lua_State *L, RVal ( T::*func )( Args... ) noexcept )
    {
       ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1, T2>::invoke, 1 );
+      lua_pushcclosure ( L, mem_functor<decltype ( func ), RVal, T, Args...>::invoke, 1 );
    }
 
-   template<typename RVal, typename T, typename T1, typename T2>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1, T2 ) const )
+   template<typename RVal, typename T, typename... Args>
+   void push_functor ( lua_State *L, RVal ( T::*func )( Args... ) const noexcept )
    {
       ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1, T2>::invoke, 1 );
+      lua_pushcclosure ( L, mem_functor<decltype ( func ), RVal, T, Args...>::invoke, 1 );
    }
+#endif
 
-   template<typename RVal, typename T, typename T1, typename T2, typename T3>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1, T2, T3 ) )
+   // 可调用对象：由operator()的类型推导出返回值和参数
+   template<typename F, typename RVal, typename C, typename... Args>
+   void push_callable ( lua_State *L, RVal ( C::* )( Args... ) )
    {
-      ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1, T2, T3>::invoke, 1 );
+      lua_pushcclosure ( L, obj_functor<F, RVal, Args...>::invoke, 1 );
    }
 
-   template<typename RVal, typename T, typename T1, typename T2, typename T3>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1, T2, T3 ) const )
+   template<typename F, typename RVal, typename C, typename... Args>
+   void push_callable ( lua_State *L, RVal ( C::* )( Args... ) const )
    {
-      ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1, T2, T3>::invoke, 1 );
+      lua_pushcclosure ( L, obj_functor<F, RVal, Args...>::invoke, 1 );
    }
 
-   template<typename RVal, typename T, typename T1, typename T2, typename T3, typename T4>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1, T2, T3, T4 ) )
+#if defined(__cpp_noexcept_function_type)
+   template<typename F, typename RVal, typename C, typename... Args>
+   void push_callable ( lua_State *L, RVal ( C::* )( Args... ) noexcept )
    {
-      ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1, T2, T3, T4>::invoke, 1 );
+      lua_pushcclosure ( L, obj_functor<F, RVal, Args...>::invoke, 1 );
    }
 
-   template<typename RVal, typename T, typename T1, typename T2, typename T3, typename T4>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1, T2, T3, T4 ) const )
+   template<typename F, typename RVal, typename C, typename... Args>
+   void push_callable ( lua_State *L, RVal ( C::* )( Args... ) const noexcept )
    {
-      ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1, T2, T3, T4>::invoke, 1 );
+      lua_pushcclosure ( L, obj_functor<F, RVal, Args...>::invoke, 1 );
    }
+#endif
 
-   template<typename RVal, typename T, typename T1, typename T2, typename T3, typename T4, typename T5>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1, T2, T3, T4, T5 ) )
+   // 可调用对象的userdata的metatable，每个类型一个，以静态变量地址为key存在registry里
+   template<typename F>
+   void push_callable_meta ( lua_State *L )
    {
-      ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1, T2, T3, T4, T5>::invoke, 1 );
+      static const char key = 0;
+      if ( lua_rawgetp ( L, LUA_REGISTRYINDEX, &key ) == LUA_TNIL )
+      {
+         lua_pop ( L, 1 );
+         lua_newtable ( L );
+         lua_pushstring ( L, "__gc" );
+         lua_pushcclosure ( L, callable_gc<F>, 0 );
+         lua_rawset ( L, -3 );
+         lua_pushvalue ( L, -1 );
+         lua_rawsetp ( L, LUA_REGISTRYINDEX, &key );
+      }
    }
 
-   template<typename RVal, typename T, typename T1, typename T2, typename T3, typename T4, typename T5>
-   void push_functor ( lua_State *L, RVal ( T::*func )( T1, T2, T3, T4, T5 ) const )
+   // push_function
+   // 压入绑定了func的C闭包
+   // 函数指针作为light userdata上值；成员函数指针和可调用对象复制到userdata上值中
+   template<typename F>
+   void push_function ( lua_State *L, F func, std::false_type )
    {
-      ( void ) func;
-      lua_pushcclosure ( L, mem_functor<RVal, T, T1, T2, T3, T4, T5>::invoke, 1 );
+      new( lua_newuserdata ( L, sizeof ( F ) ) ) F ( func );
+      push_functor ( L, func );
    }
 
-   // constructor
-   template<typename T, typename T1, typename T2, typename T3, typename T4, typename T5>
-   int constructor ( lua_State *L )
+   template<typename F>
+   void push_function ( lua_State *L, F func, std::true_type )
    {
-      // 类T构造函数，参数分别为T1 T2 T3 T4 T5 
-      // 透过new构建在C++堆上
-      new( lua_newuserdata ( L, sizeof ( val2user<T> ) ) ) val2user<T> ( read<T1> ( L, 2 ), read<T2> ( L, 3 ), read<T3> ( L, 4 ), read<T4> ( L, 5 ), read<T5> ( L, 6 ) );
-      // 给实例赋上metatable
-      push_meta ( L, class_name<typename class_type<T>::type>::name ( ) );
+      new( lua_newuserdata ( L, sizeof ( F ) ) ) F ( func );
+      push_callable_meta<F> ( L );
       lua_setmetatable ( L, -2 );
-
-      return 1;
+      push_callable<F> ( L, &F::operator() );
    }
 
-   template<typename T, typename T1, typename T2, typename T3, typename T4>
-   int constructor ( lua_State *L )
+   template<typename F>
+   void push_function ( lua_State *L, F func )
    {
-      new( lua_newuserdata ( L, sizeof ( val2user<T> ) ) ) val2user<T> ( read<T1> ( L, 2 ), read<T2> ( L, 3 ), read<T3> ( L, 4 ), read<T4> ( L, 5 ) );
-      push_meta ( L, class_name<typename class_type<T>::type>::name ( ) );
-      lua_setmetatable ( L, -2 );
-
-      return 1;
+      push_function ( L, func, typename std::is_class<F>::type ( ) );
    }
 
-   template<typename T, typename T1, typename T2, typename T3>
-   int constructor ( lua_State *L )
+   template<typename RVal, typename... Args>
+   void push_function ( lua_State *L, RVal ( *func )( Args... ) )
    {
-      new( lua_newuserdata ( L, sizeof ( val2user<T> ) ) ) val2user<T> ( read<T1> ( L, 2 ), read<T2> ( L, 3 ), read<T3> ( L, 4 ) );
-      push_meta ( L, class_name<typename class_type<T>::type>::name ( ) );
-      lua_setmetatable ( L, -2 );
-
-      return 1;
+      lua_pushlightuserdata ( L, ( void* ) func );
+      push_functor ( L, func );
    }
 
-   template<typename T, typename T1, typename T2>
-   int constructor ( lua_State *L )
+#if defined(__cpp_noexcept_function_type)
+   template<typename RVal, typename... Args>
+   void push_function ( lua_State *L, RVal ( *func )( Args... ) noexcept )
    {
-      new( lua_newuserdata ( L, sizeof ( val2user<T> ) ) ) val2user<T> ( read<T1> ( L, 2 ), read<T2> ( L, 3 ) );
-      push_meta ( L, class_name<typename class_type<T>::type>::name ( ) );
-      lua_setmetatable ( L, -2 );
-
-      return 1;
+      lua_pushlightuserdata ( L, ( void* ) func );
+      push_functor ( L, func );
    }
+#endif
 
-   template<typename T, typename T1>
-   int constructor ( lua_State *L )
+   // member variable
+   // 成员变量访问器：get/set是按类型编译期特化的函数，直接通过函数指针调用，没有虚函数
+   // get压入对象(栈上1)的成员值，set把栈上3的值赋给对象(栈上1)的成员
+   struct var_base
    {
-      new( lua_newuserdata ( L, sizeof ( val2user<T> ) ) ) val2user<T> ( read<T1> ( L, 2 ) );
-      push_meta ( L, class_name<typename class_type<T>::type>::name ( ) );
-      lua_setmetatable ( L, -2 );
+      void ( *get ) ( lua_State *L, const var_base* self );
+      void ( *set ) ( lua_State *L, const var_base* self );
+   };
 
-      return 1;
-   }
+   template<typename T, typename V>
+   struct mem_var : var_base
+   {
+      V T::*_var;
+      mem_var ( V T::*val ) : _var ( val ) { get = getter; set = setter; }
+      static void getter ( lua_State *L, const var_base* self )  { push<typename if_<is_obj<V>::value, V&, V>::type> ( L, read<T*> ( L, 1 )->*( static_cast<const mem_var*> ( self )->_var ) ); }
+      static void setter ( lua_State *L, const var_base* self )  { read<T*> ( L, 1 )->*( static_cast<const mem_var*> ( self )->_var ) = read<V> ( L, 3 ); }
+   };
 
-   template<typename T>
+   // constructor
+   // 类T构造函数，参数Args...从栈上2开始（栈上1是类table）
+   // 直接构建在userdata里
+   template<typename T, typename... Args>
+   struct construct
+   {
+      template<int... Is>
+      static void invoke ( lua_State *L, index_seq<Is...> )
+      {
+         ( void ) L;
+         val2user<T>::create ( L, read<typename arg_type<Args>::type> ( L, 2 + Is )... );
+      }
+   };
+
+   template<typename T, typename... Args>
    int constructor ( lua_State *L )
    {
-      new( lua_newuserdata ( L, sizeof ( val2user<T> ) ) ) val2user<T> ( );
-      push_meta ( L, class_name<typename class_type<T>::type>::name ( ) );
+      construct<T, Args...>::invoke ( L, typename make_index_seq<sizeof...( Args )>::type ( ) );
+      // 给实例赋上metatable
+      push_meta<typename class_type<T>::type> ( L );
       lua_setmetatable ( L, -2 );
 
       return 1;
@@ -755,8 +1009,8 @@ namespace lua_tinker
    template<typename T>
    int destroyer ( lua_State *L )
    {
-      // 删除C++堆上分配的内存
-      ( ( user* ) lua_touserdata ( L, 1 ) )->~user ( );
+      // 析构构造在userdata里的值对象
+      val2user<T>::destroy ( ( user* ) lua_touserdata ( L, 1 ) );
       return 0;
    }
 
@@ -764,10 +1018,9 @@ namespace lua_tinker
    template<typename F>
    void def ( lua_State* L, const char* name, F func )
    {
-      // 传入函数指针
-      lua_pushlightuserdata ( L, ( void* ) func );
       // 压入函数（实际上压入的是functor<>::invoke 真正的函数指针绑定在闭包上)
-      push_functor ( L, func );
+      // 也可以是lambda、std::function等可调用对象
+      push_function ( L, func );
       // 设置名字
       lua_setglobal ( L, name );
    }
@@ -859,13 +1112,109 @@ namespace lua_tinker
 
    }
 
+   // 没有参数时什么都不压入
+   inline int pcall_push ( lua_State *L ) { ( void ) L; return 0; }
+
+   // lua function handle
+   // 缓存的lua函数句柄：构造时按名字（全局名或者"a.b.c"这样的表路径）解析一次，
+   // 把函数放进registry引用；之后每次调用只需lua_rawgeti，没有字符串查找
+   // 句柄持有的是解析时的函数值，脚本之后重新定义同名函数不会影响它
+   // 句柄必须在lua_close之前析构
+   // call(args...)在主线程上调用（句柄保存的是主线程，不是构造时传入的L）：
+   // 出错时的traceback是主线程的栈，被调用的函数也不能yield。在协程里运行的C函数中，
+   // 用call(L, args...)传入当前的lua_State，在这个协程上调用
+   struct function
+   {
+      function ( ) : m_L ( NULL ), m_ref ( LUA_NOREF ) {}
+      function ( lua_State* L, const char* name );
+      function ( lua_State* L, int index );
+      function ( const function& input );
+      function& operator= ( const function& input );
+      ~function ( );
+
+      // 是否引用着一个函数
+      bool valid ( ) const { return m_ref != LUA_NOREF; }
+
+      template<typename RVal, typename... TArgs>
+      RVal call ( TArgs ... args )
+      {
+         return call<RVal> ( m_L, args... );
+      }
+
+      // 在L（同一个lua状态机的线程，比如正在运行当前C函数的协程）上调用
+      template<typename RVal, typename... TArgs>
+      RVal call ( lua_State* L, TArgs ... args )
+      {
+         // 默认构造的句柄没有lua_State，不能碰lua，直接返回默认值
+         if ( m_L == NULL )
+            return RVal ( );
+
+         // on_error没有上值，压入的是轻量C函数，不会分配闭包
+         lua_pushcclosure ( L, on_error, 0 );
+         int errfunc = lua_gettop ( L );
+
+         if ( valid ( ) )
+         {
+            lua_rawgeti ( L, LUA_REGISTRYINDEX, m_ref );
+            int count = pcall_push ( L, args... );
+            lua_pcall ( L, count, 1, errfunc );
+         }
+         else
+         {
+            print_error ( L, "lua_tinker::function::call() attempt to call an unresolved function" );
+            lua_pushnil ( L );
+         }
+
+         lua_remove ( L, errfunc );
+         return pop<RVal> ( L );
+      }
+
+      lua_State*      m_L;        // 主线程
+      int             m_ref;      // 函数在registry中的引用
+   };
+
+   // batched dispatch
+   // 把(消息id, 数据)攒成一批，flush时只做一次pcall，把整批交给lua的派发函数：
+   //    dispatcher ( ids, bufs, first, n )  处理ids[first..n]/bufs[first..n]
+   // 派发函数处理第i条之前要把bufs[i]置为false，这样某条消息的处理函数出错时，
+   // flush从下一条接着派发，只丢掉出错的那一条；置false同时也释放了数据string
+   // 两个数组在批次之间复用，不会每批重新创建table；batch必须在lua_close之前析构
+   struct batch
+   {
+      // dispatcher和function一样按名字解析一次
+      batch ( lua_State* L, const char* dispatcher );
+      ~batch ( );
+
+      // 数据在add时就压成lua string（external的buffer不复制，要保持有效到lua回收它）
+      void add ( int id, const buffer& data );
+      // 攒下的消息数
+      int size ( ) const { return m_count; }
+      // 派发攒下的消息，处理函数里新add的也在这次派发，返回派发的条数
+      // 和function::call一样，默认在主线程上调用派发函数，flush(L)在线程L上调用
+      int flush ( );
+      int flush ( lua_State* L );
+
+      function        m_func;     // 派发函数
+      lua_State*      m_T;        // 栈上放着ids和bufs两个数组的线程
+      int             m_ref;      // m_T在registry中的引用
+      int             m_count;
+
+   private:
+      batch ( const batch& );
+      batch& operator= ( const batch& );
+   };
+
 
 
 
    // class helper
    int meta_get ( lua_State *L );
    int meta_set ( lua_State *L );
-   void push_meta ( lua_State *L, const char* name );
+   int get_fields ( lua_State *L );
+   void class_vars ( lua_State *L );
+   void class_meta ( lua_State *L );
+   void class_inherit ( lua_State *L );
+   void class_fields ( lua_State *L );
 
    // class init
    template<typename T>
@@ -873,26 +1222,30 @@ namespace lua_tinker
    {
       // 通过类名设置类table
       // 如果该类没有注册，在lua中是获取不到类信息的
-      class_name<T>::name ( name );
-
       lua_newtable ( L );
 
       lua_pushstring ( L, "__name" );
       lua_pushstring ( L, name );
       lua_rawset ( L, -3 );
 
+      // 没有成员变量的类，__index直接就是类table本身，
+      // 调用方法只是虚拟机里的表查找，不进入C函数；class_mem会把它换成meta_get
       lua_pushstring ( L, "__index" );
-      lua_pushcclosure ( L, meta_get, 0 );
+      lua_pushvalue ( L, -2 );
       lua_rawset ( L, -3 );
 
-      lua_pushstring ( L, "__newindex" );
-      lua_pushcclosure ( L, meta_set, 0 );
-      lua_rawset ( L, -3 );
+      // __newindex（以及模块函数lua_tinker.get_fields）
+      class_vars ( L );
 
       lua_pushstring ( L, "__gc" );
       lua_pushcclosure ( L, destroyer<T>, 0 );
       lua_rawset ( L, -3 );
 
+      // 类table以类型的key存在registry里，压入对象时只需一次lua_rawgetp
+      lua_pushvalue ( L, -1 );
+      lua_rawsetp ( L, LUA_REGISTRYINDEX, class_name<T>::key ( ) );
+
+      // 全局名字只给脚本用（构造对象等）
       lua_setglobal ( L, name );
    }
 
@@ -901,13 +1254,21 @@ namespace lua_tinker
    void class_inh ( lua_State* L )
    {
       // 获取类table
-      push_meta ( L, class_name<T>::name ( ) );
+      push_meta<T> ( L );
       if ( lua_istable ( L, -1 ) )
       {
          // 压入父类名字
          lua_pushstring ( L, "__parent" );
-         push_meta ( L, class_name<P>::name ( ) );
+         push_meta<P> ( L );
          lua_rawset ( L, -3 );
+
+         // 把父类的成员展开到子类table中
+         push_meta<P> ( L );
+         if ( lua_istable ( L, -1 ) )
+         {
+            class_inherit ( L );
+         }
+         lua_pop ( L, 1 );
       }
       lua_pop ( L, 1 );
    }
@@ -917,17 +1278,16 @@ namespace lua_tinker
    void class_con ( lua_State* L, F func )
    {
       // 获取类table
-      push_meta ( L, class_name<T>::name ( ) );
+      push_meta<T> ( L );
       if ( lua_istable ( L, -1 ) )
       {
-         // 创建新的table __call
-         lua_newtable ( L );
+         // 类table的metatable（和继承共用）
+         class_meta ( L );
          lua_pushstring ( L, "__call" );
          // 压入构造函数
          lua_pushcclosure ( L, func, 0 );
          lua_rawset ( L, -3 );
-         // 设置__call为类table的metatable
-         lua_setmetatable ( L, -2 );
+         lua_pop ( L, 1 );
       }
       lua_pop ( L, 1 );
    }
@@ -937,13 +1297,13 @@ namespace lua_tinker
    void class_def ( lua_State* L, const char* name, F func )
    {
       // 获取类table
-      push_meta ( L, class_name<T>::name ( ) );
+      push_meta<T> ( L );
       if ( lua_istable ( L, -1 ) )
       {
          // 压入函数到类table
+         // 也可以是第一个参数为对象的普通函数或者可调用对象
          lua_pushstring ( L, name );
-         new( lua_newuserdata ( L, sizeof ( F ) ) ) F ( func );
-         push_functor ( L, func );
+         push_function ( L, func );
          lua_rawset ( L, -3 );
       }
       lua_pop ( L, 1 );
@@ -954,13 +1314,15 @@ namespace lua_tinker
    void class_mem ( lua_State* L, const char* name, VAR BASE::*val )
    {
       // 获取类table
-      push_meta ( L, class_name<T>::name ( ) );
+      push_meta<T> ( L );
       if ( lua_istable ( L, -1 ) )
       {
          // 压入类参数
          lua_pushstring ( L, name );
          new( lua_newuserdata ( L, sizeof ( mem_var<BASE, VAR> ) ) ) mem_var<BASE, VAR> ( val );
          lua_rawset ( L, -3 );
+         // 有成员变量了，访问要经过meta_get
+         class_fields ( L );
       }
       lua_pop ( L, 1 );
    }
@@ -968,16 +1330,28 @@ namespace lua_tinker
    template<typename T>
    struct class_name
    {
-      // global name
-      static const char* name ( const char* name = NULL )
+      // registry key
+      // 每个类型一个静态变量，用它的地址作为类table在registry中的key，
+      // 和名字无关，所以每个lua_State各自注册也不会相互影响
+      static const void* key ( )
       {
-         static char temp[256] = "";
-         if ( name != NULL ) strncpy ( temp, name, sizeof ( temp ) - 1 );
-         return temp;
+         static const char tag = 0;
+         return &tag;
       }
    };
 
-   // Table Object on Stack
+   template<typename T>
+   void push_meta ( lua_State *L )
+   {
+      lua_rawgetp ( L, LUA_REGISTRYINDEX, class_name<T>::key ( ) );
+   }
+
+   // Table Object in Registry
+   // table在registry中保存一个引用（luaL_ref自带空闲链表，分配和释放都是O(1)），
+   // 不占用任何栈位置，栈增长/移动也不会失效；C++侧的多个table共享一个table_obj
+   // 注意：和function一样，必须在lua_close之前析构
+   // set/get等操作使用主线程的栈（最多压入两个值，操作完就弹出），在协程里运行的C函数中
+   // 也是这样；操作触发的元方法也在主线程上运行，不能yield
    struct table_obj
    {
       table_obj ( lua_State* L, int index );
@@ -986,55 +1360,102 @@ namespace lua_tinker
       void inc_ref ( );
       void dec_ref ( );
 
-      bool validate ( );
+      // 是否引用着一个值（nil不引用）
+      bool validate ( ) const { return m_ref != LUA_NOREF && m_ref != LUA_REFNIL; }
 
       template<typename T>
       void set ( const char* name, T object )
       {
          if ( validate ( ) )
          {
-            lua_pushstring ( m_L, name );
+            lua_rawgeti ( m_L, LUA_REGISTRYINDEX, m_ref );
             push ( m_L, object );
-            lua_settable ( m_L, m_index );
+            lua_setfield ( m_L, -2, name );
+            lua_pop ( m_L, 1 );
          }
       }
 
       template<typename T>
       T get ( const char* name )
       {
-         if ( validate ( ) )
-         {
-            lua_pushstring ( m_L, name );
-            lua_gettable ( m_L, m_index );
-         }
-         else
+         if ( !validate ( ) )
          {
             lua_pushnil ( m_L );
+            return pop<T> ( m_L );
          }
 
-         return pop<T> ( m_L );
+         // 读出值后把值和table一起弹出，不用lua_remove移动栈
+         lua_rawgeti ( m_L, LUA_REGISTRYINDEX, m_ref );
+         lua_getfield ( m_L, -1, name );
+         T t = read<T> ( m_L, -1 );
+         lua_pop ( m_L, 2 );
+         return t;
       }
 
       template<typename T>
       T get ( int num )
+      {
+         if ( !validate ( ) )
+         {
+            lua_pushnil ( m_L );
+            return pop<T> ( m_L );
+         }
+
+         // 读出值后把值和table一起弹出，不用lua_remove移动栈
+         lua_rawgeti ( m_L, LUA_REGISTRYINDEX, m_ref );
+         lua_geti ( m_L, -1, num );
+         T t = read<T> ( m_L, -1 );
+         lua_pop ( m_L, 2 );
+         return t;
+      }
+
+      // 批量设置：参数是name, value, name, value...，table只压栈一次
+      template<typename... Args>
+      void set_many ( Args&&... args )
       {
          if ( validate ( ) )
          {
-            lua_pushinteger ( m_L, num );
-            lua_gettable ( m_L, m_index );
+            lua_rawgeti ( m_L, LUA_REGISTRYINDEX, m_ref );
+            set_items ( m_L, std::forward<Args> ( args )... );
+            lua_pop ( m_L, 1 );
          }
-         else
+      }
+
+      // 批量读取：参数是name, 变量, name, 变量...，读到的值赋给各个变量
+      template<typename... Args>
+      void get_many ( Args&&... args )
+      {
+         if ( validate ( ) )
          {
-            lua_pushnil ( m_L );
+            lua_rawgeti ( m_L, LUA_REGISTRYINDEX, m_ref );
+            get_items ( m_L, std::forward<Args> ( args )... );
+            lua_pop ( m_L, 1 );
          }
+      }
 
-         return pop<T> ( m_L );
+      // stack: -1.table
+      static void set_items ( lua_State* ) {}
+      template<typename T, typename... Rest>
+      static void set_items ( lua_State* L, const char* name, T object, Rest&&... rest )
+      {
+         push ( L, object );
+         lua_setfield ( L, -2, name );
+         set_items ( L, std::forward<Rest> ( rest )... );
       }
 
-      lua_State*      m_L;
-      int             m_index;
-      const void*     m_pointer;
-      int             m_ref;
+      static void get_items ( lua_State* ) {}
+      template<typename T, typename... Rest>
+      static void get_items ( lua_State* L, const char* name, T& out, Rest&&... rest )
+      {
+         lua_getfield ( L, -1, name );
+         read_into ( L, -1, out );
+         lua_pop ( L, 1 );
+         get_items ( L, std::forward<Rest> ( rest )... );
+      }
+
+      lua_State*      m_L;        // 主线程
+      int             m_ref;      // 值在registry中的引用
+      int             m_count;    // 共享它的table个数
    };
 
    // Table Object Holder
@@ -1044,6 +1465,7 @@ namespace lua_tinker
       table ( lua_State* L, int index );
       table ( lua_State* L, const char* name );
       table ( const table& input );
+      table& operator= ( const table& input );
       ~table ( );
 
       template<typename T>
@@ -1064,6 +1486,20 @@ namespace lua_tinker
          return m_obj->get<T> ( num );
       }
 
+      // t.set_many ( "x", s.x, "y", s.y );
+      template<typename... Args>
+      void set_many ( Args&&... args )
+      {
+         m_obj->set_many ( std::forward<Args> ( args )... );
+      }
+
+      // t.get_many ( "x", s.x, "y", s.y );
+      template<typename... Args>
+      void get_many ( Args&&... args )
+      {
+         m_obj->get_many ( std::forward<Args> ( args )... );
+      }
+
       table_obj*      m_obj;
    };
 
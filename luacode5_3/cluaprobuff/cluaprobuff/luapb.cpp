@@ -0,0 +1,1083 @@
+﻿// luapb.cpp
+//
+// protobuf message和lua table之间的直接转换
+
+extern "C"
+{
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+};
+#include <new>
+#include <string>
+#include <string.h>
+#include <limits.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include "luapb.h"
+
+using google::protobuf::Descriptor;
+using google::protobuf::DescriptorPool;
+using google::protobuf::EnumDescriptor;
+using google::protobuf::EnumValueDescriptor;
+using google::protobuf::FieldDescriptor;
+using google::protobuf::Message;
+using google::protobuf::MessageFactory;
+using google::protobuf::Reflection;
+
+namespace
+{
+   struct message_plan;
+
+   // 一个字段的转换信息
+   struct field_plan
+   {
+      const FieldDescriptor*  fd;
+      int                     type;       // FieldDescriptor::CppType
+      int                     wire_type;  // FieldDescriptor::Type，按它解码wire数据
+      int                     number;
+      bool                    repeated;
+      bool                    map;
+      bool                    utf8;       // proto3的string字段，ParseFromArray要求是合法的UTF-8
+      int                     key;        // 字段名在registry中的引用
+      message_plan*           sub;        // message字段（map字段是entry）的字段表
+   };
+
+   // 一个message类型的字段表
+   // 和字段数组一起分配在一个userdata里，以Descriptor的地址为key存在registry中，直到lua_close
+   struct message_plan
+   {
+      const Descriptor*       desc;
+      Message*                scratch;    // decode/encode复用的message，第一次用到时创建
+      std::string             str;        // GetStringReference用的临时空间
+      int                     names;      // 字段名到(下标+1)的table在registry中的引用
+      int                     count;
+      field_plan              fields[1];
+   };
+
+   int plan_gc ( lua_State *L )
+   {
+      message_plan* p = ( message_plan* ) lua_touserdata ( L, 1 );
+      delete p->scratch;
+      p->~message_plan ( );
+      return 0;
+   }
+
+   message_plan* get_plan ( lua_State *L, const Descriptor* desc );
+
+   // 创建desc的字段表，压入它的userdata
+   message_plan* new_plan ( lua_State *L, const Descriptor* desc )
+   {
+      int count = desc->field_count ( );
+      size_t size = sizeof ( message_plan ) + ( count > 1 ? count - 1 : 0 ) * sizeof ( field_plan );
+      message_plan* p = new( lua_newuserdata ( L, size ) ) message_plan ( );
+      p->desc = desc;
+      p->scratch = NULL;
+      p->names = LUA_NOREF;
+      p->count = 0;
+
+      if ( luaL_newmetatable ( L, "luapb.plan" ) )
+      {
+         lua_pushcfunction ( L, plan_gc );
+         lua_setfield ( L, -2, "__gc" );
+      }
+      lua_setmetatable ( L, -2 );
+
+      // 先登记再处理子message，自己引用自己的类型也能找到
+      lua_pushvalue ( L, -1 );
+      lua_rawsetp ( L, LUA_REGISTRYINDEX, desc );
+
+      lua_createtable ( L, 0, count );
+      for ( int i = 0; i < count; ++i )
+      {
+         const std::string& name = desc->field ( i )->name ( );
+         lua_pushlstring ( L, name.data ( ), name.size ( ) );
+         lua_pushinteger ( L, i + 1 );
+         lua_rawset ( L, -3 );
+      }
+      p->names = luaL_ref ( L, LUA_REGISTRYINDEX );
+
+      for ( int i = 0; i < count; ++i )
+      {
+         field_plan& f = p->fields[i];
+         f.fd = desc->field ( i );
+         f.type = f.fd->cpp_type ( );
+         f.wire_type = f.fd->type ( );
+         f.number = f.fd->number ( );
+         f.repeated = f.fd->is_repeated ( );
+         f.map = f.fd->is_map ( );
+         f.utf8 = f.wire_type == FieldDescriptor::TYPE_STRING && f.fd->file ( )->syntax ( ) == google::protobuf::FileDescriptor::SYNTAX_PROTO3;
+         f.sub = NULL;
+
+         const std::string& name = f.fd->name ( );
+         lua_pushlstring ( L, name.data ( ), name.size ( ) );
+         f.key = luaL_ref ( L, LUA_REGISTRYINDEX );
+         p->count = i + 1;
+
+         if ( f.type == FieldDescriptor::CPPTYPE_MESSAGE )
+         {
+            f.sub = get_plan ( L, f.fd->message_type ( ) );
+            lua_pop ( L, 1 );
+         }
+      }
+      return p;
+   }
+
+   // 压入desc的字段表的userdata，没有就创建
+   message_plan* get_plan ( lua_State *L, const Descriptor* desc )
+   {
+      if ( lua_rawgetp ( L, LUA_REGISTRYINDEX, desc ) == LUA_TUSERDATA )
+         return ( message_plan* ) lua_touserdata ( L, -1 );
+      lua_pop ( L, 1 );
+      return new_plan ( L, desc );
+   }
+
+   /*---------------------------------------------------------------------------*/
+   /* message -> table                                                          */
+   /*---------------------------------------------------------------------------*/
+   void push_msg ( lua_State *L, message_plan* p, const Message& m );
+
+   // 压入单个字段的值
+   void push_value ( lua_State *L, message_plan* p, const field_plan& f, const Message& m )
+   {
+      const Reflection* r = m.GetReflection ( );
+      switch ( f.type )
+      {
+      case FieldDescriptor::CPPTYPE_INT32:   lua_pushinteger ( L, r->GetInt32 ( m, f.fd ) ); break;
+      case FieldDescriptor::CPPTYPE_INT64:   lua_pushinteger ( L, ( lua_Integer ) r->GetInt64 ( m, f.fd ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT32:  lua_pushinteger ( L, r->GetUInt32 ( m, f.fd ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT64:  lua_pushinteger ( L, ( lua_Integer ) r->GetUInt64 ( m, f.fd ) ); break;
+      case FieldDescriptor::CPPTYPE_DOUBLE:  lua_pushnumber ( L, r->GetDouble ( m, f.fd ) ); break;
+      case FieldDescriptor::CPPTYPE_FLOAT:   lua_pushnumber ( L, r->GetFloat ( m, f.fd ) ); break;
+      case FieldDescriptor::CPPTYPE_BOOL:    lua_pushboolean ( L, r->GetBool ( m, f.fd ) ); break;
+      case FieldDescriptor::CPPTYPE_ENUM:    lua_pushinteger ( L, r->GetEnumValue ( m, f.fd ) ); break;
+      case FieldDescriptor::CPPTYPE_STRING:
+         {
+            const std::string& s = r->GetStringReference ( m, f.fd, &p->str );
+            lua_pushlstring ( L, s.data ( ), s.size ( ) );
+         }
+         break;
+      case FieldDescriptor::CPPTYPE_MESSAGE: push_msg ( L, f.sub, r->GetMessage ( m, f.fd ) ); break;
+      default:                               lua_pushnil ( L ); break;
+      }
+   }
+
+   // 压入repeated字段的第i个值
+   void push_item ( lua_State *L, message_plan* p, const field_plan& f, const Message& m, int i )
+   {
+      const Reflection* r = m.GetReflection ( );
+      switch ( f.type )
+      {
+      case FieldDescriptor::CPPTYPE_INT32:   lua_pushinteger ( L, r->GetRepeatedInt32 ( m, f.fd, i ) ); break;
+      case FieldDescriptor::CPPTYPE_INT64:   lua_pushinteger ( L, ( lua_Integer ) r->GetRepeatedInt64 ( m, f.fd, i ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT32:  lua_pushinteger ( L, r->GetRepeatedUInt32 ( m, f.fd, i ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT64:  lua_pushinteger ( L, ( lua_Integer ) r->GetRepeatedUInt64 ( m, f.fd, i ) ); break;
+      case FieldDescriptor::CPPTYPE_DOUBLE:  lua_pushnumber ( L, r->GetRepeatedDouble ( m, f.fd, i ) ); break;
+      case FieldDescriptor::CPPTYPE_FLOAT:   lua_pushnumber ( L, r->GetRepeatedFloat ( m, f.fd, i ) ); break;
+      case FieldDescriptor::CPPTYPE_BOOL:    lua_pushboolean ( L, r->GetRepeatedBool ( m, f.fd, i ) ); break;
+      case FieldDescriptor::CPPTYPE_ENUM:    lua_pushinteger ( L, r->GetRepeatedEnumValue ( m, f.fd, i ) ); break;
+      case FieldDescriptor::CPPTYPE_STRING:
+         {
+            const std::string& s = r->GetRepeatedStringReference ( m, f.fd, i, &p->str );
+            lua_pushlstring ( L, s.data ( ), s.size ( ) );
+         }
+         break;
+      case FieldDescriptor::CPPTYPE_MESSAGE: push_msg ( L, f.sub, r->GetRepeatedMessage ( m, f.fd, i ) ); break;
+      default:                               lua_pushnil ( L ); break;
+      }
+   }
+
+   // 按字段表把m转换成table压栈
+   void push_msg ( lua_State *L, message_plan* p, const Message& m )
+   {
+      const Reflection* r = m.GetReflection ( );
+
+      luaL_checkstack ( L, 4, "luapb: message too deep" );
+      lua_createtable ( L, 0, p->count );
+
+      for ( int i = 0; i < p->count; ++i )
+      {
+         const field_plan& f = p->fields[i];
+
+         if ( f.repeated )
+         {
+            int n = r->FieldSize ( m, f.fd );
+            lua_rawgeti ( L, LUA_REGISTRYINDEX, f.key );
+            if ( f.map )
+            {
+               // map是entry message的数组，entry的第1个字段是key，第2个是value
+               lua_createtable ( L, 0, n );
+               for ( int j = 0; j < n; ++j )
+               {
+                  const Message& e = r->GetRepeatedMessage ( m, f.fd, j );
+                  push_value ( L, f.sub, f.sub->fields[0], e );
+                  push_value ( L, f.sub, f.sub->fields[1], e );
+                  lua_rawset ( L, -3 );
+               }
+            }
+            else
+            {
+               lua_createtable ( L, n, 0 );
+               for ( int j = 0; j < n; ++j )
+               {
+                  push_item ( L, p, f, m, j );
+                  lua_rawseti ( L, -2, j + 1 );
+               }
+            }
+         }
+         else
+         {
+            // 没有设置的子message不转换
+            if ( f.type == FieldDescriptor::CPPTYPE_MESSAGE && !r->HasField ( m, f.fd ) )
+               continue;
+            lua_rawgeti ( L, LUA_REGISTRYINDEX, f.key );
+            push_value ( L, p, f, m );
+         }
+         lua_rawset ( L, -3 );
+      }
+   }
+
+   /*---------------------------------------------------------------------------*/
+   /* table -> message                                                          */
+   /*---------------------------------------------------------------------------*/
+   void read_msg ( lua_State *L, int index, message_plan* p, Message* m );
+
+   lua_Integer check_integer ( lua_State *L, int index, const field_plan& f )
+   {
+      int isnum = 0;
+      lua_Integer v = lua_tointegerx ( L, index, &isnum );
+      if ( !isnum )
+         luaL_error ( L, "luapb: field '%s' expects integer, got %s", f.fd->name ( ).c_str ( ), luaL_typename ( L, index ) );
+      return v;
+   }
+
+   lua_Number check_number ( lua_State *L, int index, const field_plan& f )
+   {
+      int isnum = 0;
+      lua_Number v = lua_tonumberx ( L, index, &isnum );
+      if ( !isnum )
+         luaL_error ( L, "luapb: field '%s' expects number, got %s", f.fd->name ( ).c_str ( ), luaL_typename ( L, index ) );
+      return v;
+   }
+
+   const char* check_string ( lua_State *L, int index, const field_plan& f, size_t* len )
+   {
+      if ( lua_type ( L, index ) != LUA_TSTRING )
+         luaL_error ( L, "luapb: field '%s' expects string, got %s", f.fd->name ( ).c_str ( ), luaL_typename ( L, index ) );
+      return lua_tolstring ( L, index, len );
+   }
+
+   void check_table ( lua_State *L, int index, const field_plan& f )
+   {
+      if ( !lua_istable ( L, index ) )
+         luaL_error ( L, "luapb: field '%s' expects table, got %s", f.fd->name ( ).c_str ( ), luaL_typename ( L, index ) );
+   }
+
+   // 枚举可以是整数或者枚举值的名字
+   int check_enum ( lua_State *L, int index, const field_plan& f )
+   {
+      if ( lua_type ( L, index ) == LUA_TSTRING )
+      {
+         const EnumValueDescriptor* e = f.fd->enum_type ( )->FindValueByName ( lua_tostring ( L, index ) );
+         if ( e == NULL )
+            luaL_error ( L, "luapb: field '%s' has no enum value '%s'", f.fd->name ( ).c_str ( ), lua_tostring ( L, index ) );
+         return e->number ( );
+      }
+      return ( int ) check_integer ( L, index, f );
+   }
+
+   // 栈上index处的值写入单个字段
+   void set_value ( lua_State *L, int index, const field_plan& f, Message* m )
+   {
+      const Reflection* r = m->GetReflection ( );
+      size_t len = 0;
+      const char* s = NULL;
+      switch ( f.type )
+      {
+      case FieldDescriptor::CPPTYPE_INT32:   r->SetInt32 ( m, f.fd, ( google::protobuf::int32 ) check_integer ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_INT64:   r->SetInt64 ( m, f.fd, ( google::protobuf::int64 ) check_integer ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT32:  r->SetUInt32 ( m, f.fd, ( google::protobuf::uint32 ) check_integer ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT64:  r->SetUInt64 ( m, f.fd, ( google::protobuf::uint64 ) check_integer ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_DOUBLE:  r->SetDouble ( m, f.fd, check_number ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_FLOAT:   r->SetFloat ( m, f.fd, ( float ) check_number ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_BOOL:    r->SetBool ( m, f.fd, lua_toboolean ( L, index ) != 0 ); break;
+      case FieldDescriptor::CPPTYPE_ENUM:    r->SetEnumValue ( m, f.fd, check_enum ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_STRING:
+         s = check_string ( L, index, f, &len );
+         r->SetString ( m, f.fd, std::string ( s, len ) );
+         break;
+      case FieldDescriptor::CPPTYPE_MESSAGE:
+         check_table ( L, index, f );
+         read_msg ( L, index, f.sub, r->MutableMessage ( m, f.fd ) );
+         break;
+      default:
+         break;
+      }
+   }
+
+   // 栈上index处的值添加到repeated字段
+   void add_item ( lua_State *L, int index, const field_plan& f, Message* m )
+   {
+      const Reflection* r = m->GetReflection ( );
+      size_t len = 0;
+      const char* s = NULL;
+      switch ( f.type )
+      {
+      case FieldDescriptor::CPPTYPE_INT32:   r->AddInt32 ( m, f.fd, ( google::protobuf::int32 ) check_integer ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_INT64:   r->AddInt64 ( m, f.fd, ( google::protobuf::int64 ) check_integer ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT32:  r->AddUInt32 ( m, f.fd, ( google::protobuf::uint32 ) check_integer ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT64:  r->AddUInt64 ( m, f.fd, ( google::protobuf::uint64 ) check_integer ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_DOUBLE:  r->AddDouble ( m, f.fd, check_number ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_FLOAT:   r->AddFloat ( m, f.fd, ( float ) check_number ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_BOOL:    r->AddBool ( m, f.fd, lua_toboolean ( L, index ) != 0 ); break;
+      case FieldDescriptor::CPPTYPE_ENUM:    r->AddEnumValue ( m, f.fd, check_enum ( L, index, f ) ); break;
+      case FieldDescriptor::CPPTYPE_STRING:
+         s = check_string ( L, index, f, &len );
+         r->AddString ( m, f.fd, std::string ( s, len ) );
+         break;
+      case FieldDescriptor::CPPTYPE_MESSAGE:
+         check_table ( L, index, f );
+         read_msg ( L, index, f.sub, r->AddMessage ( m, f.fd ) );
+         break;
+      default:
+         break;
+      }
+   }
+
+   // 按字段表把栈上index处的table写入m
+   // 这里和调用的函数都没有需要析构的C++局部对象，抛出lua错误是安全的
+   void read_msg ( lua_State *L, int index, message_plan* p, Message* m )
+   {
+      const Reflection* r = m->GetReflection ( );
+
+      luaL_checkstack ( L, 4, "luapb: message too deep" );
+      index = lua_absindex ( L, index );
+
+      for ( int i = 0; i < p->count; ++i )
+      {
+         const field_plan& f = p->fields[i];
+
+         lua_rawgeti ( L, LUA_REGISTRYINDEX, f.key );
+         if ( lua_rawget ( L, index ) == LUA_TNIL )
+         {
+            lua_pop ( L, 1 );
+            continue;
+         }
+
+         if ( f.map )
+         {
+            check_table ( L, -1, f );
+            lua_pushnil ( L );
+            while ( lua_next ( L, -2 ) )
+            {
+               Message* e = r->AddMessage ( m, f.fd );
+               set_value ( L, -1, f.sub->fields[1], e );
+               // key用副本转换，不影响lua_next
+               lua_pushvalue ( L, -2 );
+               set_value ( L, -1, f.sub->fields[0], e );
+               lua_pop ( L, 2 );
+            }
+         }
+         else if ( f.repeated )
+         {
+            check_table ( L, -1, f );
+            int n = ( int ) lua_rawlen ( L, -1 );
+            for ( int j = 1; j <= n; ++j )
+            {
+               lua_rawgeti ( L, -1, j );
+               add_item ( L, -1, f, m );
+               lua_pop ( L, 1 );
+            }
+         }
+         else
+         {
+            set_value ( L, -1, f, m );
+         }
+         lua_pop ( L, 1 );
+      }
+   }
+
+   /*---------------------------------------------------------------------------*/
+   /* lazy message                                                              */
+   /*---------------------------------------------------------------------------*/
+   // 直接在wire数据上的message代理
+   // 第一次访问字段时扫描一遍tag（跳过内容），记下每个字段第一次和最后一次出现的位置
+   // （wire类型不符的出现和ParseFromArray一样当作未知字段）；
+   // 之后只解码访问到的字段，子message也是代理
+   // uservalue开始是持有数据的lua string，子message代理共享它；
+   // 第一次缓存时换成table，[1]是这个string，string/子message/repeated字段的结果按字段名缓存在里面，
+   // 数字和bool每次按记下的位置重新解码，不占缓存
+   struct lazy_msg
+   {
+      message_plan*           plan;
+      const char*             data;
+      size_t                  size;
+      bool                    scanned;
+      int                     pos[2];     // 每个字段2个：第一次和最后一次出现的tag位置，-1表示没有
+   };
+
+   typedef google::protobuf::uint64 uint64;
+   typedef google::protobuf::uint32 uint32;
+
+   enum { WIRE_VARINT = 0, WIRE_FIXED64 = 1, WIRE_BYTES = 2, WIRE_START_GROUP = 3, WIRE_END_GROUP = 4, WIRE_FIXED32 = 5 };
+
+   // 嵌套group的层数上限，和protobuf的递归上限一样
+   const int MAX_GROUP_DEPTH = 100;
+
+   // 读一个varint，数据不完整返回NULL
+   const char* read_varint ( const char* p, const char* end, uint64* v )
+   {
+      uint64 r = 0;
+      for ( int shift = 0; p < end && shift < 64; shift += 7 )
+      {
+         unsigned char b = ( unsigned char ) *p++;
+         r |= ( uint64 ) ( b & 0x7f ) << shift;
+         if ( b < 0x80 )
+         {
+            *v = r;
+            return p;
+         }
+      }
+      return NULL;
+   }
+
+   // 读一个tag：和ParseFromArray一样最多5个字节，超出32位的部分丢掉
+   const char* read_tag ( const char* p, const char* end, uint64* tag )
+   {
+      uint64 r = 0;
+      for ( int shift = 0; p < end && shift < 35; shift += 7 )
+      {
+         unsigned char b = ( unsigned char ) *p++;
+         r |= ( uint64 ) ( b & 0x7f ) << shift;
+         if ( b < 0x80 )
+         {
+            *tag = r & 0xffffffff;
+            return p;
+         }
+      }
+      return NULL;
+   }
+
+   // 读length-delimited的长度，返回内容的开始，*vend是内容的结束
+   const char* read_bytes ( const char* p, const char* end, const char** vend )
+   {
+      uint64 len = 0;
+      p = read_varint ( p, end, &len );
+      if ( p == NULL || len > ( uint64 ) ( end - p ) )
+         return NULL;
+      *vend = p + len;
+      return p;
+   }
+
+   // 跳过tag之后的值；group跳到对应的结束tag之后。和ParseFromArray一样，
+   // 字段号0、不配对的结束tag和未知的wire类型都是错误，返回NULL
+   const char* skip_value ( const char* p, const char* end, uint64 tag, int depth = 0 )
+   {
+      uint64 v = 0;
+      const char* vend = NULL;
+      if ( ( tag >> 3 ) == 0 )
+         return NULL;
+      switch ( ( int ) ( tag & 7 ) )
+      {
+      case WIRE_VARINT:    return read_varint ( p, end, &v );
+      case WIRE_FIXED64:   return end - p >= 8 ? p + 8 : NULL;
+      case WIRE_FIXED32:   return end - p >= 4 ? p + 4 : NULL;
+      case WIRE_BYTES:     return read_bytes ( p, end, &vend ) ? vend : NULL;
+      case WIRE_START_GROUP:
+         if ( depth >= MAX_GROUP_DEPTH )
+            return NULL;
+         while ( p != NULL )
+         {
+            uint64 t = 0;
+            p = read_tag ( p, end, &t );
+            if ( p == NULL )
+               return NULL;
+            if ( ( t & 7 ) == WIRE_END_GROUP )
+               return ( t >> 3 ) == ( tag >> 3 ) ? p : NULL;
+            p = skip_value ( p, end, t, depth + 1 );
+         }
+         return NULL;
+      default:             return NULL;
+      }
+   }
+
+   // 字段按声明的类型在wire上应有的类型
+   int field_wire ( const field_plan& f )
+   {
+      switch ( f.wire_type )
+      {
+      case FieldDescriptor::TYPE_DOUBLE:
+      case FieldDescriptor::TYPE_FIXED64:
+      case FieldDescriptor::TYPE_SFIXED64:   return WIRE_FIXED64;
+      case FieldDescriptor::TYPE_FLOAT:
+      case FieldDescriptor::TYPE_FIXED32:
+      case FieldDescriptor::TYPE_SFIXED32:   return WIRE_FIXED32;
+      case FieldDescriptor::TYPE_STRING:
+      case FieldDescriptor::TYPE_BYTES:
+      case FieldDescriptor::TYPE_MESSAGE:    return WIRE_BYTES;
+      case FieldDescriptor::TYPE_GROUP:      return WIRE_START_GROUP;
+      default:                               return WIRE_VARINT;
+      }
+   }
+
+   // 这次出现是否属于字段f：wire类型要和声明的类型相符，repeated的数字字段还可以是packed。
+   // 不符的出现ParseFromArray当作未知字段，代理也要忽略它，否则读到的值会和decode不一样
+   bool wire_matches ( const field_plan& f, uint64 tag )
+   {
+      int wire = ( int ) ( tag & 7 );
+      return wire == field_wire ( f ) || ( wire == WIRE_BYTES && f.repeated && f.fd->is_packable ( ) );
+   }
+
+   uint64 read_fixed ( const char* p, int n )
+   {
+      uint64 v = 0;
+      for ( int i = n - 1; i >= 0; --i )
+         v = ( v << 8 ) | ( unsigned char ) p[i];
+      return v;
+   }
+
+   // 字段号对应的字段下标，没有返回-1
+   int field_index ( const message_plan* p, uint64 number )
+   {
+      // 字段号从1开始连续编号时直接命中
+      if ( number >= 1 && number <= ( uint64 ) p->count && p->fields[number - 1].number == ( int ) number )
+         return ( int ) number - 1;
+      if ( number > 0x1fffffff )
+         return -1;
+      const FieldDescriptor* fd = p->desc->FindFieldByNumber ( ( int ) number );
+      return fd ? fd->index ( ) : -1;
+   }
+
+   int lazy_error ( lua_State *L, const lazy_msg* m )
+   {
+      return luaL_error ( L, "luapb: malformed message '%s'", m->plan->desc->full_name ( ).c_str ( ) );
+   }
+
+   void scan ( lua_State *L, lazy_msg* m )
+   {
+      const message_plan* p = m->plan;
+      for ( int i = 0; i < 2 * p->count; ++i )
+         m->pos[i] = -1;
+
+      const char* end = m->data + m->size;
+      for ( const char* q = m->data; q < end; )
+      {
+         uint64 tag = 0;
+         const char* v = read_tag ( q, end, &tag );
+         if ( v == NULL )
+            lazy_error ( L, m );
+
+         int i = field_index ( p, tag >> 3 );
+         if ( i >= 0 && wire_matches ( p->fields[i], tag ) )
+         {
+            int at = ( int ) ( q - m->data );
+            if ( m->pos[2 * i] < 0 )
+               m->pos[2 * i] = at;
+            m->pos[2 * i + 1] = at;
+         }
+
+         q = skip_value ( v, end, tag );
+         if ( q == NULL )
+            lazy_error ( L, m );
+      }
+      m->scanned = true;
+   }
+
+   void push_lazy ( lua_State *L, message_plan* p, const char* data, size_t size, int cache );
+
+   // 解码一个wire类型为wire的标量压栈，返回值之后的位置；类型不符或者数据不完整返回NULL
+   const char* push_scalar ( lua_State *L, const field_plan& f, int wire, const char* p, const char* end )
+   {
+      uint64 v = 0;
+      if ( wire == WIRE_VARINT )
+      {
+         p = read_varint ( p, end, &v );
+         if ( p == NULL )
+            return NULL;
+      }
+      else if ( wire == WIRE_FIXED32 || wire == WIRE_FIXED64 )
+      {
+         int n = wire == WIRE_FIXED32 ? 4 : 8;
+         if ( end - p < n )
+            return NULL;
+         v = read_fixed ( p, n );
+         p += n;
+      }
+      else
+      {
+         return NULL;
+      }
+
+      switch ( f.wire_type )
+      {
+      case FieldDescriptor::TYPE_INT32:
+      case FieldDescriptor::TYPE_ENUM:       lua_pushinteger ( L, ( google::protobuf::int32 ) v ); break;
+      case FieldDescriptor::TYPE_SINT32:     lua_pushinteger ( L, ( google::protobuf::int32 ) ( ( ( uint32 ) v >> 1 ) ^ ( 0 - ( ( uint32 ) v & 1 ) ) ) ); break;
+      case FieldDescriptor::TYPE_SINT64:     lua_pushinteger ( L, ( lua_Integer ) ( ( v >> 1 ) ^ ( 0 - ( v & 1 ) ) ) ); break;
+      case FieldDescriptor::TYPE_UINT32:
+      case FieldDescriptor::TYPE_FIXED32:    lua_pushinteger ( L, ( uint32 ) v ); break;
+      case FieldDescriptor::TYPE_SFIXED32:   lua_pushinteger ( L, ( google::protobuf::int32 ) ( uint32 ) v ); break;
+      case FieldDescriptor::TYPE_BOOL:       lua_pushboolean ( L, v != 0 ); break;
+      case FieldDescriptor::TYPE_FLOAT:
+         {
+            uint32 u = ( uint32 ) v;
+            float x;
+            memcpy ( &x, &u, sizeof ( x ) );
+            lua_pushnumber ( L, x );
+         }
+         break;
+      case FieldDescriptor::TYPE_DOUBLE:
+         {
+            double x;
+            memcpy ( &x, &v, sizeof ( x ) );
+            lua_pushnumber ( L, x );
+         }
+         break;
+      default:                               lua_pushinteger ( L, ( lua_Integer ) v ); break;
+      }
+      return p;
+   }
+
+   // 解码tag之后的一个值压栈（string复制，message是代理）
+   const char* push_wire ( lua_State *L, const field_plan& f, int wire, const char* p, const char* end, int cache )
+   {
+      const char* vend = NULL;
+      if ( f.type == FieldDescriptor::CPPTYPE_STRING || f.type == FieldDescriptor::CPPTYPE_MESSAGE )
+      {
+         if ( wire != WIRE_BYTES || ( p = read_bytes ( p, end, &vend ) ) == NULL )
+            return NULL;
+         if ( f.type == FieldDescriptor::CPPTYPE_STRING )
+         {
+            if ( f.utf8 && !google::protobuf::internal::IsStructurallyValidUTF8 ( p, ( int ) ( vend - p ) ) )
+               return NULL;
+            lua_pushlstring ( L, p, vend - p );
+         }
+         else
+            push_lazy ( L, f.sub, p, vend - p, cache );
+         return vend;
+      }
+      return push_scalar ( L, f, wire, p, end );
+   }
+
+   // 没有出现的字段的默认值
+   void push_default ( lua_State *L, const field_plan& f )
+   {
+      switch ( f.type )
+      {
+      case FieldDescriptor::CPPTYPE_INT32:   lua_pushinteger ( L, f.fd->default_value_int32 ( ) ); break;
+      case FieldDescriptor::CPPTYPE_INT64:   lua_pushinteger ( L, ( lua_Integer ) f.fd->default_value_int64 ( ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT32:  lua_pushinteger ( L, f.fd->default_value_uint32 ( ) ); break;
+      case FieldDescriptor::CPPTYPE_UINT64:  lua_pushinteger ( L, ( lua_Integer ) f.fd->default_value_uint64 ( ) ); break;
+      case FieldDescriptor::CPPTYPE_DOUBLE:  lua_pushnumber ( L, f.fd->default_value_double ( ) ); break;
+      case FieldDescriptor::CPPTYPE_FLOAT:   lua_pushnumber ( L, f.fd->default_value_float ( ) ); break;
+      case FieldDescriptor::CPPTYPE_BOOL:    lua_pushboolean ( L, f.fd->default_value_bool ( ) ); break;
+      case FieldDescriptor::CPPTYPE_ENUM:    lua_pushinteger ( L, f.fd->default_value_enum ( )->number ( ) ); break;
+      case FieldDescriptor::CPPTYPE_STRING:
+         {
+            const std::string& s = f.fd->default_value_string ( );
+            lua_pushlstring ( L, s.data ( ), s.size ( ) );
+         }
+         break;
+      default:                               lua_pushnil ( L ); break;
+      }
+   }
+
+   // map entry：解码key和value压栈
+   void push_entry ( lua_State *L, const lazy_msg* m, const field_plan& f, const char* p, const char* end, int cache )
+   {
+      const message_plan* e = f.sub;
+      push_default ( L, e->fields[0] );
+      // 没有value的entry，message值是空message而不是nil（和ParseFromArray一样）
+      if ( e->fields[1].type == FieldDescriptor::CPPTYPE_MESSAGE )
+         push_lazy ( L, e->fields[1].sub, end, 0, cache );
+      else
+         push_default ( L, e->fields[1] );
+      while ( p < end )
+      {
+         uint64 tag = 0;
+         p = read_tag ( p, end, &tag );
+         if ( p == NULL )
+            lazy_error ( L, m );
+         int k = ( tag >> 3 ) == 1 ? 0 : ( tag >> 3 ) == 2 ? 1 : -1;
+         if ( k >= 0 && wire_matches ( e->fields[k], tag ) )
+         {
+            p = push_wire ( L, e->fields[k], ( int ) ( tag & 7 ), p, end, cache );
+            if ( p )
+               lua_replace ( L, k == 0 ? -3 : -2 );
+         }
+         else
+         {
+            p = skip_value ( p, end, tag );
+         }
+         if ( p == NULL )
+            lazy_error ( L, m );
+      }
+   }
+
+   // 解码repeated/map字段的所有出现压入一个table
+   void push_repeated ( lua_State *L, const lazy_msg* m, const field_plan& f, int cache )
+   {
+      int n = 0;
+      int first = m->pos[2 * ( &f - m->plan->fields )];
+
+      lua_createtable ( L, 0, 0 );
+      if ( first < 0 )
+         return;
+
+      const char* end = m->data + m->size;
+      for ( const char* q = m->data + first; q < end; )
+      {
+         uint64 tag = 0;
+         const char* v = read_tag ( q, end, &tag );
+         if ( v == NULL )
+            lazy_error ( L, m );
+         int wire = ( int ) ( tag & 7 );
+
+         if ( ( tag >> 3 ) != ( uint64 ) f.number || !wire_matches ( f, tag ) )
+         {
+            q = skip_value ( v, end, tag );
+         }
+         else if ( f.map )
+         {
+            const char* vend = NULL;
+            v = read_bytes ( v, end, &vend );
+            if ( v == NULL || wire != WIRE_BYTES )
+               lazy_error ( L, m );
+            push_entry ( L, m, f, v, vend, cache );
+            lua_rawset ( L, -3 );
+            q = vend;
+         }
+         else if ( wire == WIRE_BYTES && f.type != FieldDescriptor::CPPTYPE_STRING && f.type != FieldDescriptor::CPPTYPE_MESSAGE )
+         {
+            // packed
+            const char* vend = NULL;
+            v = read_bytes ( v, end, &vend );
+            if ( v == NULL )
+               lazy_error ( L, m );
+            int packed = f.wire_type == FieldDescriptor::TYPE_DOUBLE || f.wire_type == FieldDescriptor::TYPE_FIXED64 || f.wire_type == FieldDescriptor::TYPE_SFIXED64 ? WIRE_FIXED64
+               : f.wire_type == FieldDescriptor::TYPE_FLOAT || f.wire_type == FieldDescriptor::TYPE_FIXED32 || f.wire_type == FieldDescriptor::TYPE_SFIXED32 ? WIRE_FIXED32
+               : WIRE_VARINT;
+            while ( v != NULL && v < vend )
+            {
+               v = push_scalar ( L, f, packed, v, vend );
+               if ( v )
+                  lua_rawseti ( L, -2, ++n );
+            }
+            q = v;
+         }
+         else
+         {
+            q = push_wire ( L, f, wire, v, end, cache );
+            if ( q )
+               lua_rawseti ( L, -2, ++n );
+         }
+         if ( q == NULL )
+            lazy_error ( L, m );
+      }
+   }
+
+   // 单个message字段出现了多次：按protobuf的规则合并，和ParseFromArray的结果一样。
+   // 各次出现的内容拼在一起就是合并后的编码，代理建在拼出的string上（string由代理的uservalue持有）
+   void push_merged ( lua_State *L, const lazy_msg* m, const field_plan& f, int first, int last )
+   {
+      luaL_Buffer b;
+      luaL_buffinit ( L, &b );
+      const char* end = m->data + m->size;
+      for ( const char* q = m->data + first; q <= m->data + last; )
+      {
+         uint64 tag = 0;
+         const char* v = read_tag ( q, end, &tag );
+         if ( v == NULL )
+            lazy_error ( L, m );
+         int wire = ( int ) ( tag & 7 );
+
+         if ( ( tag >> 3 ) != ( uint64 ) f.number || !wire_matches ( f, tag ) )
+         {
+            q = skip_value ( v, end, tag );
+         }
+         else
+         {
+            const char* vend = NULL;
+            if ( wire != WIRE_BYTES || ( v = read_bytes ( v, end, &vend ) ) == NULL )
+               lazy_error ( L, m );
+            luaL_addlstring ( &b, v, vend - v );
+            q = vend;
+         }
+         if ( q == NULL )
+            lazy_error ( L, m );
+      }
+      luaL_pushresult ( &b );
+
+      size_t len = 0;
+      const char* data = lua_tolstring ( L, -1, &len );
+      push_lazy ( L, f.sub, data, len, lua_gettop ( L ) );
+      lua_remove ( L, -2 );
+   }
+
+   // 解码第i个字段压栈
+   // 单个标量和string字段以最后一次出现为准，message字段合并所有出现
+   void push_field ( lua_State *L, lazy_msg* m, int i, int cache )
+   {
+      const field_plan& f = m->plan->fields[i];
+      if ( f.repeated )
+      {
+         push_repeated ( L, m, f, cache );
+         return;
+      }
+
+      int at = m->pos[2 * i + 1];
+      if ( at < 0 )
+      {
+         push_default ( L, f );
+         return;
+      }
+
+      int first = m->pos[2 * i];
+      if ( first != at && f.type == FieldDescriptor::CPPTYPE_MESSAGE )
+      {
+         push_merged ( L, m, f, first, at );
+         return;
+      }
+
+      const char* end = m->data + m->size;
+      uint64 tag = 0;
+      const char* v = read_tag ( m->data + at, end, &tag );
+      if ( v == NULL || push_wire ( L, f, ( int ) ( tag & 7 ), v, end, cache ) == NULL )
+         lazy_error ( L, m );
+   }
+
+   // 创建代理压栈，cache是持有数据的lua string（或者包含它的uservalue table）在栈上的位置
+   void push_lazy ( lua_State *L, message_plan* p, const char* data, size_t size, int cache )
+   {
+      size_t sz = sizeof ( lazy_msg ) + ( p->count > 1 ? p->count - 1 : 0 ) * 2 * sizeof ( int );
+      lazy_msg* m = ( lazy_msg* ) lua_newuserdata ( L, sz );
+      m->plan = p;
+      m->data = data;
+      m->size = size;
+      m->scanned = false;
+      luaL_setmetatable ( L, "luapb.lazy" );
+
+      if ( lua_type ( L, cache ) == LUA_TTABLE )
+         lua_rawgeti ( L, cache, 1 );
+      else
+         lua_pushvalue ( L, cache );
+      lua_setuservalue ( L, -2 );
+   }
+
+   // __index(proxy, name)
+   int lazy_index ( lua_State *L )
+   {
+      lazy_msg* m = ( lazy_msg* ) luaL_checkudata ( L, 1, "luapb.lazy" );
+      if ( lua_type ( L, 2 ) != LUA_TSTRING )
+         return 0;
+      if ( lua_getuservalue ( L, 1 ) == LUA_TTABLE )
+      {
+         lua_pushvalue ( L, 2 );
+         if ( lua_rawget ( L, 3 ) != LUA_TNIL )
+            return 1;
+         lua_pop ( L, 1 );
+      }
+
+      lua_rawgeti ( L, LUA_REGISTRYINDEX, m->plan->names );
+      lua_pushvalue ( L, 2 );
+      lua_rawget ( L, -2 );
+      int i = ( int ) lua_tointeger ( L, -1 ) - 1;
+      lua_pop ( L, 2 );
+      if ( i < 0 )
+         return 0;
+
+      if ( !m->scanned )
+         scan ( L, m );
+      push_field ( L, m, i, 3 );
+
+      // 没有设置的子message是nil，不缓存
+      int t = lua_type ( L, -1 );
+      if ( t == LUA_TSTRING || t == LUA_TTABLE || t == LUA_TUSERDATA )
+      {
+         if ( lua_type ( L, 3 ) != LUA_TTABLE )
+         {
+            lua_createtable ( L, 1, 1 );
+            lua_pushvalue ( L, 3 );
+            lua_rawseti ( L, -2, 1 );
+            lua_pushvalue ( L, -1 );
+            lua_setuservalue ( L, 1 );
+            lua_replace ( L, 3 );
+         }
+         lua_pushvalue ( L, 2 );
+         lua_pushvalue ( L, -2 );
+         lua_rawset ( L, 3 );
+      }
+      return 1;
+   }
+
+   int lazy_newindex ( lua_State *L )
+   {
+      lazy_msg* m = ( lazy_msg* ) luaL_checkudata ( L, 1, "luapb.lazy" );
+      return luaL_error ( L, "luapb: lazy message '%s' is read-only", m->plan->desc->full_name ( ).c_str ( ) );
+   }
+
+   int lazy_tostring ( lua_State *L )
+   {
+      lazy_msg* m = ( lazy_msg* ) luaL_checkudata ( L, 1, "luapb.lazy" );
+      lua_pushfstring ( L, "luapb.lazy: %s: %p", m->plan->desc->full_name ( ).c_str ( ), ( void* ) m );
+      return 1;
+   }
+
+   /*---------------------------------------------------------------------------*/
+   /* lua module                                                                */
+   /*---------------------------------------------------------------------------*/
+   // decode/encode/materialize复用的message
+   Message* scratch ( message_plan* p )
+   {
+      if ( p->scratch == NULL )
+         p->scratch = MessageFactory::generated_factory ( )->GetPrototype ( p->desc )->New ( );
+      return p->scratch;
+   }
+
+   // 栈上1是message类型名，上值1是类型名到字段表的缓存
+   message_plan* check_type ( lua_State *L )
+   {
+      luaL_checktype ( L, 1, LUA_TSTRING );
+      lua_pushvalue ( L, 1 );
+      if ( lua_rawget ( L, lua_upvalueindex ( 1 ) ) == LUA_TUSERDATA )
+      {
+         message_plan* p = ( message_plan* ) lua_touserdata ( L, -1 );
+         lua_pop ( L, 1 );
+         return p;
+      }
+      lua_pop ( L, 1 );
+
+      const Descriptor* desc = DescriptorPool::generated_pool ( )->FindMessageTypeByName ( lua_tostring ( L, 1 ) );
+      if ( desc == NULL )
+         luaL_error ( L, "luapb: unknown message type '%s'", lua_tostring ( L, 1 ) );
+
+      message_plan* p = get_plan ( L, desc );
+      scratch ( p );
+
+      lua_pushvalue ( L, 1 );
+      lua_insert ( L, -2 );
+      lua_rawset ( L, lua_upvalueindex ( 1 ) );
+      return p;
+   }
+
+   int decode ( lua_State *L )
+   {
+      message_plan* p = check_type ( L );
+      size_t len = 0;
+      const char* data = luaL_checklstring ( L, 2, &len );
+
+      // 复用同一个message，已经分配的子message和字符串空间都会重用
+      if ( !p->scratch->ParseFromArray ( data, ( int ) len ) )
+      {
+         lua_pushnil ( L );
+         lua_pushfstring ( L, "luapb: failed to parse '%s'", lua_tostring ( L, 1 ) );
+         return 2;
+      }
+      push_msg ( L, p, *p->scratch );
+      return 1;
+   }
+
+   // lazy ( type, data )：不解码，返回data上的代理，访问字段时才解码
+   int lazy ( lua_State *L )
+   {
+      message_plan* p = check_type ( L );
+      size_t len = 0;
+      const char* data = luaL_checklstring ( L, 2, &len );
+      luaL_argcheck ( L, len <= INT_MAX, 2, "message too large" );
+      push_lazy ( L, p, data, len, 2 );
+      return 1;
+   }
+
+   // materialize ( proxy )：把代理完整解码成table
+   int materialize ( lua_State *L )
+   {
+      lazy_msg* m = ( lazy_msg* ) luaL_checkudata ( L, 1, "luapb.lazy" );
+      Message* msg = scratch ( m->plan );
+      if ( !msg->ParseFromArray ( m->data, ( int ) m->size ) )
+         lazy_error ( L, m );
+      push_msg ( L, m->plan, *msg );
+      return 1;
+   }
+
+   // enum ( type )：枚举的名字到值的table，如enum ( "LOGIN_MODULE_MSG_ID" ).ID_C2S_REQUEST_LOGIN
+   int enum_values ( lua_State *L )
+   {
+      const char* name = luaL_checkstring ( L, 1 );
+      const EnumDescriptor* ed = DescriptorPool::generated_pool ( )->FindEnumTypeByName ( name );
+      if ( ed == NULL )
+         luaL_error ( L, "luapb: unknown enum type '%s'", name );
+
+      lua_createtable ( L, 0, ed->value_count ( ) );
+      for ( int i = 0; i < ed->value_count ( ); ++i )
+      {
+         const EnumValueDescriptor* ev = ed->value ( i );
+         lua_pushinteger ( L, ev->number ( ) );
+         lua_setfield ( L, -2, ev->name ( ).c_str ( ) );
+      }
+      return 1;
+   }
+
+   int encode ( lua_State *L )
+   {
+      message_plan* p = check_type ( L );
+      luaL_checktype ( L, 2, LUA_TTABLE );
+
+      p->scratch->Clear ( );
+      read_msg ( L, 2, p, p->scratch );
+
+      // 直接序列化到lua的缓冲区
+      luaL_Buffer b;
+      size_t size = p->scratch->ByteSizeLong ( );
+      char* out = luaL_buffinitsize ( L, &b, size );
+      p->scratch->SerializeWithCachedSizesToArray ( ( google::protobuf::uint8* ) out );
+      luaL_pushresultsize ( &b, size );
+      return 1;
+   }
+}
+
+void luapb::push_message ( lua_State *L, const Message& msg )
+{
+   message_plan* p = get_plan ( L, msg.GetDescriptor ( ) );
+   lua_pop ( L, 1 );
+   push_msg ( L, p, msg );
+}
+
+void luapb::read_message ( lua_State *L, int index, Message* msg )
+{
+   index = lua_absindex ( L, index );
+   message_plan* p = get_plan ( L, msg->GetDescriptor ( ) );
+   lua_pop ( L, 1 );
+   msg->Clear ( );
+   read_msg ( L, index, p, msg );
+}
+
+extern "C" int luaopen_luapb ( lua_State *L )
+{
+   static const luaL_Reg funcs[] =
+   {
+      { "decode", decode },
+      { "encode", encode },
+      { "lazy", lazy },
+      { "materialize", materialize },
+      { "enum", enum_values },
+      { NULL, NULL }
+   };
+
+   static const luaL_Reg lazy_meta[] =
+   {
+      { "__index", lazy_index },
+      { "__newindex", lazy_newindex },
+      { "__tostring", lazy_tostring },
+      { NULL, NULL }
+   };
+
+   luaL_newmetatable ( L, "luapb.lazy" );
+   luaL_setfuncs ( L, lazy_meta, 0 );
+   lua_pop ( L, 1 );
+
+   luaL_newlibtable ( L, funcs );
+   // 类型名到字段表的缓存，作为所有函数的上值
+   lua_newtable ( L );
+   luaL_setfuncs ( L, funcs, 1 );
+   return 1;
+}
@@ -0,0 +1,38 @@
+﻿// luapb.h
+//
+// protobuf message和lua table之间的直接转换
+//
+// 通过反射遍历生成的message（如loginmessage.hxx.pb.h中的CLoginRequest），
+// 每个message类型第一次用到时生成字段表（field plan）缓存在lua_State里，
+// 字段名作为lua字符串常驻registry，之后的转换不再查找描述符、不再计算字段名的hash
+
+#if !defined(_LUAPB_H_)
+#define _LUAPB_H_
+
+#include "lua.h"
+
+namespace google { namespace protobuf { class Message; } }
+
+namespace luapb
+{
+   // msg转换成table压栈
+   // 单个的子message没有设置时不出现在table中；repeated字段是数组table，map字段是以key为键的table；
+   // 枚举是整数，string/bytes是lua string
+   void push_message ( lua_State *L, const google::protobuf::Message& msg );
+
+   // 把栈上index处的table写入msg（先Clear），table中没有的字段保持默认值
+   // 字段类型不符时抛出lua错误
+   void read_message ( lua_State *L, int index, google::protobuf::Message* msg );
+
+} // namespace luapb
+
+// require "luapb"
+// luapb.decode ( type, data )  解析二进制数据，返回table；解析失败返回nil和错误信息
+// luapb.encode ( type, table ) 返回序列化后的二进制数据
+// luapb.lazy ( type, data )    不解码，返回data上的只读代理，访问字段时才解码该字段并缓存，子message也是代理
+// luapb.materialize ( proxy )  把代理完整解码成table
+// luapb.enum ( type )          枚举的名字到值的table
+// type是message的全名，对应的pb.cc必须链接在程序里
+extern "C" int luaopen_luapb ( lua_State *L );
+
+#endif //_LUAPB_H_
@@ -6,8 +6,46 @@ extern "C"
 #include "lualib.h"  
 }
 #include "lua_tinker.h"
+#include "luapb.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 
-int main()
+// cluaprobuff.exe batch
+// per-message lua_tinker::call against lua_tinker::batch, same handler in dispatch.lua
+static void bench_dispatch(lua_State *L, const char* pData, int nSize)
+{
+	const int N = 1000000;
+	clock_t c = clock();
+	for (int i = 0; i < N; ++i)
+		lua_tinker::call<int>(L, "onMessage", (int)ID_C2S_REQUEST_LOGIN, lua_tinker::buffer(pData, nSize));
+	printf("%-16s %.3f\n", "call", (double)(clock() - c) / CLOCKS_PER_SEC);
+
+	lua_tinker::function tOnMessage(L, "onMessage");
+	c = clock();
+	for (int i = 0; i < N; ++i)
+		tOnMessage.call<int>((int)ID_C2S_REQUEST_LOGIN, lua_tinker::buffer(pData, nSize));
+	printf("%-16s %.3f\n", "function.call", (double)(clock() - c) / CLOCKS_PER_SEC);
+
+	static const int anBatch[] = { 16, 64, 256 };
+	for (int b = 0; b < (int)(sizeof(anBatch) / sizeof(anBatch[0])); ++b)
+	{
+		lua_tinker::batch tBatch(L, "dispatch");
+		c = clock();
+		for (int i = 0; i < N; ++i)
+		{
+			tBatch.add(ID_C2S_REQUEST_LOGIN, lua_tinker::buffer(pData, nSize));
+			if (tBatch.size() == anBatch[b])
+				tBatch.flush();
+		}
+		tBatch.flush();
+		char acName[32];
+		sprintf(acName, "batch %d", anBatch[b]);
+		printf("%-16s %.3f\n", acName, (double)(clock() - c) / CLOCKS_PER_SEC);
+	}
+}
+
+int main(int argc, char* argv[])
 {
 	CLoginRequest tRequest;
 	tRequest.set_name("hjhasdf");
@@ -15,13 +53,38 @@ int main()
 	tRequest.set_serverid(213412);
 
 	char acBuffer[1024] = {0};
-	tRequest.SerializeToArray(acBuffer, 1024);
+	int nSize = (int)tRequest.ByteSizeLong();
+	if (nSize >= (int)sizeof(acBuffer) || !tRequest.SerializeToArray(acBuffer, nSize))
+		return 1;
 
 	lua_State *L = luaL_newstate();
 	luaL_openlibs(L);
+	luaL_requiref(L, "luapb", luaopen_luapb, 0);
+	lua_pop(L, 1);
 	lua_tinker::dofile(L, "test.lua");
 
-	lua_tinker::call<int>(L, "printfMsg",acBuffer);
+	lua_tinker::call<int>(L, "printfMsg", lua_tinker::buffer::external(acBuffer, nSize));
+
+	{
+		luapb::push_message(L, tRequest);
+		lua_tinker::table tMsg(L, -1);
+		lua_pop(L, 1);
+		lua_tinker::call<int>(L, "printfTable", tMsg);
+	}
+
+	lua_tinker::dofile(L, "dispatch.lua");
+	{
+		lua_tinker::batch tBatch(L, "dispatch");
+		for (int i = 0; i < 3; ++i)
+			tBatch.add(ID_C2S_REQUEST_LOGIN, lua_tinker::buffer(acBuffer, nSize));
+		tBatch.flush();
+		printf("logins %d\n", lua_tinker::get<int>(L, "logins"));
+	}
+
+	if (argc > 1 && strcmp(argv[1], "batch") == 0)
+		bench_dispatch(L, acBuffer, nSize);
+	else if (argc > 1)
+		lua_tinker::dofile(L, argv[1]);
 
 	lua_close(L);
 	
@@ -28,6 +28,7 @@
 #include "ltm.h"
 #include "lundump.h"
 #include "lvm.h"
+#include "lworker.h"
 
 
 
@@ -534,6 +535,28 @@ LUA_API const char *lua_pushlstring (lua_State *L, const char *s, size_t len) {
   return getstr(ts);
 }
 
+/*
+** Pushes on the stack a string with the 'len' bytes at 's', which must
+** be followed by a '\0', without copying them (unless it is a short
+** string). Lua calls 'frel(ud, s, len + 1, 0)', if 'frel' is not NULL,
+** when it no longer needs them; 's' must stay valid and unchanged until
+** then.
+*/
+// 压入一个由s处的len个字节组成的字符串（后面必须跟着'\0'），不复制它们（除非是短字符串）。
+// Lua不再需要它们时调用frel(ud, s, len + 1, 0)（frel不是NULL的话），在那之前s必须保持有效且不变
+LUA_API const char *lua_pushexternalstring (lua_State *L, const char *s,
+                                    size_t len, lua_Alloc frel, void *ud) {
+  TString *ts;
+  lua_lock(L);
+  api_check(L, s[len] == '\0', "string not ending with a '\\0'");
+  ts = luaS_newextlstr(L, s, len, frel, ud);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+
 // 压入一个以'0'结尾的字符串
 LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
   lua_lock(L);
@@ -684,7 +707,11 @@ LUA_API int lua_geti (lua_State *L, int idx, lua_Integer n) {
   const TValue *slot;
   lua_lock(L);
   t = index2addr(L, idx);
-  if (luaV_fastget(L, t, n, slot, luaH_getint)) {
+  if (ttistable(t) && inpacked(hvalue(t), n)) {  /* packed element? */
+    getpacked(hvalue(t), n, L->top);
+    api_incr_top(L);
+  }
+  else if (luaV_fastget(L, t, n, slot, luaH_getint)) {
     setobj2s(L, L->top, slot);
     api_incr_top(L);
   }
@@ -742,7 +769,7 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
   sethvalue(L, L->top, t);
   api_incr_top(L);
   if (narray > 0 || nrec > 0)
-    luaH_resize(L, t, narray, nrec);
+    luaH_presize(L, t, narray, nrec);
   luaC_checkGC(L);
   lua_unlock(L);
 }
@@ -859,7 +886,7 @@ LUA_API void lua_seti (lua_State *L, int idx, lua_Integer n) {
 // 栈索引idx的为表，L->top - 2为键，L->top - 1为值
 LUA_API void lua_rawset (lua_State *L, int idx) {
   StkId o;
-  TValue *slot;
+  Table *t;
   lua_lock(L);
   // 栈里面是否有2个数据
   api_checknelems(L, 2);
@@ -867,10 +894,9 @@ LUA_API void lua_rawset (lua_State *L, int idx) {
   o = index2addr(L, idx);
   // 检查索引对于是值是否是表
   api_check(L, ttistable(o), "table expected");
-  // L->top - 2为键，L->top - 1为值
-  slot = luaH_set(L, hvalue(o), L->top - 2);
-  // 将栈顶的值赋给对应的slot
-  setobj2t(L, slot, L->top - 1);
+  t = hvalue(o);
+  // L->top - 2为键，L->top - 1为值，将栈顶的值赋给t[L->top - 2]
+  luaH_finishset(L, t, L->top - 2, luaH_get(t, L->top - 2), L->top - 1);
   invalidateTMcache(hvalue(o));
   luaC_barrierback(L, hvalue(o), L->top-1);
   // 将键和值出栈
@@ -1169,6 +1195,30 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         res = 1;  /* signal it */
       break;
     }
+    case LUA_GCSTEPTIME: {  /* incremental work for 'data' microseconds */
+      lu_byte oldrunning = g->gcrunning;
+      g->gcrunning = 1;  /* allow GC to run */
+      res = luaC_steptime(L, data);
+      g->gcrunning = oldrunning;  /* restore previous state */
+      break;
+    }
+    case LUA_GCBGFREE: {  /* free dead objects in a helper thread? */
+      if (data)  /* 0 if there are no threads or the allocator is unsafe */
+        res = luaW_startfree(L);
+      else
+        luaW_stopfree(L);
+      break;
+    }
+    case LUA_GCSETMARKTHREADS: {  /* threads marking in full collections */
+      res = g->gcmarkthreads;
+#if defined(LUAI_PARMARK)
+      if (data < 1 || !threadsafealloc(g))
+        data = 1;  /* markers would race in an undeclared allocator */
+      else if (data > LUAI_MAXWORKERS) data = LUAI_MAXWORKERS;
+      g->gcmarkthreads = cast_byte(data);
+#endif
+      break;
+    }
     case LUA_GCSETPAUSE: {
       res = g->gcpause;
       g->gcpause = data;
@@ -1184,6 +1234,27 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: {
+      res = isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      luaC_changemode(L, KGC_GEN);
+      break;
+    }
+    case LUA_GCINC: {
+      res = isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      luaC_changemode(L, KGC_INC);
+      break;
+    }
+    case LUA_GCSETMINORMUL: {
+      res = g->genminormul;
+      if (data < 1) data = 1;  /* avoid a collection at every allocation */
+      g->genminormul = data;
+      break;
+    }
+    case LUA_GCSETMAJORMUL: {
+      res = g->genmajormul;
+      g->genmajormul = data;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1258,11 +1329,34 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
   return f;
 }
 
-// 设置内存分配函数
+// 设置内存分配函数；新的分配器没有声明为线程安全，所以辅助线程停止
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  luaW_stopfree(L);  /* helper must not use the old allocator anymore */
   G(L)->ud = ud;
   G(L)->frealloc = f;
+  G(L)->tsalloc = NULL;  /* not declared thread safe (yet) */
+  lua_unlock(L);
+}
+
+
+/*
+** Declare whether the current allocator of the state can be called
+** from several threads at once. Only then can the collector use helper
+** threads. The declaration is for that allocator only: 'lua_setallocf'
+** cancels it.
+*/
+// 宿主声明状态机当前的分配器是否可以被多个线程同时调用，只有这样收集器才能使用辅助线程。
+// 声明只对当前的分配器有效，lua_setallocf会取消它
+LUA_API void lua_setallocsafe (lua_State *L, int safe) {
+  global_State *g = G(L);
+  lua_lock(L);
+  if (safe)
+    g->tsalloc = g->frealloc;
+  else {
+    luaW_stopfree(L);
+    g->tsalloc = NULL;
+  }
   lua_unlock(L);
 }
 
@@ -1382,6 +1476,7 @@ LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
   *up1 = *up2;
   (*up1)->refcount++;
   if (upisopen(*up1)) (*up1)->u.open.touched = 1;
+  if (isold(f1)) (*up1)->oldowner = 1;
   luaC_upvalbarrier(L, *up1);
 }
 
@@ -1230,12 +1230,429 @@ static int panic (lua_State *L) {
 
 // һµ Lua ״̬ һڱ׼ C  realloc ʵֵڴ  lua_newstate  
 // ѿɴӡһЩϢ׼ panic μ 4.6 úãڴ
+// reallocfreḛ߳ȫģͬʱ̰߳ȫ
 LUALIB_API lua_State *luaL_newstate (void) {
   lua_State *L = lua_newstate(l_alloc, NULL);
+  if (L) {
+    lua_atpanic(L, &panic);
+    lua_setallocsafe(L, 1);  /* 'realloc' and 'free' are thread safe */
+  }
+  return L;
+}
+
+
+
+/*
+** {======================================================
+** Size-class pool allocator
+** =======================================================
+*/
+
+/*
+** Blocks up to POOLMAXSIZE bytes are carved from slabs of LUAL_SLABSIZE
+** bytes; all blocks in a slab belong to the same size class. Slabs are
+** aligned to their size, so the slab of a block is found by masking
+** its address; Lua always gives the old size of a block, so blocks
+** need no header. Larger blocks go to 'realloc'. A slab that becomes
+** empty is released, unless it is the last one with free blocks in
+** its class. The pool itself is released when its last block (the
+** state itself, in 'lua_close') is freed.
+** Lua assumes that shrinking a block cannot fail, so a shrink that
+** finds no slab keeps the old block: a small block stays in its larger
+** class, and a large block becomes 'stranded', a large block with a
+** small size. Stranded blocks are kept in a list, linked through the
+** space past POOLMAXSIZE that every large block has.
+*/
+// POOLMAXSIZEֽڵĿLUAL_SLABSIZEֽڵslabз䣬һslabеĿСͬ
+// slabԼĴС룬ԿַȥλڵslabLuaͷź·ʱܻԭĴС
+// Կ鲻ҪͷĿ齻reallocյslabᱻͷţȼһппslab
+// һ飨lua_closeе״̬ͷʱڴԼҲͷš
+// LuaΪСڴ鲻ʧܣСʱòslabͱԭĿ飺Сԭĵȼ
+// Ϊ"ǳ"Ŀ飨СĳȼĴ飩ǳĿһ
+// Ӵڴ鶼еPOOLMAXSIZE֮Ŀռ
+
+/* size of a slab (must be a power of 2) */
+// slabĴС2ݣ
+#if !defined(LUAL_SLABSIZE)
+#define LUAL_SLABSIZE	(16 * 1024)
+#endif
+
+/* largest block served by the size classes */
+// СȼܷĿ
+#define POOLMAXSIZE	512
+
+/* smallest allocation for a large block: room for the stranded link */
+// ٷôǳʱӵλ
+#define LARGEMINSIZE	(POOLMAXSIZE + sizeof(void *))
+#define largesize(n)	((n) < LARGEMINSIZE ? LARGEMINSIZE : (n))
+
+/* next stranded block after 'b' */
+// ǳĿb֮һ
+#define strandnext(b)	(*(void **)((char *)(b) + POOLMAXSIZE))
+
+
+/* integer type to hold a pointer, to mask block addresses */
+// ָܷͣεַĵλ
+#if !defined(LUA_USE_C89)
+#include <stdint.h>
+#define L_P2I	uintptr_t
+#else  /* no 'uintptr_t' */
+#define L_P2I	size_t
+#endif
+
+
+/* block size of each class */
+// ÿȼĿС
+static const unsigned short poolsizes[LUAL_POOLCLASSES] = {
+  16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+
+typedef struct PoolSlab {
+  struct PoolSlab *next;  /* list of slabs with free blocks in a class */
+  struct PoolSlab *prev;
+  void *freeblocks;  /* list of freed blocks */
+  char *top;  /* first block never used */
+  char *limit;  /* end of the area for blocks */
+  void *mem;  /* memory block holding the slab */
+  unsigned int nused;  /* number of blocks in use */
+  int cls;  /* size class */
+} PoolSlab;
+
+
+typedef struct PoolClass {
+  PoolSlab *avail;  /* slabs with free blocks */
+  size_t nslabs;  /* number of slabs */
+  size_t nblocks;  /* number of blocks in use */
+  size_t nallocs;  /* total number of allocations */
+} PoolClass;
+
+
+typedef struct Pool {
+  PoolClass cls[LUAL_POOLCLASSES];
+  void *stranded;  /* list of stranded large blocks */
+  size_t reqbytes;  /* bytes requested for blocks in slabs */
+  size_t largebytes;  /* bytes in large blocks */
+  size_t nlarge;  /* number of large blocks */
+  size_t nlive;  /* number of blocks in use (small and large) */
+} Pool;
+
+
+/* size of the slab header, keeping blocks aligned */
+// slabͷĴС֤Ƕ
+#define SLABHEADER	((sizeof(PoolSlab) + 15) & ~(size_t)15)
+
+/* number of blocks in a slab of class 'c' */
+#define slabcapacity(c)	((LUAL_SLABSIZE - SLABHEADER) / poolsizes[c])
+
+/* slab owning block 'b' */
+// bڵslab
+#define slabof(b)  \
+	((PoolSlab *)((L_P2I)(b) & ~(L_P2I)(LUAL_SLABSIZE - 1)))
+
+/* whether slab 's' has no free blocks */
+#define slabfull(s)  \
+	((s)->freeblocks == NULL && (s)->top + poolsizes[(s)->cls] > (s)->limit)
+
+
+/*
+** Size class for a block of 'size' bytes (1 <= size <= POOLMAXSIZE)
+*/
+// õsizeֽڵĿڵĴСȼ
+static int poolclass (size_t size) {
+  if (size <= 128)
+    return (int)((size + 15) >> 4) - 1;
+  else if (size <= 256)
+    return 8 + (int)((size - 129) >> 5);
+  else
+    return 12 + (int)((size - 257) >> 6);
+}
+
+
+/*
+** Allocate memory for a slab aligned to its size. Where no aligned
+** allocation is available, take twice the size and align inside it.
+** A host may define its own 'l_slaballoc' and 'l_slabfree'.
+*/
+// һԼСslabûж亯ʱС롣
+// ԶԼl_slaballocl_slabfree
+#if defined(l_slaballoc)	/* { */
+
+#elif defined(_WIN32)
+
+#include <malloc.h>
+#define l_slaballoc(pm)	(*(pm) = _aligned_malloc(LUAL_SLABSIZE, LUAL_SLABSIZE))
+#define l_slabfree(m)	_aligned_free(m)
+
+#elif !defined(LUA_USE_C89)
+
+#define l_slaballoc(pm)  \
+	(posix_memalign((pm), LUAL_SLABSIZE, LUAL_SLABSIZE) == 0 ? *(pm) : NULL)
+#define l_slabfree(m)	free(m)
+
+#else
+
+#define l_slaballoc(pm)  ((*(pm) = malloc(2 * LUAL_SLABSIZE)) == NULL ? NULL \
+	: (void *)(((L_P2I)*(pm) + LUAL_SLABSIZE - 1) & \
+	           ~(L_P2I)(LUAL_SLABSIZE - 1)))
+#define l_slabfree(m)	free(m)
+
+#endif			/* } */
+
+
+static PoolSlab *newslab (Pool *p, int c) {
+  void *mem = NULL;
+  PoolSlab *s = (PoolSlab *)l_slaballoc(&mem);
+  if (s == NULL) return NULL;
+  s->mem = mem;
+  s->freeblocks = NULL;
+  s->top = (char *)s + SLABHEADER;
+  s->limit = (char *)s + LUAL_SLABSIZE;
+  s->nused = 0;
+  s->cls = c;
+  s->prev = NULL;  /* link it in the list of slabs with free blocks */
+  s->next = p->cls[c].avail;
+  if (s->next) s->next->prev = s;
+  p->cls[c].avail = s;
+  p->cls[c].nslabs++;
+  return s;
+}
+
+
+static void unlinkslab (PoolClass *pc, PoolSlab *s) {
+  if (s->prev) s->prev->next = s->next;
+  else pc->avail = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
+
+
+/*
+** Get a block of class 'c'
+*/
+// ӵȼcзһ
+static void *slabget (Pool *p, int c) {
+  PoolClass *pc = &p->cls[c];
+  PoolSlab *s = pc->avail;
+  void *b;
+  if (s == NULL && (s = newslab(p, c)) == NULL)
+    return NULL;
+  if (s->freeblocks != NULL) {  /* reuse a freed block? */
+    b = s->freeblocks;
+    s->freeblocks = *(void **)b;
+  }
+  else {  /* take a new one */
+    b = s->top;
+    s->top += poolsizes[c];
+  }
+  s->nused++;
+  if (slabfull(s))
+    unlinkslab(pc, s);  /* no more free blocks here */
+  pc->nblocks++;
+  pc->nallocs++;
+  return b;
+}
+
+
+/*
+** Return block 'b' to its slab
+*/
+// bڵslab
+static void slabput (Pool *p, void *b) {
+  PoolSlab *s = slabof(b);
+  PoolClass *pc = &p->cls[s->cls];
+  if (slabfull(s)) {  /* slab will have a free block again? */
+    s->prev = NULL;
+    s->next = pc->avail;
+    if (s->next) s->next->prev = s;
+    pc->avail = s;
+  }
+  *(void **)b = s->freeblocks;
+  s->freeblocks = b;
+  pc->nblocks--;
+  if (--s->nused == 0 && (s->prev != NULL || s->next != NULL)) {
+    unlinkslab(pc, s);  /* empty and not the last available slab */
+    pc->nslabs--;
+    l_slabfree(s->mem);
+  }
+}
+
+
+static void freepool (Pool *p) {
+  int c;
+  for (c = 0; c < LUAL_POOLCLASSES; c++) {
+    PoolSlab *s = p->cls[c].avail;
+    while (s != NULL) {  /* with no blocks in use, all slabs are here */
+      PoolSlab *next = s->next;
+      l_slabfree(s->mem);
+      s = next;
+    }
+  }
+  free(p);
+}
+
+
+/*
+** Whether 'b' is a stranded block
+*/
+// bǲǸǳĿ
+static int isstranded (Pool *p, void *b) {
+  void *s;
+  for (s = p->stranded; s != NULL; s = strandnext(s))
+    if (s == b) return 1;
+  return 0;
+}
+
+
+static void strand (Pool *p, void *b) {
+  strandnext(b) = p->stranded;
+  p->stranded = b;
+}
+
+
+static void unstrand (Pool *p, void *b) {
+  void **ps = &p->stranded;
+  while (*ps != b)
+    ps = &strandnext(*ps);
+  *ps = strandnext(b);
+}
+
+
+/*
+** Free block 'b' of 'size' bytes ('large' tells whether it came from
+** 'malloc'; a stranded block has a small size)
+*/
+// ͷsizeֽڵĿblargeʾǲmallocģǳĿССģ
+static void poolfree (Pool *p, void *b, size_t size, int large) {
+  if (!large) {
+    slabput(p, b);
+    p->reqbytes -= size;
+  }
+  else {
+    if (size <= POOLMAXSIZE)
+      unstrand(p, b);
+    free(b);
+    p->largebytes -= size;
+    p->nlarge--;
+  }
+  if (--p->nlive == 0)  /* freed the state itself? */
+    freepool(p);
+}
+
+
+// ڴصķ亯
+static void *l_poolalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  int large;  /* whether the old block came from 'malloc' */
+  void *b;
+  if (ptr == NULL) {
+    osize = 0;  /* 'osize' is the type of the new object */
+    large = 0;
+  }
+  else
+    large = (osize > POOLMAXSIZE ||
+             (p->stranded != NULL && isstranded(p, ptr)));
+  if (nsize == 0) {
+    if (ptr != NULL) poolfree(p, ptr, osize, large);
+    return NULL;
+  }
+  else if (nsize <= POOLMAXSIZE) {
+    int c = poolclass(nsize);
+    if (!large && osize != 0 && poolclass(osize) == c) {
+      p->reqbytes += nsize - osize;  /* block still fits in its class */
+      return ptr;
+    }
+    if ((b = slabget(p, c)) == NULL) {
+      if (!large && nsize > osize)
+        return NULL;
+      /* shrinking (or a stranded block): keep the old block, which is
+         large enough */
+      // С߸ǳĿ飩ԭĿ飬㹻
+      if (!large)
+        p->reqbytes += nsize - osize;
+      else {
+        if (osize > POOLMAXSIZE)  /* not stranded yet? */
+          strand(p, ptr);
+        p->largebytes += nsize - osize;
+      }
+      return ptr;
+    }
+    p->reqbytes += nsize;
+  }
+  else if (large) {  /* large block stays large */
+    if (osize <= POOLMAXSIZE)  /* stranded block grows large again? */
+      unstrand(p, ptr);
+    if ((b = realloc(ptr, largesize(nsize))) == NULL) {
+      if (osize <= POOLMAXSIZE)  /* still stranded */
+        strand(p, ptr);
+      return NULL;
+    }
+    p->largebytes += nsize - osize;
+    return b;
+  }
+  else {
+    if ((b = malloc(largesize(nsize))) == NULL)
+      return NULL;
+    p->largebytes += nsize;
+    p->nlarge++;
+  }
+  p->nlive++;
+  if (ptr != NULL) {  /* move the contents from the old block */
+    memcpy(b, ptr, (osize < nsize) ? osize : nsize);
+    poolfree(p, ptr, osize, large);
+  }
+  return b;
+}
+
+
+/*
+** Create a state using a new pool. The creator holds one reference
+** to the pool while creating the state, so that the pool survives
+** (or is released) correctly whatever happens in 'lua_newstate'.
+*/
+// һʹڴص״̬
+LUALIB_API lua_State *luaL_newstatepool (void) {
+  lua_State *L;
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(Pool));
+  p->nlive = 1;  /* reference held by this function */
+  L = lua_newstate(l_poolalloc, p);
+  if (--p->nlive == 0)  /* state was not created? */
+    freepool(p);
   if (L) lua_atpanic(L, &panic);
   return L;
 }
 
+
+// õڴصʹ
+LUALIB_API int luaL_poolstats (lua_State *L, luaL_PoolStats *st) {
+  void *ud;
+  Pool *p;
+  int c;
+  if (lua_getallocf(L, &ud) != l_poolalloc)
+    return 0;  /* state does not use a pool */
+  p = (Pool *)ud;
+  st->slabbytes = st->usedbytes = 0;
+  for (c = 0; c < LUAL_POOLCLASSES; c++) {
+    PoolClass *pc = &p->cls[c];
+    st->cls[c].size = poolsizes[c];
+    st->cls[c].nslabs = pc->nslabs;
+    st->cls[c].nblocks = pc->nblocks;
+    st->cls[c].nfree = pc->nslabs * slabcapacity(c) - pc->nblocks;
+    st->cls[c].nallocs = pc->nallocs;
+    st->slabbytes += pc->nslabs * LUAL_SLABSIZE;
+    st->usedbytes += pc->nblocks * poolsizes[c];
+  }
+  st->reqbytes = p->reqbytes;
+  st->largebytes = p->largebytes;
+  st->nlarge = p->nlarge;
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
 // lua汾
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   const lua_Number *v = lua_version(L);
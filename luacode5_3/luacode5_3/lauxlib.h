@@ -210,6 +210,57 @@ typedef struct luaL_Stream {
 
 
 
+/*
+** {======================================================
+** Size-class pool allocator
+** =======================================================
+*/
+
+/*
+** A state created by 'luaL_newstatepool' serves small blocks from
+** per-size-class slabs instead of 'realloc'. The pool belongs to that
+** state only (no locking) and is released by 'lua_close'. It is not
+** thread safe, so it must not be declared with 'lua_setallocsafe'.
+*/
+// СּڴطluaL_newstatepool״̬СڴӰСּslabз䣬
+// ٵreallocڴֻ״̬lua_closeʱͷš
+// ̰߳ȫģlua_setallocsafe
+
+/* number of size classes of the pool allocator */
+// ڴдСȼĿ
+#define LUAL_POOLCLASSES	16
+
+/* usage of one size class */
+// һСȼʹ
+typedef struct luaL_PoolClass {
+  size_t size;  /* size of the blocks of this class */
+  size_t nslabs;  /* number of slabs owned by this class */
+  size_t nblocks;  /* number of blocks in use */
+  size_t nfree;  /* number of free blocks in its slabs */
+  size_t nallocs;  /* total number of allocations served */
+} luaL_PoolClass;
+
+/* usage of a pool; 'usedbytes - reqbytes' is the internal fragmentation
+   and 'slabbytes - usedbytes' is the memory kept in free blocks */
+// ڴصʹusedbytes - reqbytesڲƬslabbytes - usedbytesǿпռõڴ
+typedef struct luaL_PoolStats {
+  size_t slabbytes;  /* memory held in slabs */
+  size_t usedbytes;  /* memory of the blocks in use (whole blocks) */
+  size_t reqbytes;  /* memory requested for those blocks */
+  size_t largebytes;  /* memory of blocks too large for any class */
+  size_t nlarge;  /* number of those blocks */
+  luaL_PoolClass cls[LUAL_POOLCLASSES];
+} luaL_PoolStats;
+
+// һʹڴط״̬
+LUALIB_API lua_State *(luaL_newstatepool) (void);
+// õڴصʹ״̬ڴشķ0
+LUALIB_API int (luaL_poolstats) (lua_State *L, luaL_PoolStats *st);
+
+/* }====================================================== */
+
+
+
 /* compatibility with old module system */
 #if defined(LUA_COMPAT_MODULE)
 
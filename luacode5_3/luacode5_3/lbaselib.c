@@ -227,27 +227,43 @@ static int luaB_collectgarbage (lua_State *L) {
     // 选项
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", NULL};
+    "isrunning", "generational", "incremental", "steptime", NULL};
   // 选项
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCSTEPTIME};
   // 选项数字
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   // 额外的选项数字
   int ex = (int)luaL_optinteger(L, 2, 0);
+  int res;
+  if (o == LUA_GCGEN) {  /* optional minor and major multipliers */
+    int majormul = (int)luaL_optinteger(L, 3, 0);
+    if (ex != 0) lua_gc(L, LUA_GCSETMINORMUL, ex);
+    if (majormul != 0) lua_gc(L, LUA_GCSETMAJORMUL, majormul);
+  }
+  else if (o == LUA_GCINC) {  /* optional pause and step multiplier */
+    int stepmul = (int)luaL_optinteger(L, 3, 0);
+    if (ex != 0) lua_gc(L, LUA_GCSETPAUSE, ex);
+    if (stepmul != 0) lua_gc(L, LUA_GCSETSTEPMUL, stepmul);
+  }
   // 调用垃圾收集函数
-  int res = lua_gc(L, o, ex);
+  res = lua_gc(L, o, ex);
   switch (o) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, (lua_Number)res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: case LUA_GCISRUNNING: {
+    case LUA_GCSTEP: case LUA_GCISRUNNING: case LUA_GCSTEPTIME: {
       lua_pushboolean(L, res);
       return 1;
     }
+    // 切换模式时返回之前的模式
+    case LUA_GCGEN: case LUA_GCINC: {
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushinteger(L, res);
       return 1;
@@ -51,6 +51,7 @@ void luaF_initupvals (lua_State *L, LClosure *cl) {
     UpVal *uv = luaM_new(L, UpVal);
     // 设置引用计数
     uv->refcount = 1;
+    uv->oldowner = 0;
     // 都是close状态
     uv->v = &uv->u.value;  /* make it closed */
     setnilvalue(uv->v);
@@ -76,6 +77,7 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
   // 没找到就新建一个
   uv = luaM_new(L, UpVal);
   uv->refcount = 0;
+  uv->oldowner = 0;
   // 链接到open upvalues列表
   uv->u.open.next = *pp;  /* link it to list of open upvalues */
   uv->u.open.touched = 1;
@@ -125,6 +127,8 @@ Proto *luaF_newproto (lua_State *L) {
   f->code = NULL;
   f->cache = NULL;
   f->sizecode = 0;
+  f->icache = NULL;
+  f->sizeicache = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
   f->upvalues = NULL;
@@ -140,9 +144,25 @@ Proto *luaF_newproto (lua_State *L) {
   return f;
 }
 
+/*
+** create the (empty) inline caches of a prototype, one for each
+** instruction of its (already complete) code
+*/
+// 为函数原型创建内联缓存，每条指令一个，代码必须已经生成完毕
+void luaF_initicache (lua_State *L, Proto *f) {
+  int i;
+  luaM_reallocvector(L, f->icache, f->sizeicache, f->sizecode, InlineCache);
+  f->sizeicache = f->sizecode;
+  for (i = 0; i < f->sizeicache; i++) {
+    f->icache[i].owner = NULL;
+    f->icache[i].slot = 0;
+  }
+}
+
 // 释放函数原型
 void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode);
+  luaM_freearray(L, f->icache, f->sizeicache);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
@@ -50,6 +50,8 @@ struct UpVal {
   TValue *v;  /* points to stack or to its own value */
   // 引用计数
   lu_mem refcount;  /* reference counter */
+  // 是否可能被老闭包引用（分代模式下给这样的上值赋值时，新值要直接变老）
+  lu_byte oldowner;  /* true if some old closure may point to it */
   union {
     // 开放状态，指向变量的指针就好了
     struct {  /* (when open) */
@@ -72,6 +74,7 @@ LUAI_FUNC void luaF_initupvals (lua_State *L, LClosure *cl);
 LUAI_FUNC UpVal *luaF_findupval (lua_State *L, StkId level);
 LUAI_FUNC void luaF_close (lua_State *L, StkId level);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
+LUAI_FUNC void luaF_initicache (lua_State *L, Proto *f);
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
 
@@ -11,6 +11,7 @@
 
 
 #include <string.h>
+#include <time.h>
 
 #include "lua.h"
 
@@ -24,6 +25,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lworker.h"
 
 
 /*
@@ -47,6 +49,15 @@
 // һfinalizerĳɱ
 #define GCFINALIZECOST	GCSWEEPCOST
 
+/*
+** strong tables with more entries than this are traversed in chunks
+** of this many entries during the propagate phase
+*/
+// ֵǿڷֳ׶ηֿÿһô
+#if !defined(GCTABLECHUNK)
+#define GCTABLECHUNK	1024
+#endif
+
 
 /*
 ** macro to adjust 'stepmul': 'stepmul' is actually used like
@@ -77,6 +88,8 @@
 #define white2gray(x)	resetbits(x->marked, WHITEBITS)
 // ɫɻɫ
 #define black2gray(x)	resetbit(x->marked, BLACKBIT)
+// ɫλλ
+#define maskgcbits	(maskcolors & ~AGEBITS)
 
 // ֵǷΪɫ
 #define valiswhite(x)   (iscollectable(x) && iswhite(gcvalue(x)))
@@ -126,6 +139,27 @@ static void reallymarkobject (global_State *g, GCObject *o);
 // oӵp
 #define linkgclist(o,p)	((o)->gclist = (p), (p) = obj2gco(o))
 
+/* whether there is still something to propagate */
+// ǷҪֳĶ󣨻ɫڷֿı
+#define hasgray(g)	((g)->gray != NULL || (g)->travtable != NULL)
+
+
+/*
+** Return the address of the 'gclist' field of an object that can be
+** in a gray list.
+*/
+// ؿԷڻɫеĶgclistֶεĵַ
+static GCObject **getgclist (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: return &gco2t(o)->gclist;
+    case LUA_TLCL: return &gco2lcl(o)->gclist;
+    case LUA_TCCL: return &gco2ccl(o)->gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return NULL;
+  }
+}
+
 
 /*
 ** If key is not marked, mark its entry as dead. This allows key to be
@@ -180,6 +214,7 @@ static int iscleared (global_State *g, const TValue *o) {
 // luaC_barrier_˵:
 // pΪɫ,vΪɻն,vΪɫ
 // 1)ǰGCҪֲʽ״̬(ֳԭӽ׶),v;
+//   ִģʽp϶vҲҪֱӱ(G_OLD0)֤϶󲻻ָ¶
 // 2)Ϊɨ׶,pΪɫ,˵˺ǰbarrier,ֱӰpɨʱɫл
 // õط:
 // 1)lua_copy:ƵλCհֵ
@@ -194,18 +229,26 @@ static int iscleared (global_State *g, const TValue *o) {
 void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
   lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
-  if (keepinvariant(g))  /* must keep invariant? */
+  if (keepinvariant(g)) {  /* must keep invariant? */
     reallymarkobject(g, v);  /* restore invariant */
+    if (isold(o)) {
+      lua_assert(!isold(v));  /* white object could not be old */
+      setage(v, G_OLD0);  /* restore generational invariant */
+    }
+  }
   else {  /* sweep phase */
     lua_assert(issweepphase(g));
-    makewhite(g, o);  /* mark main obj. as white to avoid other barriers */
+    if (g->gckind == KGC_INC)  /* incremental mode? */
+      makewhite(g, o);  /* mark main obj. as white to avoid other barriers */
   }
 }
 
 
 /*
 ** barrier that moves collector backward, that is, mark the black object
-** pointing to a white object as gray again.
+** pointing to a white object as gray again. In generational mode, the
+** table is also marked as "touched", so that the next minor collections
+** traverse it again.
 */
 // luaC_barrierback ˵ : pΪɫ, vΪɻն, vΪɫpΪɫӵgrayagain
 //õط:
@@ -216,11 +259,16 @@ void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
 //5)luaV_finishset
 //6)ִOP_SETLIST
 //7)luaV_fastset
+// ִģʽͬʱѱΪ""(G_TOUCHED1)Сջ±
 void luaC_barrierback_ (lua_State *L, Table *t) {
   global_State *g = G(L);
   lua_assert(isblack(t) && !isdead(g, t));
+  lua_assert((g->gckind == KGC_GEN) == (isold(t) && getage(t) != G_TOUCHED1));
   black2gray(t);  /* make table gray (again) */
-  linkgclist(t, g->grayagain);
+  if (getage(t) != G_TOUCHED2)  /* not already in 'grayagain'? */
+    linkgclist(t, g->grayagain);
+  if (isold(t))  /* generational mode? */
+    setage(t, G_TOUCHED1);  /* touched in current cycle */
 }
 
 
@@ -228,7 +276,9 @@ void luaC_barrierback_ (lua_State *L, Table *t) {
 ** barrier for assignments to closed upvalues. Because upvalues are
 ** shared among closures, it is impossible to know the color of all
 ** closures pointing to it. So, we assume that the object being assigned
-** must be marked.
+** must be marked. In generational mode, if some old closure may point
+** to the upvalue, the object must also become old, as old closures are
+** not traversed by minor collections.
 */
 // պupvaluesbarrierΪupvaluesڸհйģ
 // ָ֪еıհɫԣǼٶobject뱻
@@ -245,8 +295,11 @@ void luaC_upvalbarrier_ (lua_State *L, UpVal *uv) {
   global_State *g = G(L);
   GCObject *o = gcvalue(uv->v);
   lua_assert(!upisopen(uv));  /* ensured by macro luaC_upvalbarrier */
-  if (keepinvariant(g))
+  if (keepinvariant(g)) {
     markobject(g, o);
+    if (g->gckind == KGC_GEN && uv->oldowner && !isold(o))
+      setage(o, G_OLD0);  /* restore generational invariant */
+  }
 }
 
 // oԶ
@@ -255,6 +308,7 @@ void luaC_fix (lua_State *L, GCObject *o) {
   lua_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
   // ǽԶǻɫ
   white2gray(o);  /* they will be gray forever */
+  setage(o, G_OLD);  /* and old forever */
   // ӡallgcбɾ 
   g->allgc = o->next;  /* remove object from 'allgc' list */
   // ӵfixedgcб
@@ -317,7 +371,7 @@ static void reallymarkobject (global_State *g, GCObject *o) {
     }
     case LUA_TLNGSTR: {
       gray2black(o);
-      g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
+      g->GCmemtrav += sizelngstr(gco2ts(o));
       break;
     }
     case LUA_TUSERDATA: {
@@ -429,6 +483,7 @@ static void remarkupvals (global_State *g) {
 static void restartcollection (global_State *g) {
   // ջɫб
   g->gray = g->grayagain = NULL;
+  g->travtable = NULL;
   // 
   g->weak = g->allweak = g->ephemeron = NULL;
   markobject(g, g->mainthread);
@@ -447,11 +502,44 @@ static void restartcollection (global_State *g) {
 ** =======================================================
 */
 
+/*
+** Mark the keys in the shape of table 'h'. (They are strings, which
+** are values and so are never weak.)
+*/
+// Ǳ״еļַᱻã
+static void markshapekeys (global_State *g, Table *h) {
+  int i;
+  for (i = 0; i < shapesize(h); i++)
+    markobject(g, h->shape->keys[i]);
+}
+
+
+/*
+** In generational mode, a table touched by a barrier in this cycle
+** (G_TOUCHED1) goes back to 'grayagain', so that the next minor
+** collection traverses it again (its new referents are still young);
+** a table touched in the previous cycle (G_TOUCHED2) is done with that
+** and becomes a regular old table.
+*/
+// ִģʽ£ֱı(G_TOUCHED1)·ŻgrayagainһСջҪٱһ
+// õĶģһı(G_TOUCHED2)ͨ϶
+static void genlink (global_State *g, Table *h) {
+  lua_assert(isblack(h));
+  if (getage(h) == G_TOUCHED1) {  /* touched in this cycle? */
+    black2gray(h);
+    linkgclist(h, g->grayagain);  /* link it back in 'grayagain' */
+  }  /* everything else do not need to be linked back */
+  else if (getage(h) == G_TOUCHED2)
+    changeage(h, G_TOUCHED2, G_OLD);  /* advance age */
+}
+
+
 /*
 ** Traverse a table with weak values and link it to proper list. During
 ** propagate phase, keep it in 'grayagain' list, to be revisited in the
 ** atomic phase. In the atomic phase, if table has any white value,
-** put it in 'weak' list, to be cleared.
+** put it in 'weak' list, to be cleared; otherwise, also keep it in
+** 'grayagain' (generational mode needs to see it after the cycle).
 */
 // ֵıӵȷڷֳڼ䣬䱣ڡgrayagainб
 // atomic׶·ʡԭӽ׶Σ table κΰɫֵڡбУ
@@ -461,7 +549,14 @@ static void traverseweakvalue (global_State *g, Table *h) {
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
   // 鲿֣аɫֵֻΪ˼鲢ֵڱ
-  int hasclears = (h->sizearray > 0);
+  int hasclears = (sizeplain(h) > 0);
+  int i;
+  markshapekeys(g, h);
+  // ״֣Ƿаɫֵ
+  for (i = 0; i < shapesize(h) && !hasclears; i++) {  /* traverse shape */
+    if (iscleared(g, &h->slots[i]))  /* is there a white value? */
+      hasclears = 1;  /* table will have to be cleared */
+  }
   // Hash
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     // 
@@ -477,10 +572,10 @@ static void traverseweakvalue (global_State *g, Table *h) {
         hasclears = 1;  /* table will have to be cleared */
     }
   }
-  if (g->gcstate == GCSpropagate)
-    linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
-  else if (hasclears)
+  if (g->gcstate == GCSinsideatomic && hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
+  else
+    linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
 }
 
 
@@ -503,12 +598,21 @@ static int traverseephemeron (global_State *g, Table *h) {
   unsigned int i;
   /* traverse array part */
   // 鲿
-  for (i = 0; i < h->sizearray; i++) {
+  for (i = 0; i < sizeplain(h); i++) {
     if (valiswhite(&h->array[i])) {
       marked = 1;
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
   }
+  /* traverse shape (its keys are strings, so its entries are strong) */
+  // ״ַ֣ǿõ
+  markshapekeys(g, h);
+  for (i = 0; i < cast(unsigned int, shapesize(h)); i++) {
+    if (valiswhite(&h->slots[i])) {
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->slots[i]));
+    }
+  }
   /* traverse hash part */
   // Hash
   for (n = gnode(h, 0); n < limit; n++) {
@@ -538,6 +642,10 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
+  else {
+    gray2black(h);
+    genlink(g, h);  /* check whether collector still needs to see it */
+  }
   return marked;
 }
 
@@ -546,8 +654,12 @@ static void traversestrongtable (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   unsigned int i;
   // 鲿
-  for (i = 0; i < h->sizearray; i++)  /* traverse array part */
+  for (i = 0; i < sizeplain(h); i++)  /* traverse array part */
     markvalue(g, &h->array[i]);
+  // ״
+  markshapekeys(g, h);
+  for (i = 0; i < cast(unsigned int, shapesize(h)); i++)  /* traverse shape */
+    markvalue(g, &h->slots[i]);
   // Hash
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     checkdeadkey(n);
@@ -561,8 +673,74 @@ static void traversestrongtable (global_State *g, Table *h) {
       markvalue(g, gval(n));  /* mark value */
     }
   }
+  genlink(g, h);
 }
 
+/*
+** Large strong tables are traversed in chunks, so that a single step
+** does not take too long. The table being traversed is kept black,
+** out of any gray list, in 'g->travtable'; a barrier on it makes it
+** gray and links it into 'grayagain', so that the atomic phase
+** traverses it again, and its chunked traversal is abandoned. The same
+** happens if the table changes its layout (array size, hash part or
+** shape) between two chunks, as values may move to positions already
+** traversed. Positions go through the array part (unless it is packed:
+** numbers need no marking), the shape and then the hash part.
+*/
+// ǿֿһ̫áڱıֺɫκλɫУg->travtable
+// ʱҲҵgrayagainԭӽ׶λ±ֿͷˡ
+// ֮ĲֱˣСhashֻ״ֵܱŲѾλãҲһ
+// λξ鲿֣յĳ⣺ֲҪǣ״hash
+#define tablenentries(h)  \
+	(sizeplain(h) + cast(unsigned int, shapesize(h)) + sizenode(h))
+
+static lu_mem traversechunk (global_State *g) {
+  Table *h = g->travtable;
+  unsigned int i = g->travpos;
+  unsigned int asize, nshape, total, limit;
+  if (!isblack(h))  /* hit by a barrier? */
+    goto abandon;  /* it is in 'grayagain' */
+  asize = sizeplain(h);
+  if (asize != g->travsizearray || h->node != g->travnode ||
+      h->shape != g->travshape) {  /* layout changed? */
+    black2gray(h);
+    linkgclist(h, g->grayagain);  /* traverse it all in the atomic phase */
+    goto abandon;
+  }
+  nshape = cast(unsigned int, shapesize(h));
+  total = tablenentries(h);
+  limit = (total - i > GCTABLECHUNK) ? i + GCTABLECHUNK : total;
+  for (; i < limit && i < asize; i++)  /* array part */
+    markvalue(g, &h->array[i]);
+  for (; i < limit && i < asize + nshape; i++) {  /* shape */
+    int k = cast_int(i - asize);
+    markobject(g, h->shape->keys[k]);
+    markvalue(g, &h->slots[k]);
+  }
+  for (; i < limit; i++) {  /* hash part */
+    Node *n = gnode(h, i - asize - nshape);
+    checkdeadkey(n);
+    if (ttisnil(gval(n)))  /* entry is empty? */
+      removeentry(n);  /* remove it */
+    else {
+      lua_assert(!ttisnil(gkey(n)));
+      markvalue(g, gkey(n));  /* mark key */
+      markvalue(g, gval(n));  /* mark value */
+    }
+  }
+  if (limit == total) {  /* traversal done? */
+    genlink(g, h);
+    g->travtable = NULL;
+  }
+  i = g->travpos;  /* where this chunk started */
+  g->travpos = limit;
+  return sizeof(Node) * (limit - i);
+ abandon:
+  g->travtable = NULL;
+  return 0;
+}
+
+
 // 
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
@@ -586,11 +764,23 @@ static lu_mem traversetable (global_State *g, Table *h) {
         // ֱӹҽallweak
       linkgclist(h, g->allweak);  /* nothing to traverse now */
   }
+  else if (g->gcstate == GCSpropagate &&
+           tablenentries(h) > GCTABLECHUNK) {  /* large strong table? */
+    // ǿֿ
+    g->travtable = h;
+    g->travpos = 0;
+    g->travsizearray = sizeplain(h);
+    g->travnode = h->node;
+    g->travshape = h->shape;
+    return sizeof(Table) + traversechunk(g);
+  }
   else  /* not weak */
     // ǿ
     traversestrongtable(g, h);
-  return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                         sizeof(Node) * cast(size_t, allocsizenode(h));
+  return sizeof(Table) +
+         (ispacked(h) ? sizeof(Value) : sizeof(TValue)) * h->sizearray +
+         sizeof(TValue) * shapecap(shapesize(h)) +
+         sizeof(Node) * cast(size_t, allocsizenode(h));
 }
 
 
@@ -602,7 +792,10 @@ static lu_mem traversetable (global_State *g, Table *h) {
 // ԭ͡ ڹԭʱԱҪĴ Ĳ۳NULLʹ'markobjectN')
 static int traverseproto (global_State *g, Proto *f) {
   int i;
-  if (f->cache && iswhite(f->cache))
+  /* in generational mode, an old prototype is not traversed again to
+     clear its cache, so it cannot keep one */
+  // ִģʽϵԭͲٱûл棬Բ
+  if (f->cache && (iswhite(f->cache) || g->gckind == KGC_GEN))
     f->cache = NULL;  /* allow cache to be collected */
   // source
   markobjectN(g, f->source);
@@ -619,6 +812,7 @@ static int traverseproto (global_State *g, Proto *f) {
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                         sizeof(InlineCache) * f->sizeicache +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
@@ -639,17 +833,26 @@ static lu_mem traverseCclosure (global_State *g, CClosure *cl) {
 ** open upvalues point to values in a thread, so those values should
 ** be marked when the thread is traversed except in the atomic phase
 ** (because then the value cannot be changed by the thread and the
-** thread may not be traversed again)
+** thread may not be traversed again).
+** A closure that is not new may become old at the end of this cycle
+** (and any closure may in incremental mode, when switching to
+** generational mode), so its upvalues are flagged for
+** 'luaC_upvalbarrier_'.
 */
 // Luaհ
+// ¶ıհڱֽʱܻϣģʽлִģʽʱбհϣ
+// Ըupvaluesϱ־luaC_upvalbarrier_ʹ
 static lu_mem traverseLclosure (global_State *g, LClosure *cl) {
   int i;
+  int mayturnold = (g->gckind != KGC_GEN || getage(cl) != G_NEW);
   // ԭ
   markobjectN(g, cl->p);  /* mark its prototype */
   // upvalues
   for (i = 0; i < cl->nupvalues; i++) {  /* mark its upvalues */
     UpVal *uv = cl->upvals[i];
     if (uv != NULL) {
+      if (mayturnold)
+        uv->oldowner = 1;
       if (upisopen(uv) && g->gcstate != GCSinsideatomic)
         uv->u.open.touched = 1;  /* can be marked in 'remarkupvals' */
       else
@@ -683,7 +886,7 @@ static lu_mem traversethread (global_State *g, lua_State *th) {
       g->twups = th;
     }
   }
-  else if (g->gckind != KGC_EMERGENCY)
+  else if (!g->gcemergency)
     luaD_shrinkstack(th); /* do not change stack in emergency cycle */
   return (sizeof(lua_State) + sizeof(TValue) * th->stacksize +
           sizeof(CallInfo) * th->nci);
@@ -692,14 +895,20 @@ static lu_mem traversethread (global_State *g, lua_State *th) {
 
 /*
 ** traverse one gray object, turning it to black (except for threads,
-** which are always gray).
+** which are always gray). (In generational mode, objects revisited by
+** a minor collection may already be black.)
 */
 // һɫ壬ɺɫ̣߳ǻɫģ
 static void propagatemark (global_State *g) {
   lu_mem size;
+  GCObject *o;
+  if (g->travtable != NULL) {  /* a large table is being traversed? */
+    g->GCmemtrav += traversechunk(g);  /* traverse its next chunk */
+    return;
+  }
   // ӻɫȡһ
-  GCObject *o = g->gray;
-  lua_assert(isgray(o));
+  o = g->gray;
+  lua_assert(!iswhite(o));
   // ɺɫ
   gray2black(o);
   switch (o->tt) {
@@ -755,7 +964,7 @@ static void propagatemark (global_State *g) {
 
 // еĻɫ
 static void propagateall (global_State *g) {
-  while (g->gray) propagatemark(g);
+  while (hasgray(g)) propagatemark(g);
 }
 
 // key
@@ -782,6 +991,336 @@ static void convergeephemerons (global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+#if defined(LUAI_PARMARK)	/* { */
+
+/*
+** A full collection in incremental mode can run its propagate phase
+** in 'g->gcmarkthreads' threads. Each thread claims white objects with
+** an atomic operation on their 'marked' fields and keeps the gray
+** objects it claimed in a private stack; when it has plenty of them
+** and some other thread is idle, it shares a chunk of them. Objects
+** that need the serial marker are linked into a private gray list:
+** threads (their stacks may be shrunk, but their contents are still
+** marked here) and weak tables (they go to special lists). After the
+** parallel phase, these lists are joined into 'g->gray', and the usual
+** propagation finishes the job. The traversals here mirror the serial
+** ones without changing state other threads may use; for instance,
+** '__mode' is looked up without caching its absence in the metatable.
+** Markers allocate their stacks and chunks directly with the allocator
+** of the state, which therefore must be declared thread safe (see
+** 'lua_setallocsafe'); otherwise marking stays serial. That memory is
+** not counted as used by Lua. If an allocation fails, the object goes
+** to the serial marker.
+*/
+// ģʽµտg->gcmarkthreadsִ߳зֳ׶Ρÿ߳ԭӲ޸
+// ɫmarkedֶռǣĻɫԼջջܶ߳
+// ʱֳһǡҪбǵĶԼĻɫУ̣߳ǵջܱ
+// ջҲǣҪŵرУн׶νЩg->gray
+// ͨķֳʣµĹıʹеһֻǲ޸߳̿õ״̬
+// __modeʱԪлڡֱ߳״̬ķջ͹飬
+// Է뱻Ϊ̰߳ȫģlua_setallocsafeֻбǡ
+// Щڴ治Luaʹõڴ档ʧʱ󽻸б
+
+typedef struct Marker {
+  global_State *g;
+  GCObject **stack;  /* claimed objects still to be traversed */
+  int n;  /* number of objects in 'stack' */
+  int size;  /* size of 'stack' */
+  GCObject *gray;  /* objects left to the serial marker */
+} Marker;
+
+
+/* number of traversals between checks for idle markers */
+// ÿôһûпеı߳
+#define SHARECHECK	64
+
+
+/*
+** Try to claim object 'o', clearing its white bits (and setting its
+** black bit, if 'black'). Returns false if 'o' was not white (some
+** marker already claimed it).
+*/
+// ռoɫλblackΪʱͬʱúɫλoѾǰɫ߳ˣʱؼ
+static int claim (GCObject *o, int black) {
+  lu_byte m = l_loadbyte(&o->marked);
+  for (;;) {
+    lu_byte nm;
+    if (!(m & WHITEBITS))
+      return 0;  /* already marked */
+    nm = cast_byte(m & maskcolors);
+    if (black) nm |= bitmask(BLACKBIT);
+    if (l_casbyte(&o->marked, m, nm))
+      return 1;
+    m = l_loadbyte(&o->marked);
+  }
+}
+
+
+/* leave gray object 'o' to the serial marker */
+// ѻɫoб
+static void leaveserial (Marker *m, GCObject *o) {
+  *getgclist(o) = m->gray;
+  m->gray = o;
+}
+
+
+static void pushgray (Marker *m, GCObject *o) {
+  if (m->n == m->size) {  /* stack is full? */
+    global_State *g = m->g;
+    int newsize = (m->size == 0) ? WORKCHUNK * 4 : m->size * 2;
+    GCObject **ns = (GCObject **)(*g->frealloc)(g->ud, m->stack,
+               m->size * sizeof(GCObject *), newsize * sizeof(GCObject *));
+    if (ns == NULL) {  /* no memory? */
+      if (o->tt != LUA_TTHREAD)  /* (threads already are there) */
+        leaveserial(m, o);
+      return;
+    }
+    m->stack = ns;
+    m->size = newsize;
+  }
+  m->stack[m->n++] = o;
+}
+
+
+/*
+** Whether table 'h' may be weak, and so left to the serial marker. A
+** marker does not look into the metatable, which another marker may be
+** traversing (and clearing its dead keys): it only reads the absence
+** of '__mode' cached in the 'flags' of the metatable, which markers do
+** not write. A table whose metatable has not cached it yet goes to the
+** serial marker, whose 'traversetable' caches it for the next cycles.
+*/
+// hǷǵĻбǣ̲߳鿴ԪݣΪı߳
+// ڱеֻȡԪflagsлġû__modeǣ
+// ̲߳޸flagsԪûлǵıбǣtraversetableỺԺʹ
+#define mayweak(h) \
+  ((h)->metatable != NULL && !((h)->metatable->flags & bitmask(TM_MODE)))
+
+
+/* parallel version of 'reallymarkobject' */
+// а汾reallymarkobject
+static void pmarkobject (Marker *m, GCObject *o) {
+ reentry:
+  switch (o->tt) {
+    case LUA_TSHRSTR: case LUA_TLNGSTR: {
+      claim(o, 1);
+      break;
+    }
+    case LUA_TUSERDATA: {
+      TValue uvalue;
+      if (!claim(o, 1)) break;
+      if (gco2u(o)->metatable)
+        pmarkobject(m, obj2gco(gco2u(o)->metatable));
+      getuservalue(m->g->mainthread, gco2u(o), &uvalue);
+      if (iscollectable(&uvalue)) {
+        o = gcvalue(&uvalue);
+        goto reentry;
+      }
+      break;
+    }
+    case LUA_TTHREAD: {
+      if (!claim(o, 0)) break;
+      leaveserial(m, o);  /* serial marker must see it */
+      pushgray(m, o);  /* but its stack can be marked now */
+      break;
+    }
+    case LUA_TTABLE: {
+      if (!claim(o, 0)) break;
+      if (mayweak(gco2t(o)))
+        leaveserial(m, o);
+      else
+        pushgray(m, o);
+      break;
+    }
+    default: {
+      if (claim(o, 0))
+        pushgray(m, o);
+      break;
+    }
+  }
+}
+
+
+#define pmarkvalue(m,v)  \
+	{ if (iscollectable(v)) pmarkobject(m, gcvalue(v)); }
+
+#define pmarkobjectN(m,t)	{ if (t) pmarkobject(m, obj2gco(t)); }
+
+
+/*
+** Traverse gray object 'o', turning it black (except threads). Only
+** the marker that claimed 'o' writes to it.
+*/
+// ɫoڣ̳߳⣩ֻoı̻߳޸
+static void ptraverse (Marker *m, GCObject *o) {
+  int i;
+  if (o->tt != LUA_TTHREAD)
+    l_storebyte(&o->marked, cast_byte(o->marked | bitmask(BLACKBIT)));
+  switch (o->tt) {
+    case LUA_TTABLE: {
+      Table *h = gco2t(o);
+      Node *n, *limit = gnodelast(h);
+      pmarkobjectN(m, h->metatable);
+      for (i = 0; i < cast_int(sizeplain(h)); i++)
+        pmarkvalue(m, &h->array[i]);
+      for (i = 0; i < shapesize(h); i++) {
+        pmarkobject(m, obj2gco(h->shape->keys[i]));
+        pmarkvalue(m, &h->slots[i]);
+      }
+      for (n = gnode(h, 0); n < limit; n++) {
+        checkdeadkey(n);
+        if (ttisnil(gval(n)))
+          removeentry(n);
+        else {
+          pmarkvalue(m, gkey(n));
+          pmarkvalue(m, gval(n));
+        }
+      }
+      break;
+    }
+    case LUA_TLCL: {
+      LClosure *cl = gco2lcl(o);
+      pmarkobjectN(m, cl->p);
+      for (i = 0; i < cl->nupvalues; i++) {
+        UpVal *uv = cl->upvals[i];
+        if (uv != NULL) {
+          l_storebyte(&uv->oldowner, 1);  /* as in 'traverseLclosure' */
+          if (upisopen(uv))
+            l_storeint(&uv->u.open.touched, 1);
+          else
+            pmarkvalue(m, uv->v);
+        }
+      }
+      break;
+    }
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      for (i = 0; i < cl->nupvalues; i++)
+        pmarkvalue(m, &cl->upvalue[i]);
+      break;
+    }
+    case LUA_TPROTO: {
+      Proto *f = gco2p(o);
+      if (f->cache && (l_loadbyte(&f->cache->marked) & WHITEBITS))
+        f->cache = NULL;  /* allow cache to be collected */
+      pmarkobjectN(m, f->source);
+      for (i = 0; i < f->sizek; i++)
+        pmarkvalue(m, &f->k[i]);
+      for (i = 0; i < f->sizeupvalues; i++)
+        pmarkobjectN(m, f->upvalues[i].name);
+      for (i = 0; i < f->sizep; i++)
+        pmarkobjectN(m, f->p[i]);
+      for (i = 0; i < f->sizelocvars; i++)
+        pmarkobjectN(m, f->locvars[i].varname);
+      break;
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      StkId s;
+      if (th->stack != NULL) {
+        for (s = th->stack; s < th->top; s++)
+          pmarkvalue(m, s);
+      }
+      break;
+    }
+    default: lua_assert(0);
+  }
+}
+
+
+/* give a chunk of the stack of 'm' to idle markers */
+// ջеһ齻еı߳
+static void sharework (Marker *m, WorkGroup *wg) {
+  global_State *g = m->g;
+  WorkChunk *c = (WorkChunk *)(*g->frealloc)(g->ud, NULL, 0,
+                                              sizeof(WorkChunk));
+  int i;
+  if (c == NULL) return;  /* no memory; keep the work */
+  m->n -= WORKCHUNK;
+  for (i = 0; i < WORKCHUNK; i++)
+    c->item[i] = m->stack[m->n + i];
+  c->n = WORKCHUNK;
+  luaW_share(wg, c);
+}
+
+
+static void marktask (WorkGroup *wg, void *ud, int id) {
+  Marker *m = &cast(Marker *, ud)[id];
+  global_State *g = m->g;
+  int count = 0;
+  for (;;) {
+    WorkChunk *c;
+    int i;
+    while (m->n > 0) {
+      ptraverse(m, m->stack[--m->n]);
+      if (++count % SHARECHECK == 0 && m->n >= 2 * WORKCHUNK &&
+          luaW_hungry(wg))
+        sharework(m, wg);
+    }
+    c = luaW_take(wg);
+    if (c == NULL) break;  /* no more work anywhere */
+    for (i = 0; i < c->n; i++)
+      pushgray(m, cast(GCObject *, c->item[i]));
+    (*g->frealloc)(g->ud, c, sizeof(WorkChunk), 0);
+  }
+}
+
+
+/*
+** Propagate marks from the gray objects in 'g->gray' (the roots, at
+** the start of a cycle) using several threads. Threads and weak tables
+** are left in 'g->gray' for the serial marker.
+*/
+// ö̴߳g->grayеĻɫѭʼʱǸ󣩷ֳǣ̺߳g->grayиб
+static void parallelpropagate (lua_State *L, global_State *g) {
+  Marker mk[LUAI_MAXWORKERS];
+  GCObject *o, *next;
+  int i;
+  int n = (g->gcmarkthreads < LUAI_MAXWORKERS) ? g->gcmarkthreads
+                                                : LUAI_MAXWORKERS;
+  lua_assert(g->gcstate == GCSpropagate && g->travtable == NULL);
+  for (i = 0; i < n; i++) {
+    mk[i].g = g;
+    mk[i].stack = NULL;
+    mk[i].n = mk[i].size = 0;
+    mk[i].gray = NULL;
+  }
+  for (o = g->gray; o != NULL; o = next) {  /* distribute the roots */
+    next = *getgclist(o);
+    if (o->tt == LUA_TTHREAD) {
+      leaveserial(&mk[0], o);
+      pushgray(&mk[0], o);
+    }
+    else if (o->tt == LUA_TTABLE &&  /* (no marker running yet) */
+             gfasttm(g, gco2t(o)->metatable, TM_MODE) != NULL)
+      leaveserial(&mk[0], o);
+    else
+      pushgray(&mk[0], o);
+  }
+  g->gray = NULL;
+  luaW_runparallel(L, n, marktask, mk);
+  for (i = 0; i < n; i++) {  /* give leftovers to the serial marker */
+    for (o = mk[i].gray; o != NULL; o = next) {
+      next = *getgclist(o);
+      *getgclist(o) = g->gray;
+      g->gray = o;
+    }
+    lua_assert(mk[i].n == 0);
+    (*g->frealloc)(g->ud, mk[i].stack, mk[i].size * sizeof(GCObject *), 0);
+  }
+}
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Sweep Functions
@@ -798,6 +1337,8 @@ static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
     Node *n, *limit = gnodelast(h);
+    // ״еļַᱻֻҪ
+    markshapekeys(g, h);  /* shape keys are never cleared */
     // 
     for (n = gnode(h, 0); n < limit; n++) {
         // ֵûб
@@ -824,11 +1365,17 @@ static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
     Node *n, *limit = gnodelast(h);
     unsigned int i;
     // 鲿
-    for (i = 0; i < h->sizearray; i++) {
+    for (i = 0; i < sizeplain(h); i++) {
       TValue *o = &h->array[i];
       if (iscleared(g, o))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
+    // ״
+    for (i = 0; i < cast(unsigned int, shapesize(h)); i++) {
+      TValue *o = &h->slots[i];
+      if (iscleared(g, o))  /* value was collected? */
+        setnilvalue(o);  /* remove value (key stays in the shape) */
+    }
     // ϣ
     for (n = gnode(h, 0); n < limit; n++) {
       if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
@@ -880,7 +1427,12 @@ static void freeobj (lua_State *L, GCObject *o) {
       luaM_freemem(L, o, sizelstring(gco2ts(o)->shrlen));
       break;
     case LUA_TLNGSTR: {
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->u.lnglen));
+      TString *ts = gco2ts(o);
+      // ⲿַֽͷ
+      if (isextstr(ts) && extstr(ts)->frel != NULL)  /* host's bytes? */
+        (*extstr(ts)->frel)(extstr(ts)->ud, getlngstr(ts),
+                            ts->u.lnglen + 1, 0);  /* release them */
+      luaM_freemem(L, o, sizelngstr(ts));
       break;
     }
     default: lua_assert(0);
@@ -918,7 +1470,7 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
     }
     else {  /* change mark to 'white' */
         // Ϊǰɫ
-      curr->marked = cast_byte((marked & maskcolors) | white);
+      curr->marked = cast_byte((marked & maskgcbits) | white);
       p = &curr->next;  /* go to next element */
     }
   }
@@ -953,10 +1505,11 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 */
 // ԣַ
 static void checkSizes (lua_State *L, global_State *g) {
-  if (g->gckind != KGC_EMERGENCY) {
+  if (!g->gcemergency) {
     l_mem olddebt = g->GCdebt;
-    // õ1/4
-    if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
+    // õ1/4һθıС֮
+    if (g->strt.old == NULL &&  /* not resizing and... */
+        g->strt.nuse < g->strt.size / 4)  /* string table too big? */
       luaS_resize(L, g->strt.size / 2);  /* shrink it a little */
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
   }
@@ -976,6 +1529,8 @@ static GCObject *udata2finalize (global_State *g) {
   // ɨ׶ΣΪɫ
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
+  else if (getage(o) == G_OLD1)
+    g->firstold1 = o;  /* it is the first OLD1 object in the list */
   return o;
 }
 
@@ -1072,7 +1627,10 @@ static GCObject **findlast (GCObject **p) {
 
 /*
 ** move all unreachable objects (or 'all' objects) that need
-** finalization from list 'finobj' to list 'tobefnz' (to be finalized)
+** finalization from list 'finobj' to list 'tobefnz' (to be finalized).
+** (Note that objects after 'finobjold1' cannot be white, so they
+** don't need to be traversed. In incremental mode, 'finobjold1' is NULL,
+** so the whole list is traversed.)
 */
 // ûзʵҪս󣨻еĶ󣩴бfinobjƶtobefnz
 static void separatetobefnz (global_State *g, int all) {
@@ -1080,12 +1638,14 @@ static void separatetobefnz (global_State *g, int all) {
   GCObject **p = &g->finobj;
   GCObject **lastnext = findlast(&g->tobefnz);
   // ҪսĶ
-  while ((curr = *p) != NULL) {  /* traverse all finalizable objects */
+  while ((curr = *p) != g->finobjold1) {  /* traverse all finalizable objects */
     lua_assert(tofinalize(curr));
     // ռ
     if (!(iswhite(curr) || all))  /* not being collected? */
       p = &curr->next;  /* don't bother with it */
     else {
+      if (curr == g->finobjsur)  /* removing 'finobjsur'? */
+        g->finobjsur = curr->next;  /* correct it */
       *p = curr->next;  /* remove 'curr' from 'finobj' list */
     // ҽtobefnzб
       curr->next = *lastnext;  /* link at the end of 'tobefnz' list */
@@ -1096,6 +1656,28 @@ static void separatetobefnz (global_State *g, int all) {
 }
 
 
+/*
+** If pointer 'p' points to 'o', move it to the next element.
+*/
+static void checkpointer (GCObject **p, GCObject *o) {
+  if (o == *p)
+    *p = o->next;
+}
+
+
+/*
+** Correct pointers to objects inside 'allgc' list when
+** object 'o' is being removed from the list.
+*/
+// oҪallgcƳʱִģʽָallgcڲָ
+static void correctpointers (global_State *g, GCObject *o) {
+  checkpointer(&g->survival, o);
+  checkpointer(&g->old1, o);
+  checkpointer(&g->reallyold, o);
+  checkpointer(&g->firstold1, o);
+}
+
+
 /*
 ** if object 'o' has a finalizer, remove it from 'allgc' list (must
 ** search the list to find it) and link it in 'finobj' list.
@@ -1116,6 +1698,8 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
       if (g->sweepgc == &o->next)  /* should not remove 'sweepgc' object */
         g->sweepgc = sweeptolive(L, g->sweepgc);  /* change 'sweepgc' */
     }
+    else
+      correctpointers(g, o);
     /* search for pointer pointing to 'o' */
     // ָoָ
     for (p = &g->allgc; *p != o; p = &(*p)->next) { /* empty */ }
@@ -1132,6 +1716,447 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
 
 
 
+/*
+** {======================================================
+** Generational Collector
+** =======================================================
+*/
+
+// ִռΪС(minor collection)ֻ
+// ձϵĶ(G_OLD1)ͱ϶ֻɨallgcfinobjĲ֣
+// ڴϴδպ̫ʱһĴ(major collection)
+
+static void setpause (global_State *g);
+static void entersweep (lua_State *L);
+static l_mem atomic (lua_State *L);
+
+
+/*
+** Sweep a list of objects to enter generational mode. Deletes dead
+** objects and turns the non dead to old. All non-dead threads---which
+** are now old---must be in a gray list. Everything else is not in a
+** gray list and is black.
+*/
+// ִģʽʱɨһɾ󣬻ŵĶ󶼱ϡ
+// ŵ̱߳ڻɫУǺɫ
+static void sweep2old (lua_State *L, GCObject **p) {
+  GCObject *curr;
+  global_State *g = G(L);
+  while ((curr = *p) != NULL) {
+    if (iswhite(curr)) {  /* is 'curr' dead? */
+      lua_assert(isdead(g, curr));
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else {  /* all surviving objects become old */
+      setage(curr, G_OLD);
+      if (curr->tt == LUA_TTHREAD) {  /* threads must be watched */
+        lua_State *th = gco2th(curr);
+        linkgclist(th, g->grayagain);  /* insert into 'grayagain' list */
+      }
+      else  /* everything else is black */
+        gray2black(curr);
+      p = &curr->next;  /* go to next element */
+    }
+  }
+}
+
+
+/*
+** Sweep for generational mode. Delete dead objects. (Because the
+** collection is not incremental, there are no "new white" objects
+** during the sweep. So, any white object must be dead.) For
+** non-dead objects, advance their ages and clear the color of
+** new objects. (Old objects keep their colors.)
+** The ages of G_TOUCHED1 and G_TOUCHED2 objects cannot be advanced
+** here, because these old-generation objects are usually not swept
+** here. They will all be advanced in 'correctgraylist'. That function
+** will also remove objects turned white here from any gray list.
+*/
+// ִģʽɨͷ󣨰ɫһģŵĶһ
+// ¶±ɰɫ϶󱣳ԭɫ
+static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
+                            GCObject *limit, GCObject **pfirstold1) {
+  static const lu_byte nextage[] = {
+    G_SURVIVAL,  /* from G_NEW */
+    G_OLD1,      /* from G_SURVIVAL */
+    G_OLD1,      /* from G_OLD0 */
+    G_OLD,       /* from G_OLD1 */
+    G_OLD,       /* from G_OLD (do not change) */
+    G_TOUCHED1,  /* from G_TOUCHED1 (do not change) */
+    G_TOUCHED2   /* from G_TOUCHED2 (do not change) */
+  };
+  int white = luaC_white(g);
+  GCObject *curr;
+  while ((curr = *p) != limit) {
+    if (iswhite(curr)) {  /* is 'curr' dead? */
+      lua_assert(!isold(curr) && isdead(g, curr));
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else {  /* correct mark and age */
+      if (getage(curr) == G_NEW) {  /* new objects go back to white */
+        int marked = curr->marked & maskgcbits;  /* erase GC bits */
+        curr->marked = cast_byte(marked | G_SURVIVAL | white);
+      }
+      else {  /* all other objects will be old, and so keep their color */
+        setage(curr, nextage[getage(curr)]);
+        if (getage(curr) == G_OLD1 && *pfirstold1 == NULL)
+          *pfirstold1 = curr;  /* first OLD1 object in the list */
+      }
+      p = &curr->next;  /* go to next element */
+    }
+  }
+  return p;
+}
+
+
+/*
+** Traverse a list making all its elements white and clearing their
+** age. In incremental mode, all objects are 'new' all the time,
+** except for fixed strings (which are always old).
+*/
+// ж󶼱ɰɫ䣨ģʽж""ģ
+static void whitelist (global_State *g, GCObject *p) {
+  int white = luaC_white(g);
+  for (; p != NULL; p = p->next)
+    p->marked = cast_byte((p->marked & maskgcbits) | white);
+}
+
+
+/*
+** Correct a list of gray objects. Return pointer to where rest of the
+** list should be linked.
+** Because this correction is done after sweeping, young objects might
+** be turned white and still be in the list. They are only removed.
+** 'TOUCHED1' objects are advanced to 'TOUCHED2' and remain on the list;
+** non-white threads also remain on the list; 'TOUCHED2' objects become
+** regular old; they and anything else are removed from the list.
+*/
+// һɫʣಿӦӵλ
+static GCObject **correctgraylist (GCObject **p) {
+  GCObject *curr;
+  while ((curr = *p) != NULL) {
+    GCObject **next = getgclist(curr);
+    if (iswhite(curr))
+      *p = *next;  /* remove all white objects */
+    else if (getage(curr) == G_TOUCHED1) {  /* touched in this cycle? */
+      lua_assert(isgray(curr));
+      gray2black(curr);  /* make it black, for next barrier */
+      changeage(curr, G_TOUCHED1, G_TOUCHED2);
+      p = next;  /* keep it in the list and go to next element */
+    }
+    else if (curr->tt == LUA_TTHREAD) {
+      lua_assert(isgray(curr));
+      p = next;  /* keep non-white threads on the list */
+    }
+    else {  /* everything else is removed */
+      lua_assert(isold(curr));  /* young objects should be white here */
+      if (getage(curr) == G_TOUCHED2)  /* advance from TOUCHED2... */
+        changeage(curr, G_TOUCHED2, G_OLD);  /* ... to OLD */
+      gray2black(curr);  /* make object black (to be removed) */
+      *p = *next;
+    }
+  }
+  return p;
+}
+
+
+/*
+** Correct all gray lists, coalescing them into 'grayagain'.
+*/
+// еĻɫǺϲgrayagain
+static void correctgraylists (global_State *g) {
+  GCObject **list = correctgraylist(&g->grayagain);
+  *list = g->weak; g->weak = NULL;
+  list = correctgraylist(list);
+  *list = g->allweak; g->allweak = NULL;
+  list = correctgraylist(list);
+  *list = g->ephemeron; g->ephemeron = NULL;
+  correctgraylist(list);
+}
+
+
+/*
+** Mark black 'OLD1' objects when starting a new young collection.
+** Gray objects are already in some gray list, and so will be visited
+** in the atomic step.
+*/
+// ʼһСʱǺɫOLD1ǿָܻ
+static void markold (global_State *g, GCObject *from, GCObject *to) {
+  GCObject *p;
+  for (p = from; p != to; p = p->next) {
+    if (getage(p) == G_OLD1) {
+      lua_assert(!iswhite(p));
+      changeage(p, G_OLD1, G_OLD);  /* now they are old */
+      if (isblack(p))
+        reallymarkobject(g, p);
+    }
+  }
+}
+
+
+/*
+** Finish a young-generation collection.
+*/
+// һηִ
+static void finishgencycle (lua_State *L, global_State *g) {
+  correctgraylists(g);
+  checkSizes(L, g);
+  g->gcstate = GCSpropagate;  /* skip restart */
+  if (!g->gcemergency) {
+    while (g->tobefnz)  /* call all pending finalizers */
+      GCTM(L, 1);
+  }
+}
+
+
+/*
+** Does a young collection. First, mark 'OLD1' objects. Then does the
+** atomic step. Then, sweep all lists and advance pointers. Finally,
+** finish the collection.
+*/
+// СգȱOLD1Ȼִԭӽ׶ΣɨĲֲƽֶָ
+static void youngcollection (lua_State *L, global_State *g) {
+  GCObject **psurvival;  /* to point to first non-dead survival object */
+  GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
+  lua_assert(g->gcstate == GCSpropagate);
+  if (g->firstold1) {  /* are there regular OLD1 objects? */
+    markold(g, g->firstold1, g->reallyold);  /* mark them */
+    g->firstold1 = NULL;  /* no more OLD1 objects (for now) */
+  }
+  markold(g, g->finobj, g->finobjrold);
+  markold(g, g->tobefnz, NULL);
+  atomic(L);
+
+  /* sweep nursery and get a pointer to its last live element */
+  g->gcstate = GCSswpallgc;
+  deferfree(g, 1);  /* helper thread (if any) frees dead objects */
+  psurvival = sweepgen(L, g, &g->allgc, g->survival, &g->firstold1);
+  /* sweep 'survival' */
+  sweepgen(L, g, psurvival, g->old1, &g->firstold1);
+  g->reallyold = g->old1;
+  g->old1 = *psurvival;  /* 'survival' survivals are old now */
+  g->survival = g->allgc;  /* all news are survivals */
+
+  /* repeat for 'finobj' lists */
+  dummy = NULL;  /* no 'firstold1' optimization for 'finobj' lists */
+  psurvival = sweepgen(L, g, &g->finobj, g->finobjsur, &dummy);
+  /* sweep 'survival' */
+  sweepgen(L, g, psurvival, g->finobjold1, &dummy);
+  g->finobjrold = g->finobjold1;
+  g->finobjold1 = *psurvival;  /* 'survival' survivals are old now */
+  g->finobjsur = g->finobj;  /* all news are survivals */
+
+  sweepgen(L, g, &g->tobefnz, NULL, &dummy);
+  deferfree(g, 0);
+  luaW_flush(g);
+  finishgencycle(L, g);
+}
+
+
+/*
+** Clears all gray lists, sweeps objects, and prepare sublists to enter
+** generational mode. The sweeps remove dead objects and turn all
+** surviving objects to old. Threads go back to 'grayagain'; everything
+** else is turned black (not in any gray list).
+*/
+// лɫɨжΪִģʽ׼øֶ
+static void atomic2gen (lua_State *L, global_State *g) {
+  g->gray = g->grayagain = NULL;
+  g->weak = g->allweak = g->ephemeron = NULL;
+  /* sweep all elements making them old */
+  g->gcstate = GCSswpallgc;
+  sweep2old(L, &g->allgc);
+  /* everything alive now is old */
+  g->reallyold = g->old1 = g->survival = g->allgc;
+  g->firstold1 = NULL;  /* there are no OLD1 objects anywhere */
+
+  /* repeat for 'finobj' lists */
+  sweep2old(L, &g->finobj);
+  g->finobjrold = g->finobjold1 = g->finobjsur = g->finobj;
+
+  sweep2old(L, &g->tobefnz);
+
+  /* the main thread is not in any list; it is old and always watched */
+  // ̲߳κζУ
+  setage(g->mainthread, G_OLD);
+  linkgclist(g->mainthread, g->grayagain);
+
+  g->gckind = KGC_GEN;
+  g->lastatomic = 0;
+  g->GCestimate = gettotalbytes(g);  /* base for memory control */
+  finishgencycle(L, g);
+}
+
+
+/*
+** Set debt for the next minor collection, which will happen when
+** memory grows 'genminormul'%.
+*/
+// һСյծڴgenminormul%ʱ
+static void setminordebt (global_State *g) {
+  luaE_setdebt(g, -(cast(l_mem, (gettotalbytes(g) / 100)) * g->genminormul));
+}
+
+
+/*
+** Enter generational mode. Must go until the end of an atomic cycle
+** to ensure that all objects are correctly marked and weak tables
+** are cleared. Then, turn all objects into old and finishes the
+** collection.
+*/
+// ִģʽرһ飬ȻлŵĶ󶼱
+static l_mem entergen (lua_State *L, global_State *g) {
+  l_mem numobjs;
+  luaC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  numobjs = atomic(L);  /* propagates all and then do the atomic stuff */
+  atomic2gen(L, g);
+  setminordebt(g);  /* set debt assuming next cycle will be minor */
+  return numobjs;
+}
+
+
+/*
+** Enter incremental mode. Turn all objects white, make all
+** intermediate lists point to NULL (to avoid invalid pointers),
+** and go to the pause state.
+*/
+// ģʽжɰɫշִõĸָ룬ͣ״̬
+static void enterinc (global_State *g) {
+  lua_State *mt = g->mainthread;
+  whitelist(g, g->allgc);
+  g->reallyold = g->old1 = g->survival = NULL;
+  whitelist(g, g->finobj);
+  whitelist(g, g->tobefnz);
+  g->finobjrold = g->finobjold1 = g->finobjsur = NULL;
+  mt->marked = cast_byte((mt->marked & maskgcbits) | luaC_white(g));
+  g->gcstate = GCSpause;
+  g->gckind = KGC_INC;
+  g->lastatomic = 0;
+}
+
+
+/*
+** Change collector mode to 'newmode'.
+*/
+// лռģʽ
+void luaC_changemode (lua_State *L, int newmode) {
+  global_State *g = G(L);
+  if (newmode != g->gckind) {
+    if (newmode == KGC_GEN)  /* entering generational mode? */
+      entergen(L, g);
+    else
+      enterinc(g);  /* entering incremental mode */
+  }
+  g->lastatomic = 0;
+}
+
+
+/*
+** Does a full collection in generational mode.
+*/
+// ִģʽµգգ
+static l_mem fullgen (lua_State *L, global_State *g) {
+  enterinc(g);
+  return entergen(L, g);
+}
+
+
+/*
+** Does a major collection after last collection was a "bad collection".
+**
+** When the program is building a big structure, it allocates lots of
+** memory but generates very little garbage. In those scenarios,
+** the generational mode just wastes time doing small collections, and
+** major collections are frequently what we call a "bad collection", a
+** collection that frees too few objects. To avoid the cost of switching
+** between generational mode and the incremental mode needed for full
+** (major) collections, the collector tries to stay in incremental mode
+** after a bad collection, and to switch back to generational mode only
+** after a "good" collection (one that traverses less than 9/8 objects
+** of the previous one).
+** The collector must choose whether to stay in incremental mode or to
+** switch back to generational mode before sweeping. At this point, it
+** does not know the real memory in use, so it cannot use memory to
+** decide whether to return to generational mode. Instead, it uses the
+** traversal work done by 'atomic' as an approximation. (A collection
+** which traverses less than 9/8 of what the previous one traversed is
+** considered "good".)
+*/
+// һδ"õĻ"յڴ̫٣ڹݽṹʱ
+// ģʽգֱĳαĹСһε9/8Żصִģʽ
+static void stepgenfull (lua_State *L, global_State *g) {
+  l_mem newatomic;  /* work done by 'atomic' */
+  lu_mem lastatomic = g->lastatomic;  /* work from last collection */
+  if (g->gckind == KGC_GEN)  /* still in generational mode? */
+    enterinc(g);  /* enter incremental mode */
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  newatomic = atomic(L);  /* mark everybody */
+  if (cast(lu_mem, newatomic) < lastatomic + (lastatomic >> 3)) {  /* good collection? */
+    atomic2gen(L, g);  /* return to generational mode */
+    setminordebt(g);
+  }
+  else {  /* another bad collection; stay in incremental mode */
+    g->GCestimate = gettotalbytes(g);  /* first estimate */
+    entersweep(L);
+    luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
+    setpause(g);
+    g->lastatomic = newatomic;
+  }
+}
+
+
+/*
+** Does a generational "step".
+** Usually, this means doing a minor collection and setting the debt to
+** make another collection when memory grows 'genminormul'% larger.
+**
+** However, there are exceptions. If memory grows 'genmajormul'%
+** larger than it was at the end of the last major collection (kept
+** in 'g->GCestimate'), the function does a major collection. At the
+** end, it checks whether the major collection was able to free a
+** decent amount of memory (at least half the growth in memory since
+** previous major collection). If so, the collector keeps its state,
+** and the next collection will probably be minor again. Otherwise,
+** we have what we call a "bad collection". In that case, set the field
+** 'g->lastatomic' to signal that fact, so that the next collection will
+** go to 'stepgenfull'.
+**
+** 'GCdebt <= 0' means an explicit call to GC step with "size" zero;
+** in that case, do a minor collection.
+*/
+// ִģʽһͨһСգڴϴδպgenmajormul%ʱһδգ
+// ûܻյһͼΪ"õĻ"´stepgenfull
+static void genstep (lua_State *L, global_State *g) {
+  if (g->lastatomic != 0)  /* last collection was a bad one? */
+    stepgenfull(L, g);  /* do a full step */
+  else {
+    lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
+    lu_mem majorinc = (majorbase / 100) * g->genmajormul;
+    if (g->GCdebt > 0 && gettotalbytes(g) > majorbase + majorinc) {
+      l_mem numobjs = fullgen(L, g);  /* do a major collection */
+      /* if it did not collect at least half of memory growth since
+         last major collection, it was a bad collection */
+      if (gettotalbytes(g) >= majorbase + (majorinc / 2)) {
+        g->lastatomic = numobjs;  /* signal that last collection was bad */
+        setpause(g);  /* do a long wait for next (major) collection */
+      }
+    }
+    else {  /* regular case; do a minor collection */
+      youngcollection(L, g);
+      setminordebt(g);
+      g->GCestimate = majorbase;  /* preserve base value */
+    }
+  }
+  lua_assert(isdecGCmodegen(g));
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** GC control
@@ -1183,6 +2208,8 @@ static void entersweep (lua_State *L) {
 // ͷеԪ
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
+  luaW_stopfree(L);  /* free everything in this thread from now on */
+  luaC_changemode(L, KGC_INC);
   // finalizersָжб
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
@@ -1191,7 +2218,6 @@ void luaC_freeallobjects (lua_State *L) {
   lua_assert(g->tobefnz == NULL);
   // ðɫпȥ˵Ķ
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
-  g->gckind = KGC_NORMAL;
   // finobjallgcfixedgcĶ
   sweepwholelist(L, &g->finobj);
   sweepwholelist(L, &g->allgc);
@@ -1234,7 +2260,9 @@ static l_mem atomic (lua_State *L) {
   l_mem work;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
+  lua_assert(g->travtable == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
   g->GCmemtrav = 0;  /* start counting work */
@@ -1294,8 +2322,11 @@ static lu_mem sweepstep (lua_State *L, global_State *g,
                          int nextstate, GCObject **nextlist) {
   if (g->sweepgc) {
     l_mem olddebt = g->GCdebt;
+    deferfree(g, 1);  /* helper thread (if any) frees dead objects */
     // ÿGCSWEEPMAX
     g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
+    deferfree(g, 0);
+    luaW_flush(g);
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
     if (g->sweepgc)  /* is there still something to sweep? */
       return (GCSWEEPMAX * GCSWEEPCOST);
@@ -1314,7 +2345,9 @@ static lu_mem singlestep (lua_State *L) {
       // ӸʼǣɫΪɫ뵽ɫ
       // ͣ׶
     case GCSpause: {
-      g->GCmemtrav = g->strt.size * sizeof(GCObject*);
+      /* (while the string table is resized, its old array counts too) */
+      // ַڸıСʱҲҪ
+      g->GCmemtrav = (g->strt.size + g->strt.oldsize) * sizeof(GCObject*);
       // ռ
       restartcollection(g);
       g->gcstate = GCSpropagate;
@@ -1323,10 +2356,10 @@ static lu_mem singlestep (lua_State *L) {
     // ֳ׶
     case GCSpropagate: {
       g->GCmemtrav = 0;
-      lua_assert(g->gray);
+      lua_assert(hasgray(g));
       propagatemark(g);
       // ֻûлɫObjectsŸı״̬
-       if (g->gray == NULL)  /* no more gray objects? */
+       if (!hasgray(g))  /* no more gray objects? */
         g->gcstate = GCSatomic;  /* finish propagate phase */
       return g->GCmemtrav;  /* memory traversed in this step */
     }
@@ -1370,7 +2403,7 @@ static lu_mem singlestep (lua_State *L) {
     }
     // ɫΪ
     case GCScallfin: {  /* call remaining finalizers */
-      if (g->tobefnz && g->gckind != KGC_EMERGENCY) {
+      if (g->tobefnz && !g->gcemergency) {
         int n = runafewfinalizers(L);
         return (n * GCFINALIZECOST);
       }
@@ -1415,19 +2448,13 @@ static l_mem getdebt (global_State *g) {
 }
 
 /*
-** performs a basic GC step when collector is running
+** performs a basic incremental step
 */
-// ռʱִл GC 
- // luaC_stepУdebtGCdebtǱԱʵGCdebtʼΪgcstepmul
-void luaC_step (lua_State *L) {
-  global_State *g = G(L);
- 
+// ִһλ GC 
+ // incstepУdebtGCdebtǱԱʵGCdebtʼΪgcstepmul
+static void incstep (lua_State *L, global_State *g) {
   // 㱾εgcҪĶֽ
   l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
-  if (!g->gcrunning) {  /* not running? */
-    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
-    return;
-  }
   // GCdebtʱluaC_stepͨGCdebtѭsinglestep
   // ظֱͣ㹻(debt)
   // GCdebtŴdebtᵼ¸ѭĴӣӶӳһĹstepmulΪʡ
@@ -1451,22 +2478,101 @@ void luaC_step (lua_State *L) {
 
 
 /*
-** Performs a full GC cycle; if 'isemergency', set a flag to avoid
-** some operations which could change the interpreter state in some
-** unexpected ways (running finalizers and shrinking some structures).
+** performs a basic GC step when collector is running
+*/
+// ռʱִл GC 
+void luaC_step (lua_State *L) {
+  global_State *g = G(L);
+  luaS_resizestep(L);  /* move some strings if string table is resizing */
+  if (!g->gcrunning)  /* not running? */
+    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
+  else if (isdecGCmodegen(g))
+    genstep(L, g);
+  else
+    incstep(L, g);
+}
+
+
+/*
+** Clock for time-budgeted steps, in microseconds. Only differences
+** between two readings are used, so it may wrap around. Without a
+** precise clock, it falls back to 'clock', which measures CPU time.
+*/
+// ʱԤƽGCʱʹõʱӣ΢룩ֻʹζĲԿԻơ
+// ûоȷʱʱ˻صclockCPUʱ䣩
+#if !defined(luai_gcclock)
+
+#if defined(LUA_USE_POSIX)
+#define l_gettime(ts)	clock_gettime(CLOCK_MONOTONIC, ts)
+#elif (defined(_MSC_VER) && _MSC_VER >= 1900) || \
+      (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L)
+#define l_gettime(ts)	timespec_get(ts, TIME_UTC)
+#endif
+
+static lu_mem luai_gcclock (void) {
+#if defined(l_gettime)
+  struct timespec ts;
+  l_gettime(&ts);
+  return cast(lu_mem, ts.tv_sec) * 1000000u + cast(lu_mem, ts.tv_nsec / 1000);
+#else
+  return cast(lu_mem, cast(double, clock()) * (1000000.0 / CLOCKS_PER_SEC));
+#endif
+}
+
+#endif
+
+
+/*
+** Performs incremental steps until 'usec' microseconds have passed or
+** the collector reaches the end of a cycle; returns true in the latter
+** case. The clock is checked after each single step, and no single
+** step traverses more than a chunk of a large table, so the budget is
+** overrun by at most one step (the atomic phase cannot be split). The
+** work done is discounted from the debt, so that the automatic steps
+** do not repeat it. In generational mode collections are not
+** incremental, so it does a generational step only if one is due.
+*/
+// ƽռֱusec΢һѭʱ棩ÿһС֮ʱӣ
+// ÿֻһ飬೬һʱ䣨ԭӽ׶β֣ܲĹծп۳
+// ԶĲ費ظЩִģʽ»ղģֻҪʱһִ
+int luaC_steptime (lua_State *L, int usec) {
+  global_State *g = G(L);
+  l_mem work = 0;
+  lu_mem start;
+  if (isdecGCmodegen(g)) {
+    if (g->GCdebt <= 0)
+      return 0;  /* nothing due */
+    genstep(L, g);
+    return 1;
+  }
+  start = luai_gcclock();
+  do {
+    work += singlestep(L);
+  } while (g->gcstate != GCSpause &&
+           luai_gcclock() - start < cast(lu_mem, usec));
+  if (g->gcstate == GCSpause) {
+    setpause(g);  /* pause until next cycle */
+    return 1;
+  }
+  else {  /* convert 'work units' to Kb and pay them */
+    work = (work / g->gcstepmul) * STEPMULADJ;
+    luaE_setdebt(g, g->GCdebt - work);
+    return 0;
+  }
+}
+
+
+/*
+** Performs a full incremental GC cycle.
 ** Before running the collection, check 'keepinvariant'; if it is true,
 ** there may be some objects marked as black, so the collector has
 ** to sweep all objects to turn them back to white (as white has not
 ** changed, nothing will be collected).
 */
-// ִһGCѭ;ǽ״̬һ־ȥֹһЩһ벻ķʽı״ִ̬սһЩṹ
+// ִһGCѭ
 // ռ֮ǰkeepinvariantΪtrueһЩ屻ΪɫռɨжܽǱذɫ
 // Ϊɫûиı䣬Բռκζ
-void luaC_fullgc (lua_State *L, int isemergency) {
-  global_State *g = G(L);
-  lua_assert(g->gckind == KGC_NORMAL);
-  // ǷΪ״̬
-  if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
+static void fullinc (lua_State *L, global_State *g) {
   // һнذɫ
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
@@ -1475,15 +2581,39 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   // κιɨ׶Կʼµѭ
   luaC_runtilstate(L, bitmask(GCSpause));
   luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
+#if defined(LUAI_PARMARK)
+  if (g->gcmarkthreads > 1 && threadsafealloc(g) && !g->gcemergency)
+    parallelpropagate(L, g);  /* mark (almost) everything in parallel */
+#endif
   luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
   /* estimate must be correct after a full GC cycle */
   // һGCںƱȷ
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
-  g->gckind = KGC_NORMAL;
   setpause(g);
 }
 
+
+/*
+** Performs a full GC cycle; if 'isemergency', set a flag to avoid
+** some operations which could change the interpreter state in some
+** unexpected ways (running finalizers and shrinking some structures).
+*/
+// ִһGCѭģʽͷִģʽԴ
+void luaC_fullgc (lua_State *L, int isemergency) {
+  global_State *g = G(L);
+  lua_assert(!g->gcemergency);
+  // ǷΪ״̬
+  g->gcemergency = isemergency;  /* set flag */
+  if (g->gckind == KGC_INC)
+    fullinc(L, g);
+  else
+    fullgen(L, g);
+  if (isemergency)
+    luaW_drain(g);  /* memory must be really free before retrying */
+  g->gcemergency = 0;
+}
+
 /* }====================================================== */
 
 
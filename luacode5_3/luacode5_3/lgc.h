@@ -87,12 +87,15 @@
 #define testbit(x,b)		testbits(x, bitmask(b))
 
 
-/* Layout for bit use in 'marked' field: */
-#define WHITE0BIT	0  // 对象为白色类型0 /* object is white (type 0) */
-#define WHITE1BIT	1  // 对象为白色类型1 /* object is white (type 1) */
-#define BLACKBIT	2  // 对象为黑色 /* object is black */
+/*
+** Layout for bit use in 'marked' field. First three bits are
+** used for object "age" in generational mode.
+*/
+#define WHITE0BIT	3  // 对象为白色类型0 /* object is white (type 0) */
+#define WHITE1BIT	4  // 对象为白色类型1 /* object is white (type 1) */
+#define BLACKBIT	5  // 对象为黑色 /* object is black */
 // FINALIZEDBIT 用于标记没有被引用需要回收的udata 。udata的处理与其他数据类型不同，由于它是用户传人的数据，它的回收可能会调用用户注册的GC 函数，
-#define FINALIZEDBIT	3	// 对象被标记为可以回收的 //  /* object has been marked for finalization */
+#define FINALIZEDBIT	6	// 对象被标记为可以回收的 //  /* object has been marked for finalization */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 // 所有的白色的位与在一起
@@ -119,6 +122,36 @@
 #define luaC_white(g)	cast(lu_byte, (g)->currentwhite & WHITEBITS)
 
 
+/*
+** object age in generational mode. Objects in the young generation
+** ('G_NEW' and 'G_SURVIVAL') are traversed in every minor collection;
+** old objects are only traversed again when touched by a barrier.
+*/
+// 分代模式下对象的年龄。年轻代的对象（G_NEW和G_SURVIVAL）在每次小回收中都会被遍历，
+// 老对象只有在被屏障“碰过”以后才会被再次遍历
+#define G_NEW		0	/* created in current cycle */
+#define G_SURVIVAL	1	/* created in previous cycle */
+#define G_OLD0		2	/* marked old by frw. barrier in this cycle */
+#define G_OLD1		3	/* first full cycle as old */
+#define G_OLD		4	/* really old object (not to be visited) */
+#define G_TOUCHED1	5	/* old object touched this cycle */
+#define G_TOUCHED2	6	/* old object touched in previous cycle */
+
+#define AGEBITS		7  /* all age bits (111) */
+
+#define getage(o)	((o)->marked & AGEBITS)
+#define setage(o,a)  ((o)->marked = cast_byte(((o)->marked & (~AGEBITS)) | a))
+// 是否是老对象
+#define isold(o)	(getage(o) > G_SURVIVAL)
+
+#define changeage(o,f,t)  \
+	check_exp(getage(o) == (f), (o)->marked ^= ((f)^(t)))
+
+/* is collector in generational mode (or about to return to it)? */
+// 收集器是否处于分代模式（或者马上要回到分代模式）
+#define isdecGCmodegen(g)	((g)->gckind == KGC_GEN || (g)->lastatomic != 0)
+
+
 /*
 ** Does one step of collection when debt becomes positive. 'pre'/'pos'
 ** allows some adjustments to be done only when needed. macro
@@ -154,6 +187,7 @@
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
+LUAI_FUNC int luaC_steptime (lua_State *L, int usec);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
@@ -162,6 +196,7 @@ LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
 LUAI_FUNC void luaC_upvalbarrier_ (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount (lua_State *L, UpVal *uv);
+LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
 
 
 #endif
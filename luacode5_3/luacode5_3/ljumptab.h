@@ -0,0 +1,81 @@
+/*
+** $Id: ljumptab.h $
+** Jump Table for the Lua interpreter
+** See Copyright Notice in lua.h
+*/
+
+// 解释器主循环使用的跳转表（GCC/Clang 的"标签地址"扩展）
+// 每条指令执行完后直接在自己的末尾取下一条指令并跳转，这样每个操作码都有自己的
+// 间接跳转，分支预测器可以分别学习每条指令之后最可能出现的指令，而且省掉了
+// switch 的范围检查。
+
+
+#undef vmdispatch
+#undef vmcase
+#undef vmbreak
+
+// 通过跳转表跳到对应操作码的标签
+#define vmdispatch(x)     goto *disptab[x];
+
+// 每个操作码对应一个标签 L_OP_XXX
+#define vmcase(l)     L_##l:
+
+// 指令结束时直接取下一条指令并分发（每个操作码复制一份分发代码）
+#define vmbreak		vmfetch(); vmdispatch(GET_OPCODE(i));
+
+
+/*
+** order must match the enum in 'lopcodes.h' (grep "ORDER OP")
+*/
+// 顺序必须和 lopcodes.h 中的枚举一致
+static const void *const disptab[NUM_OPCODES] = {
+
+&&L_OP_MOVE,
+&&L_OP_LOADK,
+&&L_OP_LOADKX,
+&&L_OP_LOADBOOL,
+&&L_OP_LOADNIL,
+&&L_OP_GETUPVAL,
+&&L_OP_GETTABUP,
+&&L_OP_GETTABLE,
+&&L_OP_SETTABUP,
+&&L_OP_SETUPVAL,
+&&L_OP_SETTABLE,
+&&L_OP_NEWTABLE,
+&&L_OP_SELF,
+&&L_OP_ADD,
+&&L_OP_SUB,
+&&L_OP_MUL,
+&&L_OP_MOD,
+&&L_OP_POW,
+&&L_OP_DIV,
+&&L_OP_IDIV,
+&&L_OP_BAND,
+&&L_OP_BOR,
+&&L_OP_BXOR,
+&&L_OP_SHL,
+&&L_OP_SHR,
+&&L_OP_UNM,
+&&L_OP_BNOT,
+&&L_OP_NOT,
+&&L_OP_LEN,
+&&L_OP_CONCAT,
+&&L_OP_JMP,
+&&L_OP_EQ,
+&&L_OP_LT,
+&&L_OP_LE,
+&&L_OP_TEST,
+&&L_OP_TESTSET,
+&&L_OP_CALL,
+&&L_OP_TAILCALL,
+&&L_OP_RETURN,
+&&L_OP_FORLOOP,
+&&L_OP_FORPREP,
+&&L_OP_TFORCALL,
+&&L_OP_TFORLOOP,
+&&L_OP_SETLIST,
+&&L_OP_CLOSURE,
+&&L_OP_VARARG,
+&&L_OP_EXTRAARG
+
+};
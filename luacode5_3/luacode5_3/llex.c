@@ -157,8 +157,8 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     setbvalue(o, 1);  /* t[string] = true */
     luaC_checkGC(L);
   }
-  // 重用的
-  else {  /* string already present */
+  // 重用的（短字符串是唯一的，已经是同一个对象；它们也可能在表的形状中，没有对应的Node）
+  else if (ts->tt == LUA_TLNGSTR) {  /* long string already present */
     ts = tsvalue(keyfromval(o));  /* re-use value previously stored */
   }
   L->top--;  /* remove string from stack */
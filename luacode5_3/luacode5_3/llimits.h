@@ -192,6 +192,25 @@ typedef unsigned long Instruction;
 #endif
 
 
+/*
+** Limits for table shapes. A table whose keys are all short strings
+** keeps them in a shared shape while it has at most LUAI_MAXSHAPEKEYS
+** keys (0 disables shapes); a shape can be extended in at most
+** LUAI_MAXSHAPEKIDS different ways. Tables going past these limits use
+** a regular hash part. (Both must fit in an 'lu_byte'.)
+*/
+// 表形状的限制：只有短字符串键的表，在键不超过LUAI_MAXSHAPEKEYS个时使用共享的
+// 形状保存键（为0时不使用形状）；一个形状最多扩展出LUAI_MAXSHAPEKIDS个不同的子形状。
+// 超出限制的表使用普通的hash部分。（两者都必须能放入'lu_byte'）
+#if !defined(LUAI_MAXSHAPEKEYS)
+#define LUAI_MAXSHAPEKEYS	8
+#endif
+
+#if !defined(LUAI_MAXSHAPEKIDS)
+#define LUAI_MAXSHAPEKIDS	32
+#endif
+
+
 /*
 ** Size of cache for strings in the API. 'N' is the number of
 ** sets (better be a prime) and "M" is the size of each set (M == 1
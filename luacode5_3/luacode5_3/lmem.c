@@ -20,6 +20,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lworker.h"
 
 
 
@@ -79,6 +80,12 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   global_State *g = G(L);
   size_t realosize = (block) ? osize : 0;
   lua_assert((realosize == 0) == (block == NULL));
+  if (nsize == 0 && isdeferringfree(g) && block != NULL) {
+    // ɨʱͷŵĿ齻߳
+    luaW_free(g, block, osize);  /* helper thread will free it */
+    g->GCdebt -= osize;
+    return NULL;
+  }
 #if defined(HARDMEMTESTS)
   if (nsize > realosize && g->gcrunning)
     luaC_fullgc(L, 1);  /* force a GC whenever possible */
@@ -355,8 +355,8 @@ typedef struct TString {
   CommonHeader;
   // 短字符串表示“语法保留字”，长字符串表示是否已经计算了hash
   lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
-  // 短字符串的长度
-  lu_byte shrlen;  /* length for short strings */
+  // 短字符串的长度（长字符串中为0，或者是外部字符串的LSTREXT）
+  lu_byte shrlen;  /* length for short strings; LSTREXT for external ones */
   // 字符串的hash
   unsigned int hash;
   // 长字符串不入hash表,之用到长度，短字符串入hash表，用到链接结构
@@ -380,12 +380,49 @@ typedef union UTString {
 } UTString;
 
 
+/*
+** A long string reaches its bytes through 'contents': they follow its
+** header or, for an external string (see 'lua_pushexternalstring'),
+** stay in a buffer of the host, which 'frel' releases when the string
+** is collected. Short strings keep their bytes inline, right after the
+** 'TString'. Long strings do not use 'shrlen', so it tells external
+** ones apart (short strings are never that long).
+*/
+// 长字符串通过contents得到它的字节：字节跟在头后面，或者对于外部字符串（见lua_pushexternalstring）
+// 留在宿主的缓冲区中，字符串被回收时由frel释放。短字符串的字节直接跟在TString后面。
+// 长字符串不使用shrlen，所以用它区分外部字符串（短字符串不会有那么长）
+#define LSTREXT		cast_byte(~0)
+
+typedef struct LngString {
+  UTString h;
+  char *contents;  /* its bytes (followed by a '\0') */
+} LngString;
+
+typedef struct ExtString {
+  LngString h;
+  lua_Alloc frel;  /* function to release its bytes (or NULL) */
+  void *ud;  /* first argument to 'frel' */
+} ExtString;
+
+#define lngstr(ts)	check_exp((ts)->tt == LUA_TLNGSTR, cast(LngString *, (ts)))
+#define isextstr(ts)	((ts)->shrlen == LSTREXT)
+#define extstr(ts)	check_exp(isextstr(ts), cast(ExtString *, lngstr(ts)))
+
+
 /*
 ** Get the actual string (array of bytes) from a 'TString'.
 ** (Access to 'extra' ensures that value is really a 'TString'.)
+** Where the kind of string is known, 'getshrstr' and 'getlngstr'
+** avoid the test.
 */
+// 从TString得到实际的字符串（字节数组）。已知字符串种类的地方用getshrstr和getlngstr，不需要判断
+#define getshrstr(ts)  \
+  check_exp(sizeof((ts)->extra) && (ts)->tt == LUA_TSHRSTR, \
+            cast(char *, (ts)) + sizeof(UTString))
+#define getlngstr(ts)	(lngstr(ts)->contents)
 #define getstr(ts)  \
-  check_exp(sizeof((ts)->extra), cast(char *, (ts)) + sizeof(UTString))
+  check_exp(sizeof((ts)->extra), \
+    (ts)->tt == LUA_TSHRSTR ? getshrstr(ts) : getlngstr(ts))
 
 
 /* get the actual string (array of bytes) from a Lua value */
@@ -472,6 +509,17 @@ typedef struct LocVar {
 } LocVar;
 
 
+/*
+** Inline cache of a table access with a constant short-string key
+*/
+// 以短字符串常量为键的表访问指令的内联缓存：记录上次访问的表的hash部分
+// （或者形状）和键所在的槽位，下次访问同一个hash部分（或者同一形状的表）时直接命中
+typedef struct InlineCache {
+  const void *owner;  /* node array or shape of the table last accessed */
+  int slot;  /* index of the key inside that node array or shape */
+} InlineCache;
+
+
 /*
 ** Function Prototypes
 */
@@ -489,6 +537,8 @@ typedef struct Proto {
   // 常量的数目，存放的是常量数组（也就是k数组）的元素数量，和FuncState中nk的含义一样
   int sizek;  /* size of 'k' */
   int sizecode;
+  // icache的大小
+  int sizeicache;  /* size of 'icache' */
   // lineinfo的大小
   int sizelineinfo;
   // 内嵌函数数组的数目，可能有些是申请出来的赋初值为nil的
@@ -513,6 +563,8 @@ typedef struct Proto {
   Upvaldesc *upvalues;  /* upvalue information */
   // 使用此原型最后创建的闭包
   struct LClosure *cache;  /* last-created closure with this prototype */
+  // 每条指令一个内联缓存（大小和code一样）
+  InlineCache *icache;  /* inline caches, one per instruction */
   // 函数的源文件和路径
   TString  *source;  /* used for debug information */
   GCObject *gclist;
@@ -591,6 +643,35 @@ typedef struct Node {
 } Node;
 
 
+/*
+** Shape of a record-like table: the ordered list of its (short string)
+** keys. Tables with the same keys added in the same order share a
+** shape and keep only their values, in a dense 'slots' array. Shapes
+** form a tree (each one extends its parent with one key) and are
+** reference counted by the tables and shapes using them.
+*/
+// 表的形状：当表只有短字符串键时（像结构体一样使用），表的键按插入顺序记录在
+// 形状中，值按同样的顺序存放在表的'slots'数组里。以相同顺序加入相同键的表共享
+// 同一个形状，这样每个表就不需要自己的Node数组了。形状构成一棵树（每个形状比它的
+// 父形状多一个键），由使用它的表和子形状进行引用计数。
+typedef struct Shape {
+  // 少最后一个键的形状（第一层的形状为NULL）
+  struct Shape *parent;  /* shape without the last key (or NULL) */
+  // 由这个形状扩展出来的形状链表
+  struct Shape *kids;  /* shapes extending this one */
+  // 父形状'kids'链表中的下一个
+  struct Shape *sibling;  /* next shape in the parent's 'kids' list */
+  // 引用计数
+  int refcount;  /* number of tables and shapes using this shape */
+  // 键的数目
+  lu_byte nkeys;  /* number of keys */
+  // 子形状的数目
+  lu_byte nkids;  /* number of shapes in 'kids' */
+  // 键，按插入顺序
+  TString *keys[1];  /* keys, in insertion order */
+} Shape;
+
+
 typedef struct Table {
   CommonHeader;
   // 这是一个byte类型的数据，用于表示这个表中提供了哪些元方法。最开始这个flags是空的，
@@ -603,15 +684,23 @@ typedef struct Table {
   // 即如果散列桶数组要扩展的话，也是以每次在原大小基础上乘以2的形式扩展。
   // hash部分的大小的log2
   lu_byte lsizenode;  /* log2 of size of 'node' array */
+  // 紧凑数组部分中所有元素的类型标签，数组部分是普通的TValue数组时为LUA_TNIL
+  lu_byte arraytag;  /* tag of a packed array part (LUA_TNIL if plain) */
   // 数组部分的大小
   unsigned int sizearray;  /* size of 'array' array */
-  // 数组部分
-  TValue *array;  /* array part */
+  // 紧凑数组部分中存在的元素数目（它们在最前面）
+  unsigned int npacked;  /* number of elements in a packed array part */
+  // 数组部分（紧凑时实际是Value数组）
+  TValue *array;  /* array part (an array of 'Value's when packed) */
   // 指向该表的散列桶数组起始位置的指针
   // hash部分
   Node *node;
   // 指向该表散列桶数组的最后位置的指针
   Node *lastfree;  /* any free position is before this position */
+  // 表的形状（不为NULL时表示hash部分由形状和slots表示，此时node为dummynode）
+  Shape *shape;  /* shape of the table, when using one */
+  // 形状中每个键对应的值
+  TValue *slots;  /* values of the keys in 'shape' */
   // 存放该表的元表
   struct Table *metatable;
   // GC相关的链表
@@ -679,6 +679,7 @@ static void close_func (LexState *ls) {
   f->sizelocvars = fs->nlocvars;
   luaM_reallocvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
   f->sizeupvalues = fs->nups;
+  luaF_initicache(L, f);
   lua_assert(fs->bl == NULL);
   // 切回到上一个
   ls->fs = fs->prev;
@@ -36,6 +36,18 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 #endif
 
+/* minor generational collection after memory grows 20% */
+// ִģʽڴ20%һС
+#if !defined(LUAI_GENMINORMUL)
+#define LUAI_GENMINORMUL	20
+#endif
+
+/* major generational collection after memory grows 100% */
+// ִģʽڴϴδպ100%ʱһδ
+#if !defined(LUAI_GENMAJORMUL)
+#define LUAI_GENMAJORMUL	100
+#endif
+
 
 /*
 ** a macro to help the creation of a unique random seed when a state is
@@ -241,6 +253,8 @@ static void f_luaopen (lua_State *L, void *ud) {
   luaS_init(L);
   // ʼԪ
   luaT_init(L);
+  // ʼ״
+  luaH_initshapes(L);
   // 
   luaX_init(L);
   // Ƿռ
@@ -283,10 +297,13 @@ static void close_state (lua_State *L) {
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   // ͷŸ߳еʵ
   luaC_freeallobjects(L);  /* collect all objects */
+  // ͷ״ĸеıѾͷǵ״
+  luaH_freeshapes(L);
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
   // ͷַhash
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  luaM_freearray(L, G(L)->strt.old, G(L)->strt.oldsize);
   // ͷŶջ
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
@@ -359,27 +376,41 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   preinit_thread(L, g);
   g->frealloc = f;
   g->ud = ud;
+  g->tsalloc = NULL;  /* not known to be thread safe */
   g->mainthread = L;
   g->seed = makeseed(L);
   g->gcrunning = 0;  /* no GC while building state */
   g->GCestimate = 0;
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->strt.oldsize = g->strt.moved = 0;
+  g->strt.old = NULL;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->version = NULL;
   g->gcstate = GCSpause;
-  g->gckind = KGC_NORMAL;
+  g->gckind = KGC_INC;
+  g->gcemergency = 0;
+  g->gcdeferfree = 0;
+  g->gcmarkthreads = 1;
+  g->bgfree = NULL;
   g->allgc = g->finobj = g->tobefnz = g->fixedgc = NULL;
+  g->survival = g->old1 = g->reallyold = g->firstold1 = NULL;
+  g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
+  g->lastatomic = 0;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
+  g->travtable = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->shaperoot = NULL;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->genminormul = LUAI_GENMINORMUL;
+  g->genmajormul = LUAI_GENMAJORMUL;
   // ʼ͵Ԫ
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   // f_luaopenʼЩҪڴ书
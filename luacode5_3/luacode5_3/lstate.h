@@ -69,16 +69,22 @@ struct lua_longjmp;  /* defined in ldo.c */
 
 
 /* kinds of Garbage Collection */
-#define KGC_NORMAL	0
-#define KGC_EMERGENCY	1	/* gc was forced by an allocation failure */
+#define KGC_INC		0	/* incremental gc */
+#define KGC_GEN		1	/* generational gc */
 
 // 全局的字符串表
+// 改变大小时旧的桶数组保留在old中，它的桶按顺序逐步挪到hash里；
+// 一个字符串在old中，当且仅当它在old中的桶还没有挪走
 typedef struct stringtable {
   TString **hash;
   // 元素的数目
   int nuse;  /* number of elements */
   // 散列桶数目
   int size;
+  TString **old;  /* previous array while resizing (NULL otherwise) */
+  int oldsize;  /* size of 'old' */
+  // old中已经挪走的桶的数目
+  int moved;  /* buckets of 'old' already moved into 'hash' */
 } stringtable;
 
 
@@ -155,6 +161,8 @@ typedef struct global_State {
   lua_Alloc frealloc;  /* function to reallocate memory */
   // 分配器的userdata
   void *ud;         /* auxiliary data to 'frealloc' */
+  // 宿主声明为线程安全的分配器（见lua_setallocsafe），没有时为NULL
+  lua_Alloc tsalloc;  /* allocator declared thread safe (or NULL) */
   // 当前使用的内存大小(为实际内存分配器所分配的内存与GCdebt的差值)
   l_mem totalbytes;  /* number of bytes currently allocated - GCdebt */
   // 要回收的内存数量
@@ -182,10 +190,20 @@ typedef struct global_State {
   //#define GCSpause    7           // 停止
   // 当前gc的状态，
   lu_byte gcstate;  /* state of garbage collector */
-  //#define KGC_NORMAL	0
-  //#define KGC_EMERGENCY	1	/* gc was forced by an allocation failure */
+  //#define KGC_INC	0	// 增量模式
+  //#define KGC_GEN	1	// 分代模式
   // GC运行的类型
   lu_byte gckind;  /* kind of GC running */
+  // 是否是内存分配失败触发的紧急回收
+  lu_byte gcemergency;  /* true if this is an emergency collection */
+  // 为真时释放内存交给辅助线程（见lworker.c）
+  lu_byte gcdeferfree;  /* true if frees go to the helper thread */
+  // 完整回收时用来标记的线程数（见lgc.c中的parallelpropagate）
+  lu_byte gcmarkthreads;  /* number of threads marking in full collections */
+  // 分代模式下，内存增长多少（百分比）时做一次小回收
+  int genminormul;  /* control for minor generational collections */
+  // 分代模式下，内存增长多少（百分比）时做一次大回收
+  int genmajormul;  /* control for major generational collections */
   // GC是否运行
   lu_byte gcrunning;  /* true if GC is running */
   // 存放待GC对象的链表，所有对象创建之后都会放入该链表中。
@@ -210,6 +228,12 @@ typedef struct global_State {
   //  3)遍历线程时
   //  4)将黑色结点变灰色向后barrier时
   GCObject *grayagain;  /* list of objects to be traversed atomically */
+  // 正在分块遍历的大表（见lgc.c中的traversechunk），以及开始遍历时它的布局
+  struct Table *travtable;  /* large table being traversed in chunks */
+  unsigned int travpos;  /* next entry of 'travtable' to be traversed */
+  unsigned int travsizearray;  /* layout of 'travtable' when it started */
+  struct Node *travnode;
+  struct Shape *travshape;
   // 存放弱表的链表。weak 弱值表对象链表
   //新增元素的地方:
   //  1)非繁殖阶段遍历弱值表含有可能需要清理的值时
@@ -228,6 +252,22 @@ typedef struct global_State {
   GCObject *tobefnz;  /* list of userdata to be GC */
   // 不能被gc的obj列表，fixedgc 不会被回收的对象链表
   GCObject *fixedgc;  /* list of objects not to be collected */
+  /* fields for generational collector */
+  // 分代收集器使用的字段：allgc和finobj链表按年龄分段，
+  // 表头到survival是新对象，survival到old1是存活过一次的对象，old1到reallyold是刚变老的对象，之后都是老对象
+  GCObject *survival;  /* start of objects that survived one GC cycle */
+  GCObject *old1;  /* start of old1 objects */
+  GCObject *reallyold;  /* objects more than one cycle old ("really old") */
+  GCObject *firstold1;  /* first OLD1 object in the list (if any) */
+  GCObject *finobjsur;  /* list of survival objects with finalizers */
+  GCObject *finobjold1;  /* list of old1 objects with finalizers */
+  GCObject *finobjrold;  /* list of really old objects with finalizers */
+  // 上一次大回收是否“不好”（没有回收多少内存），不好的话暂时退回增量模式
+  lu_mem lastatomic;  /* see function 'genstep' in file 'lgc.c' */
+  // 表形状树的根（没有键的形状）
+  struct Shape *shaperoot;  /* root of the tree of table shapes */
+  // 在后台释放内存的辅助线程（没有时为NULL）
+  struct BgFree *bgfree;  /* helper thread freeing dead objects */
   // 拥有open upvalues的线程列表
   struct lua_State *twups;  /* list of threads with open upvalues */
   // 每一个GC步骤中，最多多少个finalizers被调用
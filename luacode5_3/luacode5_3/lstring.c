@@ -45,7 +45,7 @@ int luaS_eqlngstr (TString *a, TString *b) {
   // 如果a,b直接相等，或者长度相等且内容相等
   return (a == b) ||  /* same instance or... */
     ((len == b->u.lnglen) &&  /* equal length and ... */
-     (memcmp(getstr(a), getstr(b), len) == 0));  /* equal contents */
+     (memcmp(getlngstr(a), getlngstr(b), len) == 0));  /* equal contents */
 }
 
 // 计算字符串的hash值
@@ -59,11 +59,84 @@ unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
   return h;
 }
 
+
+/*
+** LUAI_HASHWORD selects how short strings are hashed when they are
+** internalized: 1 (default) reads them a machine word at a time; 0 uses
+** 'luaS_hash' as for every other string. Long strings, the seed and
+** anything else hashed through 'luaS_hash' are not affected.
+*/
+// LUAI_HASHWORD选择短字符串内部化时的hash：1（默认）每次读一个机器字；
+// 0和其它字符串一样用luaS_hash。长字符串、种子等其它用luaS_hash的地方不受影响
+#if !defined(LUAI_HASHWORD)
+#define LUAI_HASHWORD	1
+#endif
+
+#if LUAI_HASHWORD
+
+#if defined(_WIN64) || defined(_LP64) || defined(__LP64__)
+typedef size_t Hword;
+#define HWMUL	cast(Hword, 0x9e3779b97f4a7c15)
+#else
+typedef unsigned int Hword;
+#define HWMUL	cast(Hword, 0x9e3779b1)
+#endif
+
+#define HWSIZE		sizeof(Hword)
+#define HWHALF		(HWSIZE * 4)
+
+/* combine a word into the hash: multiply, then fold the high half down */
+// 把一个字并入hash：相乘，再把高半部分折叠到低位
+#define hwmix(h,w)	((h) = ((h) ^ (w)) * HWMUL, (h) ^= (h) >> HWHALF)
+
+
+/*
+** Hash for short strings. All bytes are used (the byte loop in
+** 'luaS_hash' skips every other byte of strings with 32 or more
+** bytes). Words are read with 'memcpy', so 'str' may be unaligned;
+** the last partial word is the last full word of the string, which
+** overlaps the previous one. As in 'luaS_hash', the hash starts from
+** 'seed' xor length, and every word goes through a multiplication
+** with the running hash, so which strings collide depends on the
+** (randomized) seed.
+*/
+// 短字符串的hash，用到所有字节（luaS_hash对32字节以上的字符串只取一半字节）。
+// 用memcpy读字，str不需要对齐；最后不满一个字的部分读字符串最后一个完整的字，
+// 和前一个字重叠。和luaS_hash一样从种子^长度开始，每个字都和当前的hash一起参与乘法，
+// 哪些字符串会冲突取决于（随机的）种子
+static unsigned int hashshort (const char *str, size_t l, unsigned int seed) {
+  Hword h = cast(Hword, seed ^ cast(unsigned int, l));
+  Hword w;
+  if (l >= HWSIZE) {
+    const char *last = str + l - HWSIZE;
+    for (; str < last; str += HWSIZE) {
+      memcpy(&w, str, HWSIZE);
+      hwmix(h, w);
+    }
+    memcpy(&w, last, HWSIZE);  /* last (maybe overlapping) word */
+    hwmix(h, w);
+  }
+  else if (l > 0) {  /* less than a word */
+    w = 0;
+    for (; l > 0; l--)
+      w = (w << 8) | cast_byte(str[l - 1]);
+    hwmix(h, w);
+  }
+  hwmix(h, 0);  /* mix the last word into the low bits used by 'lmod' */
+  return cast(unsigned int, h);
+}
+
+#else
+
+#define hashshort(str,l,seed)	luaS_hash(str, l, seed)
+
+#endif
+
 // 计算长字符串的hash值
 unsigned int luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_TLNGSTR);
   if (ts->extra == 0) {  /* no hash? */
-    ts->hash = luaS_hash(getstr(ts), ts->u.lnglen, ts->hash);
+    ts->hash = luaS_hash(getlngstr(ts), ts->u.lnglen, ts->hash);
     ts->extra = 1;  /* now it has its hash */
   }
   return ts->hash;
@@ -71,42 +144,120 @@ unsigned int luaS_hashlongstr (TString *ts) {
 
 
 /*
-** resizes the string table
+** Number of buckets moved from the old array into the new one for each
+** new short string ('STRMOVE') and for each GC step ('STRMOVEGC') while
+** the string table is being resized. With at least one per new string,
+** a table that grew has moved everything before it is full again; with
+** a few dozen, the cache misses of moving them overlap, and creating
+** strings is as fast as with a one-shot rehash.
 */
-// 重新定义字符串表的大小
-void luaS_resize (lua_State *L, int newsize) {
-  int i;
-  stringtable *tb = &G(L)->strt;
-  // 增大
-  if (newsize > tb->size) {  /* grow table if needed */
-	  // 重新分配内存
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
-	// 请客桶位
-    for (i = tb->size; i < newsize; i++)
-      tb->hash[i] = NULL;
+// 改变大小期间，每创建一个短字符串（STRMOVE）以及每个GC步（STRMOVEGC）
+// 从旧数组挪到新数组的桶数。每个新字符串至少挪一个，扩大后的表在再次装满之前就挪完了；
+// 一次挪几十个，它们的cache miss可以重叠，创建字符串和一次性rehash一样快
+#if !defined(STRMOVE)
+#define STRMOVE		32
+#endif
+
+#if !defined(STRMOVEGC)
+#define STRMOVEGC	64
+#endif
+
+
+/*
+** Bucket where a string with hash 'h' is (or should go). While resizing,
+** strings whose bucket in the old array was not moved yet are (and new
+** ones go) there, so a string is always in exactly one list.
+*/
+// hash为h的字符串所在（或者应该放入）的桶。改变大小期间，
+// 在旧数组中的桶还没有挪走的字符串在旧数组里（新的也放在那里），所以一个字符串总是只在一个链表中
+static TString **strbucket (stringtable *tb, unsigned int h) {
+  if (tb->old != NULL) {  /* resizing? */
+    int i = lmod(h, tb->oldsize);
+    if (i >= tb->moved)  /* bucket not moved yet? */
+      return &tb->old[i];
   }
-  // 将现在的字符串全部重新挂接到新的桶位上
-  for (i = 0; i < tb->size; i++) {  /* rehash */
-    TString *p = tb->hash[i];
-    tb->hash[i] = NULL;
+  return &tb->hash[lmod(h, tb->size)];
+}
+
+
+/*
+** Move up to 'n' buckets from the old array into the new one; free the
+** old array after its last bucket is moved. (Both sizes are powers of
+** 2, so the strings of old bucket 'i' can only go to new buckets 'i',
+** 'i + oldsize', ...; these are cleared right before, which is also
+** before 'strbucket' can return them.)
+*/
+// 从旧数组挪最多n个桶到新数组，最后一个桶挪走后释放旧数组。
+// （两个大小都是2的幂，旧桶i中的字符串只会去新桶i，i + oldsize，...；
+// 在挪之前才清空这些新桶，这也在strbucket可能返回它们之前）
+static void movebuckets (lua_State *L, stringtable *tb, int n) {
+  for (; n > 0 && tb->moved < tb->oldsize; n--) {
+    int i = tb->moved++;
+    TString *p = tb->old[i];
+    for (; i < tb->size; i += tb->oldsize)
+      tb->hash[i] = NULL;
     while (p) {  /* for each node in the list */
       TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, newsize);  /* new position */
+      unsigned int h = lmod(p->hash, tb->size);  /* new position */
       p->u.hnext = tb->hash[h];  /* chain it */
       tb->hash[h] = p;
       p = hnext;
     }
   }
-  // 收缩
-  if (newsize < tb->size) {  /* shrink table if needed */
-    /* vanishing slice should be empty */
-    lua_assert(tb->hash[newsize] == NULL && tb->hash[tb->size - 1] == NULL);
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
+  if (tb->moved == tb->oldsize) {  /* all moved? */
+    luaM_freearray(L, tb->old, tb->oldsize);
+    tb->old = NULL;
+    tb->oldsize = tb->moved = 0;
+  }
+}
+
+
+/*
+** resizes the string table
+** Only the new array is allocated here (and not even cleared, see
+** 'movebuckets'); the strings are moved into it a few buckets at a time
+** by 'internshrstr' and 'luaS_resizestep', so the pause does not grow
+** with the number of strings. A resize still in progress is finished
+** first.
+*/
+// 重新定义字符串表的大小
+// 这里只分配新数组（也不清空，见movebuckets），字符串由internshrstr和
+// luaS_resizestep每次挪几个桶，停顿不随字符串数目增长。还没有完成的上一次改变会先完成
+void luaS_resize (lua_State *L, int newsize) {
+  stringtable *tb = &G(L)->strt;
+  TString **newhash;
+  if (tb->old != NULL)  /* previous resize not finished? */
+    movebuckets(L, tb, tb->oldsize);  /* finish it */
+  // 分配新数组（可能出内存错误，这时表没有变化）
+  newhash = luaM_newvector(L, newsize, TString *);
+  if (tb->size > 0) {  /* strings to move? */
+    tb->old = tb->hash;
+    tb->oldsize = tb->size;
+    tb->moved = 0;
+  }
+  else {  /* first array: nothing to move, clear it now */
+    int i;
+    for (i = 0; i < newsize; i++)
+      newhash[i] = NULL;
   }
+  tb->hash = newhash;
   tb->size = newsize;
 }
 
 
+/*
+** Move some buckets if the string table is being resized (called in
+** each GC step, so that a resize also finishes when few new strings are
+** created)
+*/
+// 字符串表正在改变大小时挪几个桶（每个GC步调用，新字符串很少时改变也能完成）
+void luaS_resizestep (lua_State *L) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->old != NULL)
+    movebuckets(L, tb, STRMOVEGC);
+}
+
+
 /*
 ** Clear API string cache. (Entries cannot be empty, so fill them with
 ** a non-collectable string.)
@@ -144,33 +295,33 @@ void luaS_init (lua_State *L) {
 
 
 /*
-** creates a new string object
+** creates a new string object of 'totalsize' bytes (without its
+** contents, which depend on its kind)
 */
-// 创建一个新的字符串实例
-static TString *createstrobj (lua_State *L, size_t l, int tag, unsigned int h) {
-  TString *ts;
-  GCObject *o;
-  size_t totalsize;  /* total size of TString object */
-  totalsize = sizelstring(l);
-  o = luaC_newobj(L, tag, totalsize);
-  ts = gco2ts(o);
+// 创建一个totalsize字节的新字符串实例（不包括内容，内容由字符串的种类决定）
+static TString *createstrobj (lua_State *L, size_t totalsize, int tag,
+                              unsigned int h) {
+  GCObject *o = luaC_newobj(L, tag, totalsize);
+  TString *ts = gco2ts(o);
   ts->hash = h;
   ts->extra = 0;
-  getstr(ts)[l] = '\0';  /* ending 0 */
   return ts;
 }
 
-// 创建一个指定长度的长字符串
+// 创建一个指定长度的长字符串，字节跟在头后面
 TString *luaS_createlngstrobj (lua_State *L, size_t l) {
-  TString *ts = createstrobj(L, l, LUA_TLNGSTR, G(L)->seed);
+  TString *ts = createstrobj(L, sizelngstring(l), LUA_TLNGSTR, G(L)->seed);
+  ts->shrlen = 0;  /* not external */
   ts->u.lnglen = l;
+  lngstr(ts)->contents = cast(char *, lngstr(ts) + 1);
+  getlngstr(ts)[l] = '\0';  /* ending 0 */
   return ts;
 }
 
 // 将字符串从字符串表中删除
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  TString **p = strbucket(tb, ts->hash);
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -186,14 +337,14 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   TString *ts;
   global_State *g = G(L);
   // 计算字符串的hash值
-  unsigned int h = luaS_hash(str, l, g->seed);
+  unsigned int h = hashshort(str, l, g->seed);
   // 通过hash值找到桶位
-  TString **list = &g->strt.hash[lmod(h, g->strt.size)];
+  TString **list = strbucket(&g->strt, h);
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
   // 遍历列表，找对应的字符串
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
     if (l == ts->shrlen &&
-        (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
+        (memcmp(str, getshrstr(ts), l * sizeof(char)) == 0)) {
       /* found! */
 	  // 找到了
       if (isdead(g, ts))  /* dead (but not collected yet)? */
@@ -201,15 +352,20 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
-  // 如果字符串的数目大于桶位的大小，重新分布桶位和挂接
-  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2) {
+  // 正在改变大小时挪几个桶；否则如果字符串的数目大于桶位的大小，开始扩大
+  if (g->strt.old != NULL) {  /* resizing? */
+    movebuckets(L, &g->strt, STRMOVE);  /* move a few more buckets */
+    list = strbucket(&g->strt, h);  /* bucket may have moved */
+  }
+  else if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2) {
     luaS_resize(L, g->strt.size * 2);
-    list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
+    list = strbucket(&g->strt, h);  /* recompute with new size */
   }
   // 创建一个短字符串，放入到短字符串表中
-  ts = createstrobj(L, l, LUA_TSHRSTR, h);
-  memcpy(getstr(ts), str, l * sizeof(char));
+  ts = createstrobj(L, sizelstring(l), LUA_TSHRSTR, h);
   ts->shrlen = cast_byte(l);
+  memcpy(getshrstr(ts), str, l * sizeof(char));
+  getshrstr(ts)[l] = '\0';  /* ending 0 */
   ts->u.hnext = *list;
   *list = ts;
   g->strt.nuse++;
@@ -233,12 +389,61 @@ TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
       luaM_toobig(L);
 	// 长字符串直接创建，并将原来的数据拷贝到目标的长字符串
     ts = luaS_createlngstrobj(L, l);
-    memcpy(getstr(ts), str, l * sizeof(char));
+    memcpy(getlngstr(ts), str, l * sizeof(char));
     return ts;
   }
 }
 
 
+typedef struct {
+  const char *s;
+  size_t l;
+  lua_Alloc frel;
+  void *ud;
+  TString *ts;  /* result */
+} AuxNewExt;
+
+
+static void auxnewext (lua_State *L, void *ud) {
+  AuxNewExt *a = cast(AuxNewExt *, ud);
+  if (a->l <= LUAI_MAXSHORTLEN)  /* short strings are always internalized */
+    a->ts = internshrstr(L, a->s, a->l);
+  else {
+    TString *ts = createstrobj(L, sizeof(ExtString), LUA_TLNGSTR,
+                                  G(L)->seed);
+    ts->shrlen = LSTREXT;
+    ts->u.lnglen = a->l;
+    lngstr(ts)->contents = cast(char *, a->s);
+    extstr(ts)->frel = a->frel;
+    extstr(ts)->ud = a->ud;
+    a->ts = ts;
+  }
+}
+
+
+/*
+** Create a long string with the 'l' bytes at 's' (followed by a '\0'),
+** not copying them: 'frel' (if not NULL) releases them when the string
+** is collected. A short string is copied, as usual, and its buffer
+** released at once. Anyway, the buffer is released if there is an
+** error.
+*/
+// 不复制s处的l个字节（后面跟着'\0'）创建长字符串：字符串被回收时用frel（不是NULL的话）
+// 释放它们。短字符串和平常一样复制，它的缓冲区立即释放。出错时缓冲区也会被释放
+TString *luaS_newextlstr (lua_State *L, const char *s, size_t l,
+                          lua_Alloc frel, void *ud) {
+  AuxNewExt a;
+  int status;
+  a.s = s; a.l = l; a.frel = frel; a.ud = ud; a.ts = NULL;
+  status = luaD_rawrunprotected(L, auxnewext, &a);
+  if ((status != LUA_OK || !isextstr(a.ts)) && frel != NULL)
+    (*frel)(ud, cast(void *, s), l + 1, 0);  /* buffer no longer needed */
+  if (status != LUA_OK)
+    luaD_throw(L, status);  /* rethrow memory error */
+  return a.ts;
+}
+
+
 /*
 ** Create or reuse a zero-terminated string, first checking in the
 ** cache (using the string address as a key). The cache can contain
@@ -547,6 +547,617 @@ static const char *lmemfind (const char *s1, size_t l1,
 }
 
 
+/*
+** {======================================================
+** COMPILED PATTERNS
+** A pattern is compiled into a flat program: one instruction per
+** item, with the length and suffix of each single char class already
+** known, bracket classes as bitmaps, and runs of plain characters
+** merged into literals. Programs are kept in a small cache (the first
+** upvalue of the matching functions), indexed by the address of the
+** pattern string and checked against a copy of it, so a pattern used in
+** a loop is compiled only once. 'cmatch' and friends below mirror
+** 'match' and friends above step by step (including 'matchdepth'), so
+** both give the same results and raise the same errors.
+** =======================================================
+*/
+
+
+/* number of entries in the pattern cache */
+#if !defined(PATCACHESIZE)
+#define PATCACHESIZE	64
+#endif
+
+/* longer patterns are not compiled */
+#if !defined(PATMAXCOMPILE)
+#define PATMAXCOMPILE	512
+#endif
+
+/* maximum number of '%x' classes inside a compiled bracket class */
+#define PSETCLASSES	8
+
+
+/* instructions */
+enum {
+  PI_MATCH,  /* end of pattern */
+  PI_STR,  /* literal string */
+  PI_CHAR,  /* single char (with a suffix) */
+  PI_ANY,  /* '.' */
+  PI_CLASS,  /* '%x' */
+  PI_SET,  /* '[set]' */
+  PI_OPEN,  /* '(' */
+  PI_POSITION,  /* '()' */
+  PI_CLOSE,  /* ')' */
+  PI_EOS,  /* '$' at the end of the pattern */
+  PI_BALANCE,  /* '%bxy' */
+  PI_FRONTIER,  /* '%f[set]' */
+  PI_BACKREF  /* '%0'-'%9' */
+};
+
+
+typedef struct PSet {
+  unsigned char bits[32];  /* single chars and ranges */
+  unsigned char neg;  /* true for '[^...]' */
+  unsigned char ncls;  /* number of classes in 'cls' */
+  char cls[PSETCLASSES];  /* '%x' classes (they depend on the locale) */
+} PSet;
+
+
+typedef struct PInst {
+  unsigned char op;
+  unsigned char suffix;  /* '*', '+', '-', '?' or 0 (single char items) */
+  unsigned char c;  /* char, class, capture index or '%b' open char */
+  unsigned char c2;  /* '%b' close char */
+  unsigned char nclose;  /* number of ')' before 'follow' */
+  short follow;  /* char that must follow a repetition, or -1 */
+  size_t len;  /* length of a literal */
+  union {
+    const PSet *set;  /* PI_SET, PI_FRONTIER */
+    const char *lit;  /* PI_STR */
+  } u;
+} PInst;
+
+
+typedef struct Pattern {
+  size_t lp;  /* length of the pattern */
+  int ok;  /* false if the pattern is left to the interpreter */
+  int first;  /* first instruction that consumes input */
+  const char *pat;  /* copy of the pattern */
+  PInst code[1];  /* program, followed by its sets and literals */
+} Pattern;
+
+
+/* sizes of a program */
+typedef struct PSize {
+  size_t ninst, nsets, nlits;
+} PSize;
+
+
+#define setcharbit(set,c)	((set)->bits[(c) >> 3] |= (1u << ((c) & 7)))
+
+
+static int setmatch (const PSet *set, int c) {
+  int res = (set->bits[c >> 3] >> (c & 7)) & 1;
+  if (!res) {
+    int i;
+    for (i = 0; i < set->ncls; i++) {
+      if (match_class(c, uchar(set->cls[i]))) {
+        res = 1;
+        break;
+      }
+    }
+  }
+  return res ^ set->neg;
+}
+
+
+/* is 'cl' (after a '%') a character class? */
+static int isclass (int cl) {
+  return (cl != '\0' && strchr("acdglpsuwxz", tolower(cl)) != NULL);
+}
+
+
+/* 'classend' without errors: returns NULL for a malformed class */
+static const char *cclassend (const char *p, const char *pe) {
+  switch (*p++) {
+    case L_ESC: {
+      return (p == pe) ? NULL : p + 1;
+    }
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a ']' */
+        if (p == pe) return NULL;
+        if (*(p++) == L_ESC && p < pe)
+          p++;  /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p+1;
+    }
+    default: {
+      return p;
+    }
+  }
+}
+
+
+/*
+** Build in 'set' (when not NULL) the bracket class from 'p' ('[') to
+** 'ec' (its ']'), reading it as 'matchbracketclass' does. Returns 0 if
+** the class has too many '%x' classes.
+*/
+static int compileset (const char *p, const char *ec, PSet *set) {
+  PSet s;
+  memset(&s, 0, sizeof(s));
+  if (*(p+1) == '^') {
+    s.neg = 1;
+    p++;  /* skip the '^' */
+  }
+  while (++p < ec) {
+    if (*p == L_ESC) {
+      p++;
+      if (!isclass(uchar(*p)))
+        setcharbit(&s, uchar(*p));
+      else if (s.ncls == PSETCLASSES)
+        return 0;
+      else
+        s.cls[s.ncls++] = *p;
+    }
+    else if (*(p+1) == '-' && (p+2 < ec)) {
+      int c;
+      p+=2;
+      for (c = uchar(*(p-2)); c <= uchar(*p); c++)
+        setcharbit(&s, c);
+    }
+    else
+      setcharbit(&s, uchar(*p));
+  }
+  if (set) *set = s;
+  return 1;
+}
+
+
+/*
+** Compile pattern 'p' (ending at 'pe'). With 'pt' == NULL it only
+** computes in 'sz' the sizes of the program; otherwise it fills 'pt',
+** laid out with the sizes in 'sz'. Returns 0 for patterns left to the
+** interpreter: malformed patterns (whose errors are raised only when
+** matching reaches them) and sets with too many classes.
+*/
+static int compilepattern (const char *p, const char *pe, Pattern *pt,
+                           PSize *sz) {
+  PInst *code = NULL;
+  PSet *sets = NULL;
+  char *lits = NULL;
+  int instr = 0;  /* last instruction is a literal? */
+  if (pt) {
+    code = pt->code;
+    sets = (PSet *)(code + sz->ninst);
+    lits = (char *)(sets + sz->nsets);
+  }
+  sz->ninst = sz->nsets = sz->nlits = 0;
+  while (p != pe) {
+    PInst in;
+    in.suffix = in.c = in.c2 = in.nclose = 0;
+    in.follow = -1;
+    in.len = 0;
+    in.u.lit = NULL;
+    switch (*p) {
+      case '(': {
+        in.op = (*(p + 1) == ')') ? PI_POSITION : PI_OPEN;
+        p += (in.op == PI_POSITION) ? 2 : 1;
+        break;
+      }
+      case ')': {
+        in.op = PI_CLOSE;
+        p++;
+        break;
+      }
+      case '$': {
+        if ((p + 1) != pe)
+          goto dflt;
+        in.op = PI_EOS;
+        p++;
+        break;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= pe - 1)
+              return 0;  /* missing arguments to '%b' */
+            in.op = PI_BALANCE;
+            in.c = uchar(*(p + 2));
+            in.c2 = uchar(*(p + 3));
+            p += 4;
+            break;
+          }
+          case 'f': {
+            const char *ep;
+            p += 2;
+            if (*p != '[' || (ep = cclassend(p, pe)) == NULL)
+              return 0;  /* missing '[' after '%f' or malformed set */
+            if (!compileset(p, ep - 1, pt ? &sets[sz->nsets] : NULL))
+              return 0;
+            in.op = PI_FRONTIER;
+            in.u.set = pt ? &sets[sz->nsets] : NULL;
+            sz->nsets++;
+            p = ep;
+            break;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            in.op = PI_BACKREF;
+            in.c = uchar(*(p + 1));
+            p += 2;
+            break;
+          }
+          default: goto dflt;
+        }
+        break;
+      }
+      default: dflt: {  /* single char class */
+        const char *ep = cclassend(p, pe);
+        if (ep == NULL)
+          return 0;  /* malformed pattern */
+        switch (*p) {
+          case '.': in.op = PI_ANY; break;
+          case L_ESC: {
+            in.op = isclass(uchar(*(p + 1))) ? PI_CLASS : PI_CHAR;
+            in.c = uchar(*(p + 1));
+            break;
+          }
+          case '[': {
+            if (!compileset(p, ep - 1, pt ? &sets[sz->nsets] : NULL))
+              return 0;
+            in.op = PI_SET;
+            in.u.set = pt ? &sets[sz->nsets] : NULL;
+            sz->nsets++;
+            break;
+          }
+          default: in.op = PI_CHAR; in.c = uchar(*p); break;
+        }
+        p = ep;
+        if (p != pe && (*p == '*' || *p == '+' || *p == '-' || *p == '?'))
+          in.suffix = uchar(*p++);
+        if (in.op == PI_CHAR && in.suffix == 0) {  /* plain char? */
+          if (pt) lits[sz->nlits] = (char)in.c;
+          sz->nlits++;
+          if (instr) {  /* extend current literal */
+            if (pt) code[sz->ninst - 1].len++;
+            continue;
+          }
+          in.op = PI_STR;
+          in.c = 0;
+          in.len = 1;
+          in.u.lit = pt ? &lits[sz->nlits - 1] : NULL;
+        }
+        break;
+      }
+    }
+    instr = (in.op == PI_STR);
+    if (pt) code[sz->ninst] = in;
+    sz->ninst++;
+  }
+  if (pt) {
+    size_t i;
+    code[sz->ninst].op = PI_MATCH;
+    for (i = 0; i < sz->ninst; i++) {  /* what follows each item */
+      const PInst *next = &code[i + 1];
+      while (next->op == PI_CLOSE && code[i].nclose < LUA_MAXCAPTURES) {
+        code[i].nclose++;
+        next++;
+      }
+      if (next->op == PI_STR)
+        code[i].follow = uchar(next->u.lit[0]);
+      else if (next->op == PI_CHAR && next->suffix == '+')
+        code[i].follow = next->c;
+    }
+    i = 0;
+    /* leading captures do not consume input (nor fail) */
+    while (code[i].op == PI_OPEN || code[i].op == PI_POSITION) i++;
+    pt->first = (i < LUA_MAXCAPTURES) ? (int)i : 0;
+  }
+  sz->ninst++;  /* PI_MATCH */
+  return 1;
+}
+
+
+/*
+** Push the compiled program for pattern 'p' (of length 'lp', from the
+** string at index 'arg') from the cache in the first upvalue. A pattern
+** is compiled the second time it is seen; the first time its slot only
+** keeps the pattern string, so patterns built for a single use do not
+** pay for compiling. Returns NULL (and pushes something else) when the
+** interpreter must be used.
+*/
+static const Pattern *getpattern (lua_State *L, int arg,
+                                  const char *p, size_t lp) {
+  int slot = (int)(((size_t)p >> 3) % PATCACHESIZE) + 1;
+  size_t size;
+  PSize sz;
+  Pattern *pt;
+  int ok;
+  if (lp > PATMAXCOMPILE) {
+    lua_pushnil(L);
+    return NULL;
+  }
+  if (lua_rawgeti(L, lua_upvalueindex(1), slot) == LUA_TUSERDATA) {
+    pt = (Pattern *)lua_touserdata(L, -1);
+    if (pt->lp == lp && memcmp(pt->pat, p, lp) == 0)
+      return pt->ok ? pt : NULL;  /* cache hit */
+  }
+  if (!lua_rawequal(L, -1, arg)) {  /* first time? */
+    lua_pushvalue(L, arg);  /* remember the pattern */
+    lua_rawseti(L, lua_upvalueindex(1), slot);
+    return NULL;
+  }
+  lua_pop(L, 1);  /* seen before: compile it */
+  ok = compilepattern(p, p + lp, NULL, &sz);
+  if (!ok) sz.ninst = sz.nsets = sz.nlits = 0;
+  size = offsetof(Pattern, code) + sz.ninst * sizeof(PInst) +
+         sz.nsets * sizeof(PSet) + sz.nlits + lp + 1;
+  pt = (Pattern *)lua_newuserdata(L, size);
+  pt->lp = lp;
+  pt->ok = ok;
+  pt->first = 0;
+  pt->pat = (char *)pt + size - (lp + 1);
+  memcpy((char *)pt->pat, p, lp + 1);  /* with its final '\0' */
+  if (ok) compilepattern(p, p + lp, pt, &sz);
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, lua_upvalueindex(1), slot);
+  return ok ? pt : NULL;
+}
+
+
+static const char *cmatch (MatchState *ms, const char *s, const PInst *pc);
+
+
+static int csinglematch (MatchState *ms, const char *s, const PInst *pc) {
+  if (s >= ms->src_end)
+    return 0;
+  else {
+    int c = uchar(*s);
+    switch (pc->op) {
+      case PI_ANY: return 1;  /* matches any char */
+      case PI_CLASS: return match_class(c, pc->c);
+      case PI_SET: return setmatch(pc->u.set, c);
+      default: return (pc->c == c);
+    }
+  }
+}
+
+
+/* number of chars from 's' matching single char item 'pc' */
+static ptrdiff_t ccount (MatchState *ms, const char *s, const PInst *pc) {
+  const char *e = ms->src_end;
+  const char *p = s;
+  switch (pc->op) {
+    case PI_ANY: return e - s;
+    case PI_CHAR: while (p < e && uchar(*p) == pc->c) p++; break;
+    case PI_CLASS: while (p < e && match_class(uchar(*p), pc->c)) p++; break;
+    default: while (p < e && setmatch(pc->u.set, uchar(*p))) p++; break;
+  }
+  return p - s;
+}
+
+
+static const char *cmatchbalance (MatchState *ms, const char *s,
+                                  const PInst *pc) {
+  if (uchar(*s) != pc->c) return NULL;
+  else {
+    int cont = 1;
+    while (++s < ms->src_end) {
+      if (uchar(*s) == pc->c2) {
+        if (--cont == 0) return s+1;
+      }
+      else if (uchar(*s) == pc->c) cont++;
+    }
+  }
+  return NULL;  /* string ends out of balance */
+}
+
+
+/*
+** Can 'cmax_expand' skip the positions where the rest of the pattern
+** fails at its first char? Only if getting there (closing 'nclose'
+** captures) would not raise an error.
+*/
+static int canskip (MatchState *ms, int nclose) {
+  int l;
+  if (ms->matchdepth <= nclose)
+    return 0;  /* would raise "pattern too complex" */
+  for (l = ms->level - 1; l >= 0 && nclose > 0; l--) {
+    if (ms->capture[l].len == CAP_UNFINISHED)
+      nclose--;
+  }
+  return (nclose == 0);  /* else would raise "invalid pattern capture" */
+}
+
+
+static const char *cmax_expand (MatchState *ms, const char *s,
+                                const PInst *pc) {
+  ptrdiff_t i = ccount(ms, s, pc);
+  int c = pc->follow;
+  if (c >= 0 && !canskip(ms, pc->nclose))
+    c = -1;
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    const char *res;
+    if (c >= 0) {  /* skip repetitions not followed by 'c' */
+      while (i >= 0 && uchar(*(s+i)) != c) i--;
+      if (i < 0) break;
+    }
+    res = cmatch(ms, (s+i), pc + 1);
+    if (res) return res;
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+
+static const char *cmin_expand (MatchState *ms, const char *s,
+                                const PInst *pc) {
+  for (;;) {
+    const char *res = cmatch(ms, s, pc + 1);
+    if (res != NULL)
+      return res;
+    else if (csinglematch(ms, s, pc))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *cstart_capture (MatchState *ms, const char *s,
+                                   const PInst *pc, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=cmatch(ms, s, pc)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *cend_capture (MatchState *ms, const char *s,
+                                 const PInst *pc) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = cmatch(ms, s, pc)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+static const char *cmatch (MatchState *ms, const char *s, const PInst *pc) {
+  if (ms->matchdepth-- == 0)
+    luaL_error(ms->L, "pattern too complex");
+  init: /* using goto's to optimize tail recursion */
+  switch (pc->op) {
+    case PI_MATCH: {  /* end of pattern */
+      break;
+    }
+    case PI_STR: {
+      if ((size_t)(ms->src_end - s) >= pc->len &&
+          memcmp(s, pc->u.lit, pc->len) == 0) {
+        s += pc->len; pc++; goto init;
+      }
+      s = NULL;
+      break;
+    }
+    case PI_OPEN: {
+      s = cstart_capture(ms, s, pc + 1, CAP_UNFINISHED);
+      break;
+    }
+    case PI_POSITION: {
+      s = cstart_capture(ms, s, pc + 1, CAP_POSITION);
+      break;
+    }
+    case PI_CLOSE: {
+      s = cend_capture(ms, s, pc + 1);
+      break;
+    }
+    case PI_EOS: {
+      if (s != ms->src_end) s = NULL;  /* check end of string */
+      break;
+    }
+    case PI_BALANCE: {
+      s = cmatchbalance(ms, s, pc);
+      if (s != NULL) {
+        pc++; goto init;  /* return match(ms, s, p + 4); */
+      }  /* else fail (s == NULL) */
+      break;
+    }
+    case PI_FRONTIER: {
+      char previous = (s == ms->src_init) ? '\0' : *(s - 1);
+      if (!setmatch(pc->u.set, uchar(previous)) &&
+           setmatch(pc->u.set, uchar(*s))) {
+        pc++; goto init;  /* return match(ms, s, ep); */
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, pc->c);
+      if (s != NULL) {
+        pc++; goto init;  /* return match(ms, s, p + 2) */
+      }
+      break;
+    }
+    default: {  /* single char item */
+      if (!csinglematch(ms, s, pc)) {  /* does not match? */
+        if (pc->suffix == '*' || pc->suffix == '?' || pc->suffix == '-') {
+          pc++; goto init;  /* return match(ms, s, ep + 1); */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (pc->suffix) {  /* handle optional suffix */
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = cmatch(ms, s + 1, pc + 1)) != NULL)
+              s = res;
+            else {
+              pc++; goto init;  /* else return match(ms, s, ep + 1); */
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = cmax_expand(ms, s, pc);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = cmin_expand(ms, s, pc);
+            break;
+          default:  /* no suffix */
+            s++; pc++; goto init;  /* return match(ms, s + 1, ep); */
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/*
+** First position from 's' where pattern 'pt' can match, or NULL if
+** there is none. Only the first item that consumes input is checked;
+** a match at the positions skipped would fail right there.
+*/
+static const char *cfirst (MatchState *ms, const Pattern *pt,
+                           const char *s) {
+  const PInst *pc = &pt->code[pt->first];
+  switch (pc->op) {
+    case PI_STR: {
+      return lmemfind(s, ms->src_end - s, pc->u.lit, pc->len);
+    }
+    case PI_CHAR: case PI_ANY: case PI_CLASS: case PI_SET: {
+      if (pc->suffix != 0 && pc->suffix != '+')
+        return s;  /* item may match the empty string */
+      if (pc->op == PI_CHAR)
+        return (const char *)memchr(s, pc->c, ms->src_end - s);
+      while (s < ms->src_end && !csinglematch(ms, s, pc)) s++;
+      return (s < ms->src_end) ? s : NULL;
+    }
+    default: return s;
+  }
+}
+
+
+#define domatch(ms,s,p,pt)  \
+	((pt) ? cmatch(ms, s, (pt)->code) : match(ms, s, p))
+
+/* }====================================================== */
+
+
 static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   if (i >= ms->level) {
@@ -626,16 +1237,20 @@ static int str_find_aux (lua_State *L, int find) {
   }
   else {
     MatchState ms;
+    const Pattern *pt;
     const char *s1 = s + init - 1;
     int anchor = (*p == '^');
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
+    pt = getpattern(L, 2, p, lp);
     prepstate(&ms, L, s, ls, p, lp);
     do {
       const char *res;
+      if (pt && !anchor && (s1 = cfirst(&ms, pt, s1)) == NULL)
+        break;  /* no more places where it can match */
       reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if ((res=domatch(&ms, s1, p, pt)) != NULL) {
         if (find) {
           lua_pushinteger(L, (s1 - s) + 1);  /* start */
           lua_pushinteger(L, res - s);   /* end */
@@ -665,6 +1280,7 @@ static int str_match (lua_State *L) {
 typedef struct GMatchState {
   const char *src;  /* current position */
   const char *p;  /* pattern */
+  const Pattern *pt;  /* compiled pattern (or NULL) */
   const char *lastmatch;  /* end of last match */
   MatchState ms;  /* match state */
 } GMatchState;
@@ -676,8 +1292,11 @@ static int gmatch_aux (lua_State *L) {
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if (gm->pt && (src = cfirst(&gm->ms, gm->pt, src)) == NULL)
+      break;  /* no more places where it can match */
     reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+    if ((e = domatch(&gm->ms, src, gm->p, gm->pt)) != NULL &&
+        e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
       return push_captures(&gm->ms, src, e);
     }
@@ -695,7 +1314,8 @@ static int gmatch (lua_State *L) {
   gm = (GMatchState *)lua_newuserdata(L, sizeof(GMatchState));
   prepstate(&gm->ms, L, s, ls, p, lp);
   gm->src = s; gm->p = p; gm->lastmatch = NULL;
-  lua_pushcclosure(L, gmatch_aux, 3);
+  gm->pt = getpattern(L, 2, p, lp);  /* keep it on closure, too */
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -768,20 +1388,29 @@ static int str_gsub (lua_State *L) {
   lua_Integer max_s = luaL_optinteger(L, 4, srcl + 1);  /* max replacements */
   int anchor = (*p == '^');
   lua_Integer n = 0;  /* replacement count */
+  const Pattern *pt;
   MatchState ms;
   luaL_Buffer b;
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
-  luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
+  pt = getpattern(L, 2, p, lp);  /* below the buffer, so it stays alive */
+  luaL_buffinit(L, &b);
   prepstate(&ms, L, src, srcl, p, lp);
   while (n < max_s) {
     const char *e;
+    if (pt && !anchor) {  /* copy what cannot start a match */
+      const char *next = cfirst(&ms, pt, src);
+      if (next == NULL) break;  /* no more matches */
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+    e = domatch(&ms, src, p, pt);
+    if (e != NULL && e != lastmatch) {  /* match? */
       n++;
       add_value(&ms, &b, src, e, tr);  /* add replacement to buffer */
       src = lastmatch = e;
@@ -1543,13 +2172,9 @@ static const luaL_Reg strlib[] = {
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
-  {"find", str_find},
   {"format", str_format},
-  {"gmatch", gmatch},
-  {"gsub", str_gsub},
   {"len", str_len},
   {"lower", str_lower},
-  {"match", str_match},
   {"rep", str_rep},
   {"reverse", str_reverse},
   {"sub", str_sub},
@@ -1561,6 +2186,16 @@ static const luaL_Reg strlib[] = {
 };
 
 
+/* functions sharing the pattern cache */
+static const luaL_Reg patlib[] = {
+  {"find", str_find},
+  {"gmatch", gmatch},
+  {"gsub", str_gsub},
+  {"match", str_match},
+  {NULL, NULL}
+};
+
+
 static void createmetatable (lua_State *L) {
   lua_createtable(L, 0, 1);  /* table to be metatable for strings */
   lua_pushliteral(L, "");  /* dummy string */
@@ -1578,6 +2213,8 @@ static void createmetatable (lua_State *L) {
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
   luaL_newlib(L, strlib);
+  lua_createtable(L, PATCACHESIZE, 0);  /* pattern cache */
+  luaL_setfuncs(L, patlib, 1);
   createmetatable(L);
   return 1;
 }
@@ -21,10 +21,17 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** Tables whose hash part holds only a few short-string keys (records)
+** keep these keys in a shape shared by all tables with the same keys
+** in the same order, and only their values in a dense 'slots' array.
+** Any other key moves them to a regular hash part.
+** An array part holding only integers (or only floats) is packed,
+** keeping only their values.
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -161,6 +168,370 @@ static unsigned int arrayindex (const TValue *key) {
 }
 
 
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+/* size of a shape with 'n' keys */
+#define sizeshape(n)	(offsetof(Shape, keys) + sizeof(TString *) * (n))
+
+
+/*
+** returns the index of 'key' in shape 's', or -1 if it is not there
+*/
+// 返回key在形状中的索引，不存在时返回-1
+static int shapeindex (const Shape *s, const TString *key) {
+  int i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (s->keys[i] == key)
+      return i;
+  }
+  return -1;
+}
+
+
+/*
+** release a reference to shape 's'; a shape nobody uses any more is
+** removed from its parent's list of kids and freed, which releases
+** the reference it held to its parent
+*/
+// 释放对形状的一个引用，没有被使用的形状从父形状中移除并释放（同时释放对父形状的引用）
+static void releaseshape (lua_State *L, Shape *s) {
+  while (--s->refcount == 0) {
+    Shape *p = s->parent;
+    Shape **kids = &p->kids;
+    lua_assert(s->kids == NULL);
+    while (*kids != s)  /* find 's' in its parent's list */
+      kids = &(*kids)->sibling;
+    *kids = s->sibling;  /* unlink it */
+    p->nkids--;
+    luaM_freemem(L, s, sizeshape(s->nkeys));
+    s = p;  /* release the reference it held to its parent */
+  }
+}
+
+
+/*
+** returns the shape that extends 'p' with 'key', creating it if
+** needed, or NULL if 'p' already has too many kids. (A new shape has
+** no references yet.)
+*/
+// 得到在p的基础上加入key的形状，不存在时创建（新创建的形状还没有引用），
+// p的子形状太多时返回NULL
+static Shape *getshape (lua_State *L, Shape *p, TString *key) {
+  Shape **kids;
+  Shape *s;
+  int i;
+  for (kids = &p->kids; (s = *kids) != NULL; kids = &s->sibling) {
+    if (s->keys[s->nkeys - 1] == key) {  /* found? */
+      *kids = s->sibling;  /* move it to the front of the list */
+      s->sibling = p->kids;
+      p->kids = s;
+      return s;
+    }
+  }
+  if (p->nkids >= LUAI_MAXSHAPEKIDS)  /* too many variants of 'p'? */
+    return NULL;
+  s = cast(Shape *, luaM_malloc(L, sizeshape(p->nkeys + 1)));
+  s->parent = p;
+  s->kids = NULL;
+  s->refcount = 0;
+  s->nkeys = p->nkeys + 1;
+  s->nkids = 0;
+  for (i = 0; i < p->nkeys; i++)
+    s->keys[i] = p->keys[i];
+  s->keys[p->nkeys] = key;
+  s->sibling = p->kids;  /* link it into its parent */
+  p->kids = s;
+  p->nkids++;
+  p->refcount++;
+  return s;
+}
+
+
+typedef struct {
+  Table *t;
+  int n;
+} AuxgrowslotsT;
+
+
+static void auxgrowslots (lua_State *L, void *ud) {
+  AuxgrowslotsT *ags = cast(AuxgrowslotsT *, ud);
+  Table *t = ags->t;
+  luaM_reallocvector(L, t->slots, shapecap(ags->n), shapecap(ags->n + 1),
+                        TValue);
+}
+
+
+/*
+** try to add short string 'key' to the shape of table 't' (which has
+** no hash part). Returns the (nil) slot for the key's value or NULL
+** when the key does not fit in a shape.
+*/
+// 试着把短字符串key加入（没有hash部分的）表t的形状中。返回key对应的值的槽位，
+// 不能放入形状时返回NULL
+static TValue *shapenewkey (lua_State *L, Table *t, TString *key) {
+  Shape *old = t->shape;
+  int n = (old == NULL) ? 0 : old->nkeys;
+  Shape *s;
+  if (n >= LUAI_MAXSHAPEKEYS)  /* too many keys for a shape? */
+    return NULL;
+  s = getshape(L, (old == NULL) ? G(L)->shaperoot : old, key);
+  if (s == NULL)
+    return NULL;
+  if (shapecap(n + 1) > shapecap(n)) {  /* 'slots' must grow? */
+    AuxgrowslotsT ags;
+    ags.t = t; ags.n = n;
+    if (luaD_rawrunprotected(L, auxgrowslots, &ags) != LUA_OK) {
+      if (s->refcount == 0) {  /* shape was just created? */
+        s->refcount = 1;
+        releaseshape(L, s);  /* remove it */
+      }
+      luaD_throw(L, LUA_ERRMEM);  /* rethrow memory error */
+    }
+  }
+  s->refcount++;
+  t->shape = s;
+  if (old != NULL)
+    releaseshape(L, old);
+  setnilvalue(&t->slots[n]);
+  return &t->slots[n];
+}
+
+
+/* number of non-nil values in the shape of table 't' */
+static int numuseshape (const Table *t) {
+  int i;
+  int n = 0;
+  for (i = 0; i < shapesize(t); i++) {
+    if (!ttisnil(&t->slots[i]))
+      n++;
+  }
+  return n;
+}
+
+
+void luaH_initshapes (lua_State *L) {
+  Shape *root = cast(Shape *, luaM_malloc(L, sizeshape(0)));
+  root->parent = root->kids = root->sibling = NULL;
+  root->refcount = 1;  /* root is never released */
+  root->nkeys = root->nkids = 0;
+  G(L)->shaperoot = root;
+}
+
+
+void luaH_freeshapes (lua_State *L) {
+  Shape *root = G(L)->shaperoot;
+  if (root != NULL) {  /* state was fully built? */
+    lua_assert(root->kids == NULL);  /* freeing tables released all shapes */
+    luaM_freemem(L, root, sizeshape(0));
+    G(L)->shaperoot = NULL;
+  }
+}
+
+/* }============================================================= */
+
+
+
+/*
+** {=============================================================
+** Packed arrays
+** ==============================================================
+*/
+
+/*
+** if 'key' is an integer, or a float with an integral value, put it
+** in 'k' and return true
+*/
+static int intkey (const TValue *key, lua_Integer *k) {
+  if (ttisinteger(key)) {
+    *k = ivalue(key);
+    return 1;
+  }
+  else  /* ('luaV_tointeger' would convert strings, too) */
+    return (ttisfloat(key) && luaV_tointeger(key, k, 0));
+}
+
+
+/*
+** turn the packed array part of 't' into a plain one (for good)
+*/
+// 把表t的紧凑数组部分转换成普通的TValue数组（之后不再转换回去）
+static void unpack (lua_State *L, Table *t) {
+  unsigned int i, size = t->sizearray;
+  TValue *array = NULL;
+  lua_assert(ispacked(t));
+  if (size > 0) {
+    Value *p = packedarray(t);
+    array = luaM_newvector(L, size, TValue);
+    for (i = 0; i < t->npacked; i++) {
+      val_(&array[i]) = p[i];
+      settt_(&array[i], t->arraytag);
+    }
+    for (; i < size; i++)
+      setnilvalue(&array[i]);
+    luaM_freearray(L, p, packedalloc(size));
+  }
+  t->array = array;
+  t->arraytag = LUA_TNIL;
+  t->npacked = 0;
+}
+
+
+/*
+** Pack the plain array part of 't' for values with tag 'tag', if it is
+** empty. (A constructor creates its array part plain, as its values
+** are not known yet, and packs it when they turn out to be numbers:
+** shrinking the block costs less than growing it.)
+*/
+// 如果表t的普通数组部分是空的，把它转换成标签为tag的紧凑数组。（构造函数创建的数组部分是普通的，
+// 因为那时还不知道它的值，发现值是数字时再转换成紧凑的：缩小内存块比扩大它代价小）
+void luaH_packarray (lua_State *L, Table *t, int tag) {
+  unsigned int i, size = t->sizearray;
+  lua_assert(!ispacked(t) && (tag == LUA_TNUMINT || tag == LUA_TNUMFLT));
+  for (i = 0; i < size; i++) {
+    if (!ttisnil(&t->array[i]))
+      return;  /* not empty */
+  }
+  if (size > 0)
+    t->array = cast(TValue *, luaM_realloc_(L, t->array,
+                                            size * sizeof(TValue),
+                                            packedalloc(size) * sizeof(Value)));
+  t->arraytag = cast_byte(tag);
+}
+
+
+/*
+** Try to do 't[key] = v' in the packed array part of 't', with no
+** allocation: replace an element with one of the same type, append an
+** element after the last one (an empty array takes any number type),
+** or remove the last element. Returns 0 if that cannot be done.
+*/
+// 不分配内存，尝试在紧凑数组部分完成t[key] = v：用同类型的值替换一个元素、在最后一个元素之后追加
+// （空数组可以接受任意数字类型），或者删除最后一个元素。做不到时返回0
+static int packedset (Table *t, lua_Integer key, const TValue *v) {
+  lua_Unsigned i = l_castS2U(key) - 1u;
+  lua_assert(ispacked(t));
+  if (i < t->npacked) {  /* an element? */
+    if (rttype(v) == t->arraytag)
+      packedarray(t)[i] = val_(v);
+    else if (ttisnil(v) && i == t->npacked - 1)
+      t->npacked--;  /* removed the last one */
+    else
+      return 0;  /* would make a hole or mix types */
+  }
+  else if (i >= t->sizearray)
+    return 0;  /* not in the array part */
+  else if (ttisnil(v))
+    return 1;  /* nothing to remove */
+  else if (i == t->npacked &&
+           (rttype(v) == t->arraytag || (i == 0 && ttisnumber(v)))) {
+    t->arraytag = cast_byte(rttype(v));
+    packedarray(t)[t->npacked++] = val_(v);  /* append it */
+  }
+  else
+    return 0;
+  return 1;
+}
+
+
+static TValue *insertkey (lua_State *L, Table *t, const TValue *key);
+static void rehash (lua_State *L, Table *t, const TValue *ek);
+
+
+/*
+** 't[key] = value' for an integer key, keeping a packed array part
+** packed if the value fits in it
+*/
+static void setint (lua_State *L, Table *t, lua_Integer key,
+                                            TValue *value) {
+  const TValue *p;
+  TValue *cell;
+  if (ispacked(t)) {
+    if (packedset(t, key, value))
+      return;  /* done */
+    else if (l_castS2U(key) - 1u < t->sizearray)
+      unpack(L, t);  /* value must go to a plain array part */
+  }
+  p = luaH_getint(t, key);
+  if (p != luaO_nilobject)
+    cell = cast(TValue *, p);
+  else {
+    TValue k;
+    setivalue(&k, key);
+    cell = insertkey(L, t, &k);
+    if (cell == NULL) {  /* table must grow? */
+      /* (unlike 'luaH_newkey', do not go through 'luaH_set', which would
+         unpack an array part that the key now falls into) */
+      // 不像luaH_newkey那样通过luaH_set插入：键现在可能落在紧凑数组部分里，luaH_set会把它转成普通的
+      rehash(L, t, &k);
+      setint(L, t, key, value);
+      return;
+    }
+  }
+  setobj2t(L, cell, value);
+}
+
+
+/*
+** Move into the packed array part of 't' the integer keys of the old
+** hash part 'nold' (with 'size' nodes) that continue its elements,
+** when they do so with no holes and with the same number type.
+** 'pending', if not NULL, is the value of the next key, which the
+** caller is about to append. The hash part is re-inserted in node
+** order, not in key order, and a key stored past the end of the packed
+** elements would make the array part plain for good.
+*/
+// 把旧hash部分nold（size个节点）中接在表t紧凑元素之后的整数键移入紧凑数组部分，
+// 条件是它们没有空洞并且是同一种数字类型。pending不是NULL时是调用者接下来要追加的那个键的值。
+// hash部分按节点顺序而不是键的顺序重新插入，存到紧凑元素末尾之后的键会让数组部分永远变成普通的
+static void repack (Table *t, const Node *nold, int size,
+                    const TValue *pending) {
+  lua_Unsigned n = t->npacked;
+  lua_Unsigned count = 0, last = 0;
+  int tag = (n > 0) ? t->arraytag : LUA_TNIL;  /* (empty: any number) */
+  int j;
+  if (pending != NULL) {
+    if (tag == LUA_TNIL) tag = rttype(pending);
+    if (rttype(pending) != tag) return;
+    count = 1;  /* it is key 'n + 1' */
+    last = n + 1;
+  }
+  for (j = 0; j < size; j++) {  /* check the keys for the array part */
+    const Node *old = nold + j;
+    if (!ttisnil(gval(old)) && ttisinteger(gkey(old))) {
+      lua_Unsigned k = l_castS2U(ivalue(gkey(old)));
+      if (k - 1u - n < t->sizearray - n) {  /* n < k <= sizearray? */
+        if (tag == LUA_TNIL && ttisnumber(gval(old)))
+          tag = rttype(gval(old));
+        if (rttype(gval(old)) != tag)
+          return;  /* array part will be plain */
+        count++;
+        if (k > last) last = k;
+      }
+    }
+  }
+  if (count == 0 || last != n + count)
+    return;  /* nothing to move, or a hole */
+  for (j = 0; j < size; j++) {  /* move them */
+    const Node *old = nold + j;
+    if (!ttisnil(gval(old)) && ttisinteger(gkey(old))) {
+      lua_Unsigned k = l_castS2U(ivalue(gkey(old)));
+      if (k - 1u - n < t->sizearray - n)
+        packedarray(t)[k - 1] = val_(gval(old));
+    }
+  }
+  if (pending != NULL)
+    packedarray(t)[n] = val_(pending);
+  t->arraytag = cast_byte(tag);
+  t->npacked = cast(unsigned int, last);
+}
+
+/* }============================================================= */
+
+
 /*
 ** returns the index of a 'key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
@@ -175,6 +546,13 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   // 数组部分直接返回
   if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+  else if (isshape(t)) {  /* key must be in the shape */
+    int k = ttisshrstring(key) ? shapeindex(t->shape, tsvalue(key)) : -1;
+    if (k < 0)
+      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    /* shape elements are numbered after array ones */
+    return cast(unsigned int, k + 1) + t->sizearray;
+  }
   else {
     int nx;
 	// 取得在hash部分的索引
@@ -202,6 +580,15 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
 int luaH_next (lua_State *L, Table *t, StkId key) {
 	// 得到原始的key值的位置
   unsigned int i = findindex(L, t, key);  /* find original element */
+  if (ispacked(t)) {  /* array part has 'npacked' elements, then nils */
+    if (i < t->npacked) {
+      setivalue(key, i + 1);
+      getpacked(t, i + 1, key + 1);
+      return 1;
+    }
+    else if (i < t->sizearray)
+      i = t->sizearray;  /* skip the nils */
+  }
   for (; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
 		// key的位置赋值为 i + 1
@@ -211,6 +598,16 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       return 1;
     }
   }
+  if (isshape(t)) {  /* then the shape (there is no hash part) */
+    for (i -= t->sizearray; cast_int(i) < t->shape->nkeys; i++) {
+      if (!ttisnil(&t->slots[i])) {  /* a non-nil value? */
+        setsvalue2s(L, key, t->shape->keys[i]);
+        setobj2s(L, key+1, &t->slots[i]);
+        return 1;
+      }
+    }
+    return 0;  /* no more elements */
+  }
   // hash部分
   for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
@@ -304,7 +701,7 @@ static unsigned int numusearray (const Table *t, unsigned int *nums) {
     /* count elements in range (2^(lg - 1), 2^lg] */
 	// 计算(2^(lg - 1), 2^lg]的元素数目
     for (; i <= lim; i++) {
-      if (!ttisnil(&t->array[i-1]))
+      if (ispacked(t) ? i <= t->npacked : !ttisnil(&t->array[i-1]))
         lc++;
     }
     nums[lg] += lc;
@@ -334,10 +731,19 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
 // 设置表的数组部分
 static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
   unsigned int i;
-  luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
-  // 将新的那部分置为空
-  for (i=t->sizearray; i<size; i++)
-     setnilvalue(&t->array[i]);
+  if (ispacked(t)) {  /* (elements after 'npacked' are nil already) */
+    Value *p = packedarray(t);
+    lua_assert(t->npacked <= size);
+    luaM_reallocvector(L, p, packedalloc(t->sizearray), packedalloc(size),
+                          Value);
+    t->array = cast(TValue *, p);
+  }
+  else {
+    luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
+    // 将新的那部分置为空
+    for (i=t->sizearray; i<size; i++)
+       setnilvalue(&t->array[i]);
+  }
   t->sizearray = size;
 }
 
@@ -381,9 +787,15 @@ static void auxsetnode (lua_State *L, void *ud) {
   setnodevector(L, asn->t, asn->nhsize);
 }
 
-// 重新设置大小
-void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
-                                          unsigned int nhsize) {
+/*
+** 'pending', if not NULL, is the value for key 'npacked + 1' of a full
+** packed array part, which the caller will set once the array grows
+** (see 'repack' and 'luaH_setint')
+*/
+// 重新设置大小。pending不是NULL时是满的紧凑数组部分的键npacked + 1的值，
+// 调用者在数组增长后会设置它（见repack和luaH_setint）
+static void resize (lua_State *L, Table *t, unsigned int nasize,
+                    unsigned int nhsize, const TValue *pending) {
   unsigned int i;
   int j;
   AuxsetnodeT asn;
@@ -391,6 +803,10 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
   int oldhsize = allocsizenode(t);
   // 保存原来的hash节点
   Node *nold = t->node;  /* save old hash ... */
+  /* ... and the shape, unless it can stay (no other keys to hash) */
+  // 如果新的hash部分为空，表继续使用原来的形状，否则形状中的键也要放入新的hash部分
+  Shape *oldshape = (nhsize > 0) ? t->shape : NULL;
+  TValue *oldslots = t->slots;
   // 如果新的比旧的大，重新设置
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
@@ -400,32 +816,78 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
     setarrayvector(L, t, oldasize);  /* array back to its original size */
     luaD_throw(L, LUA_ERRMEM);  /* rethrow memory error */
   }
+  if (oldshape != NULL) {  /* shape keys will go to the new hash part */
+    t->shape = NULL;
+    t->slots = NULL;
+  }
   // 如果数组部分需要收缩
   if (nasize < oldasize) {  /* array part must shrink? */
     t->sizearray = nasize;
-    /* re-insert elements from vanishing slice */
-	// 将收缩的那一部分插入列表
-    for (i=nasize; i<oldasize; i++) {
-      if (!ttisnil(&t->array[i]))
-        luaH_setint(L, t, i + 1, &t->array[i]);
+    if (ispacked(t)) {
+      Value *p = packedarray(t);
+      unsigned int n = t->npacked;
+      if (n > nasize) {  /* re-insert elements from vanishing slice */
+        t->npacked = nasize;
+        for (i=nasize; i<n; i++) {
+          TValue v;
+          val_(&v) = p[i];
+          settt_(&v, t->arraytag);
+          setint(L, t, i + 1, &v);
+        }
+      }
+      luaM_reallocvector(L, p, packedalloc(oldasize), packedalloc(nasize),
+                            Value);
+      t->array = cast(TValue *, p);
+    }
+    else {
+      /* re-insert elements from vanishing slice */
+      // 将收缩的那一部分插入列表
+      for (i=nasize; i<oldasize; i++) {
+        if (!ttisnil(&t->array[i]))
+          luaH_setint(L, t, i + 1, &t->array[i]);
+      }
+      /* shrink array */
+      // 收缩数组部分
+      luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
     }
-    /* shrink array */
-	// 收缩数组部分
-    luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
   }
+  if (ispacked(t))  /* keys that continue the packed elements go first */
+    repack(t, nold, oldhsize, pending);
   /* re-insert elements from hash part */
-  // 重新插入hash部分的元素
+  // 重新插入hash部分的元素（已经移入紧凑数组的键只是再写一次同样的值）
   for (j = oldhsize - 1; j >= 0; j--) {
     Node *old = nold + j;
     if (!ttisnil(gval(old))) {
       /* doesn't need barrier/invalidate cache, as entry was
          already present in the table */
-      setobjt2t(L, luaH_set(L, t, gkey(old)), gval(old));
+      if (ttisinteger(gkey(old)))  /* may go to a packed array part */
+        setint(L, t, ivalue(gkey(old)), gval(old));
+      else
+        setobjt2t(L, luaH_set(L, t, gkey(old)), gval(old));
     }
   }
   // 如果原来有hash部分，将原来hash部分师傅掉
   if (oldhsize > 0)  /* not the dummy node? */
     luaM_freearray(L, nold, cast(size_t, oldhsize)); /* free old hash */
+  // 把形状中的键值放入新的hash部分，然后释放形状
+  if (oldshape != NULL) {  /* re-insert elements from the shape */
+    int k;
+    for (k = 0; k < oldshape->nkeys; k++) {
+      if (!ttisnil(&oldslots[k])) {
+        TValue key;
+        setsvalue(L, &key, oldshape->keys[k]);
+        setobjt2t(L, luaH_set(L, t, &key), &oldslots[k]);
+      }
+    }
+    luaM_freearray(L, oldslots, cast(size_t, shapecap(oldshape->nkeys)));
+    releaseshape(L, oldshape);
+  }
+}
+
+
+void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
+                                          unsigned int nhsize) {
+  resize(L, t, nasize, nhsize, NULL);
 }
 
 
@@ -434,6 +896,24 @@ void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   luaH_resize(L, t, nasize, nsize);
 }
 
+
+/*
+** Size a new table from the hints of a constructor (or of
+** 'lua_createtable'). A small hash part is not created in advance, as
+** short-string keys will go to a shape. The array part is plain.
+*/
+// 根据构造函数（或'lua_createtable'）的提示设置新表的大小。较小的hash部分不预先
+// 创建，因为短字符串键会放入形状中。数组部分是普通的
+void luaH_presize (lua_State *L, Table *t, unsigned int nasize,
+                                           unsigned int nhsize) {
+  if (nhsize <= LUAI_MAXSHAPEKEYS)
+    nhsize = 0;
+  if (nasize > 0 && ispacked(t))
+    unpack(L, t);  /* see 'luaH_packarray' (table is empty: no allocation) */
+  if (nasize > 0 || nhsize > 0)
+    luaH_resize(L, t, nasize, nhsize);
+}
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -443,6 +923,7 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   unsigned int nums[MAXABITS + 1];
   int i;
   int totaluse;
+  int shapeuse = numuseshape(t);  /* keys in the shape */
   // 重置计数，MAXABITS是31
   for (i = 0; i <= MAXABITS; i++) nums[i] = 0;  /* reset counts */
   // 计算数组部分的计数
@@ -450,6 +931,7 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   totaluse = na;  /* all those keys are integer keys */
   // 计算hash部分的键数
   totaluse += numusehash(t, nums, &na);  /* count keys in hash part */
+  totaluse += shapeuse;  /* (shape keys are strings, never array indices) */
   /* count extra key */
   // 计数传入的键
   na += countint(ek, nums);
@@ -459,7 +941,10 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   asize = computesizes(nums, &na);
   /* resize the table to new computed sizes */
   // 使用新的计算的尺寸来重置尺寸
-  luaH_resize(L, t, asize, totaluse - na);
+  if (isshape(t) && totaluse - na == cast(unsigned int, shapeuse))
+    luaH_resize(L, t, asize, 0);  /* only shape keys out of the array: keep it */
+  else
+    luaH_resize(L, t, asize, totaluse - na);
 }
 
 
@@ -476,6 +961,10 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  t->arraytag = LUA_TNUMINT;  /* start with an (empty) packed array part */
+  t->npacked = 0;
+  t->shape = NULL;
+  t->slots = NULL;
   setnodevector(L, t, 0);
   return t;
 }
@@ -484,7 +973,14 @@ Table *luaH_new (lua_State *L) {
 void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t))
     luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
-  luaM_freearray(L, t->array, t->sizearray);
+  if (ispacked(t))
+    luaM_freearray(L, packedarray(t), packedalloc(t->sizearray));
+  else
+    luaM_freearray(L, t->array, t->sizearray);
+  if (isshape(t)) {
+    luaM_freearray(L, t->slots, cast(size_t, shapecap(t->shape->nkeys)));
+    releaseshape(L, t->shape);
+  }
   luaM_free(L, t);
 }
 
@@ -503,29 +999,13 @@ static Node *getfreepos (Table *t) {
 
 
 /*
-** inserts a new key into a hash table; first, check whether key's main
-** position is free. If not, check whether colliding node is in its main
-** position or not: if it is not, move colliding node to an empty place and
-** put new key in its main position; otherwise (colliding node is in its main
-** position), new key goes to an empty position.
+** insert new key 'key' (not nil, NaN, nor a float with an integer
+** value) into the hash part of 't'; returns NULL when there is no free
+** position for it and the table must grow
 */
-// 在hash表里面插入一个新的键，首先：检查键的主位置是否空缺，如果不是，
-// 检查碰撞节点是否在主位置，如果不是，将碰撞节点移动到一个空的位置并将新的键
-// 放到它的主位置，否则（碰撞节点在它的主位置），新的键就到一个空位置
-TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
+// 把新键key（不是nil、NaN或者有整数值的浮点数）插入表t的hash部分，没有空位置时返回NULL，表需要增长
+static TValue *insertkey (lua_State *L, Table *t, const TValue *key) {
   Node *mp;
-  TValue aux;
-  if (ttisnil(key)) luaG_runerror(L, "table index is nil");
-  else if (ttisfloat(key)) {
-    lua_Integer k;
-	// 浮点转换成整型
-    if (luaV_tointeger(key, &k, 0)) {  /* does index fit in an integer? */
-      setivalue(&aux, k);
-      key = &aux;  /* insert it as an integer */
-    }
-    else if (luai_numisnan(fltvalue(key)))
-      luaG_runerror(L, "table index is NaN");
-  }
   // 主位置
   mp = mainposition(t, key);
   // 主位置已经备用了
@@ -534,12 +1014,8 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
 	// 得到最后一个空的位置
     Node *f = getfreepos(t);  /* get a free place */
 	// 没有空的位置了
-    if (f == NULL) {  /* cannot find a free place? */
-		// 重新计算大小
-      rehash(L, t, key);  /* grow table */
-      /* whatever called 'newkey' takes care of TM cache */
-      return luaH_set(L, t, key);  /* insert key into grown table */
-    }
+    if (f == NULL)  /* cannot find a free place? */
+      return NULL;
     lua_assert(!isdummy(t));
 	// 现在主位置的这个节点重新计算主位置，如果主位置不在这里吗，就将它移走
     othern = mainposition(t, gkey(mp));
@@ -579,14 +1055,67 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
 
 
 /*
-** search function for integers
+** inserts a new key into a hash table; first, check whether key's main
+** position is free. If not, check whether colliding node is in its main
+** position or not: if it is not, move colliding node to an empty place and
+** put new key in its main position; otherwise (colliding node is in its main
+** position), new key goes to an empty position.
 */
-// 得到整形的值
+// 在hash表里面插入一个新的键，首先：检查键的主位置是否空缺，如果不是，
+// 检查碰撞节点是否在主位置，如果不是，将碰撞节点移动到一个空的位置并将新的键
+// 放到它的主位置，否则（碰撞节点在它的主位置），新的键就到一个空位置
+TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
+  TValue *slot;
+  TValue aux;
+  if (ttisnil(key)) luaG_runerror(L, "table index is nil");
+  else if (ttisfloat(key)) {
+    lua_Integer k;
+	// 浮点转换成整型
+    if (luaV_tointeger(key, &k, 0)) {  /* does index fit in an integer? */
+      setivalue(&aux, k);
+      key = &aux;  /* insert it as an integer */
+    }
+    else if (luai_numisnan(fltvalue(key)))
+      luaG_runerror(L, "table index is NaN");
+  }
+  // 没有hash部分的表，短字符串键优先放入形状
+  else if (ttisshrstring(key) && isdummy(t)) {  /* no hash part? */
+    slot = shapenewkey(L, t, tsvalue(key));
+    if (slot != NULL) {  /* key went to the shape? */
+      luaC_barrierback(L, t, key);
+      return slot;
+    }
+  }
+  slot = insertkey(L, t, key);
+  if (slot == NULL) {  /* no free place? */
+	// 重新计算大小
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
+  }
+  return slot;
+}
+
+
+/*
+** search function for integers (an element of a packed array part
+** comes in the cell of 't', good until the next read)
+*/
+// 得到整形的值（紧凑数组部分的元素放在表t的单元中返回，在下一次读取之前有效）
 const TValue *luaH_getint (Table *t, lua_Integer key) {
   /* (1 <= key && key <= t->sizearray) */
 	// 是否是数组部分
-  if (l_castS2U(key) - 1 < t->sizearray)
-    return &t->array[key - 1];
+  if (l_castS2U(key) - 1 < t->sizearray) {
+    if (!ispacked(t))
+      return &t->array[key - 1];
+    else if (inpacked(t, key)) {  /* copy it to the cell */
+      TValue *cell = packedcell(t);
+      getpacked(t, key, cell);
+      return cell;
+    }
+    else
+      return luaO_nilobject;  /* (a packed array part has no nil slots) */
+  }
   else {
 	  // 找到桶位
     Node *n = hashint(t, key);
@@ -609,8 +1138,13 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 */
 // 搜索短字符对应的函数
 const TValue *luaH_getshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
   lua_assert(key->tt == LUA_TSHRSTR);
+  if (isshape(t)) {  /* keys are in the shape? */
+    int i = shapeindex(t->shape, key);
+    return (i < 0) ? luaO_nilobject : &t->slots[i];
+  }
+  n = hashstr(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     const TValue *k = gkey(n);
     if (ttisshrstring(k) && eqshrstr(tsvalue(k), key))
@@ -625,6 +1159,29 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 }
 
 
+/*
+** slow path of 'luaH_getcached', called after inline cache 'ic' of
+** the instruction doing the access missed: searches short string
+** 'key' and, when it is found, updates the cache with its position
+*/
+// luaH_getcached的慢路径，在指令的内联缓存没有命中后调用：搜索短字符串，找到时更新缓存
+const TValue *luaH_getcachemiss (Table *t, TString *key, InlineCache *ic) {
+  const TValue *slot = luaH_getshortstr(t, key);
+  if (slot == luaO_nilobject)
+    return slot;  /* not found; nothing to remember */
+  else if (isshape(t)) {  /* remember the shape and the key index in it */
+    ic->owner = t->shape;
+    ic->slot = cast_int(slot - t->slots);
+  }
+  else {  /* remember the node array and the key index in it */
+    ic->owner = t->node;
+    ic->slot = cast_int(cast(const Node *, cast(const char *, slot) -
+                                           offsetof(Node, i_val)) - t->node);
+  }
+  return slot;
+}
+
+
 /*
 ** "Generic" get version. (Not that generic: not valid for integers,
 ** which may be in array part, nor for floats with integral values.)
@@ -660,9 +1217,10 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 
 
 /*
-** main search function
+** main search function (see 'luaH_getint' for the elements of a packed
+** array part)
 */
-// 主要的搜索函数
+// 主要的搜索函数（紧凑数组部分的元素见luaH_getint）
 const TValue *luaH_get (Table *t, const TValue *key) {
   switch (ttype(key)) {
 	  // 短字符串
@@ -692,30 +1250,59 @@ const TValue *luaH_get (Table *t, const TValue *key) {
 */
 // 注意：使用此功能时，您可能需要检查GC屏障并使TM缓存无效
 TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
+  const TValue *p;
+  lua_Integer k;
+  // 紧凑数组部分没有可以返回的槽位，需要先转换成普通数组
+  if (ispacked(t) && intkey(key, &k) && l_castS2U(k) - 1u < t->sizearray)
+    unpack(L, t);  /* a packed array part has no slot to return */
   // 如果已经有键，使用键的值
-  const TValue *p = luaH_get(t, key);
+  p = luaH_get(t, key);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   // 创建新的键的值
   else return luaH_newkey(L, t, key);
 }
 
-// 设置键值为整数的值
-void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
-  // 得到键值为整数的值
-  const TValue *p = luaH_getint(t, key);
-  TValue *cell;
-  // 找到
-  if (p != luaO_nilobject)
-    cell = cast(TValue *, p);
+
+/*
+** Finish a raw assignment 't[key] = value', given 'slot', the result
+** of a 'luaH_get' for 'key'. An integer key of a table with a packed
+** array part goes through 'luaH_setint', which keeps it packed if it
+** can.
+*/
+// 完成原始赋值t[key] = value，slot是用key调用luaH_get的结果。数组部分紧凑的表的整数键
+// 交给luaH_setint，尽量保持紧凑
+void luaH_finishset (lua_State *L, Table *t, const TValue *key,
+                     const TValue *slot, TValue *value) {
+  lua_Integer k;
+  if (ispacked(t) && (slot == luaO_nilobject || ispackedcell(t, slot)) &&
+      intkey(key, &k)) {
+    checkcell(t, k, slot);
+    luaH_setint(L, t, k, value);
+  }
   else {
-	// 没找到插入一个新值
-    TValue k;
-    setivalue(&k, key);
-    cell = luaH_newkey(L, t, &k);
+    if (slot == luaO_nilobject)  /* no previous entry? */
+      slot = luaH_newkey(L, t, key);  /* create one */
+    setobj2t(L, cast(TValue *, slot), value);
   }
-  // 设置对应的值
-  setobj2t(L, cell, value);
+}
+
+
+/*
+** Set the value of an integer key. An append to a full packed array
+** part doubles it, so that it goes on packed (instead of putting the
+** new element in the hash part, as other keys out of the array part);
+** keys of the hash part that follow it move to the array with it.
+*/
+// 设置键值为整数的值。在满的紧凑数组部分后面追加时把它加倍，让它保持紧凑
+// （而不是像数组部分之外的其他键一样把新元素放到hash部分），hash部分中紧接在它后面的键也一起移入数组
+void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
+  unsigned int size = t->sizearray;
+  if (ispacked(t) && t->npacked == size && l_castS2U(key) == size + 1u &&
+      size <= MAXASIZE / 2 &&
+      (rttype(value) == t->arraytag || (size == 0 && ttisnumber(value))))
+    resize(L, t, (size > 0) ? size * 2 : 1, allocsizenode(t), value);
+  setint(L, t, key, value);
 }
 
 
@@ -752,7 +1339,11 @@ static lua_Unsigned unbound_search (Table *t, lua_Unsigned j) {
 // 尝试找到表t的边界，一个表的边界是指一个整数索引使得t[i]是非nil而t[i+1]是nil(如果t[1]是nil的话为0）
 lua_Unsigned luaH_getn (Table *t) {
   unsigned int j = t->sizearray;
-  if (j > 0 && ttisnil(&t->array[j - 1])) {
+  if (ispacked(t)) {
+    if (t->npacked < j)  /* are there nils after the elements? */
+      return t->npacked;
+  }
+  else if (j > 0 && ttisnil(&t->array[j - 1])) {
 	 // 在数组部分找边界（二分法搜索）
     /* there is a boundary in the array part: (binary) search for it */
     unsigned int i = 0;
@@ -765,7 +1356,7 @@ lua_Unsigned luaH_getn (Table *t) {
   }
   /* else must find a boundary in hash part */
   // hash部分是否为空
-  else if (isdummy(t))  /* hash part is empty? */
+  if (isdummy(t))  /* hash part is empty? */
     return j;  /* that is easy... */
   else return unbound_search(t, j);
 }
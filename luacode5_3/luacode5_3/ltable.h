@@ -38,25 +38,137 @@
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
-/* returns the key, given the value of a table entry */
+/* true when 't' keeps its (short string) keys in a shape */
+// Ƿʹ״
+#define isshape(t)		((t)->shape != NULL)
+
+/* number of slots allocated for a shape with 'n' keys */
+// n״ҪslotsĿ4һ
+#define shapecap(n)		(((n) + 3) & ~3)
+
+/* number of keys in the shape of 't' (0 when it has none) */
+#define shapesize(t)	(isshape(t) ? (t)->shape->nkeys : 0)
+
+
+/*
+** An array part holding only integers, or only floats, is kept packed:
+** just the values, all of them with tag 'arraytag'. Its first 'npacked'
+** elements are present and the others are nil. A store that does not
+** fit turns it into a plain array of TValues ('arraytag' LUA_TNIL and
+** 'npacked' 0), and it stays plain. As packed elements have no TValue
+** of their own, 'luaH_getint' and 'luaH_get' return them in a cell
+** after the values, which is only good until the next read of the
+** table: copy it, or use it, before reading again. When the array part
+** grows, the integer keys of the hash part that continue the elements
+** move into it, so filling it out of order does not make it plain
+** unless the array part has to grow over a missing key.
+*/
+// ֻֻŸ鲿ʹýմ洢ֵֻǩarraytag
+// ǰnpackedԪشڣΪnilŲȥдͨTValue
+// arraytagΪLUA_TNILnpackedΪ0֮һֱͨ顣ԪûԼTValue
+// luaH_getintluaH_getǸƵֵһԪзأֻһζȡ֮ǰЧ
+// ٴζȡ֮ǰҪƻõ鲿ʱhashнԪغƽ
+// ֻҪҪ鲿ȱٵļͲͨ
+#define ispacked(t)		((t)->arraytag != LUA_TNIL)
+#define packedarray(t)	cast(Value *, (t)->array)
+
+/* number of 'Value's in the cell of a packed array part */
+#define PACKEDCELL	((sizeof(TValue) + sizeof(Value) - 1) / sizeof(Value))
+
+/* number of 'Value's allocated for a packed array part of size 'n' */
+#define packedalloc(n)	((n) > 0 ? (n) + PACKEDCELL : 0)
+
+#define packedcell(t)	cast(TValue *, packedarray(t) + (t)->sizearray)
+
+/* true if 'o', returned by a 'luaH_get*', is the cell of table 't' */
+#define ispackedcell(t,o)	((t)->npacked > 0 && (o) == packedcell(t))
+
+/*
+** check that the cell 'o' returned for key 'k' still holds t[k], that
+** is, that no read of another element has reused it in between
+*/
+// ΪkصĵԪoȻt[k]Ҳ˵ڼûбĶȡ
+#define checkcell(t,k,o) \
+  lua_assert(!ispackedcell(t,o) || (inpacked(t,k) && \
+    rttype(o) == (t)->arraytag && \
+    memcmp(&val_(o), &packedarray(t)[(k) - 1], sizeof(Value)) == 0))
+
+/* true if integer key 'k' is an element of a packed array part */
+#define inpacked(t,k)	(l_castS2U(k) - 1u < (t)->npacked)
+
+/* 'o' = t[k], for 'k' in a packed array part */
+#define getpacked(t,k,o) \
+  { TValue *io_=(o); const Table *t_=(t); \
+    val_(io_) = packedarray(t_)[(k) - 1]; settt_(io_, t_->arraytag); }
+
+/* t[k] = v, if 'k' is in a packed array part and 'v' has its type */
+#define fastsetpacked(t,k,v) \
+  (inpacked(t,k) && rttype(v) == (t)->arraytag && \
+   (packedarray(t)[(k) - 1] = val_(v), 1))
+
+/* number of TValues in the array part of 't' (none if it is packed) */
+#define sizeplain(t)	(ispacked(t) ? 0 : (t)->sizearray)
+
+
+/*
+** true when the inline cache 'ic' still describes where short string
+** 'key' lives in table 't': same shape (or node array) and the slot
+** still holds that key
+*/
+// Уʹûм¼״hash֣Ҽ¼ĲλȻ
+#define icachehit(t,key,ic) \
+  (isshape(t) ? \
+   ((ic)->owner == (t)->shape && (ic)->slot < (t)->shape->nkeys && \
+    (t)->shape->keys[(ic)->slot] == (key)) : \
+   ((ic)->owner == (t)->node && (ic)->slot < sizenode(t) && \
+    ttisshrstring(gkey(gnode(t, (ic)->slot))) && \
+    tsvalue(gkey(gnode(t, (ic)->slot))) == (key)))
+
+/* value of a hit in inline cache 'ic' */
+#define icacheval(t,ic) \
+  (isshape(t) ? &(t)->slots[(ic)->slot] : gval(gnode(t, (ic)->slot)))
+
+/*
+** get of short string 'key' through inline cache 'ic': a hit is
+** resolved inline; only a miss calls 'luaH_getcachemiss'
+*/
+// ͨicȡַkeyֵʱֱõûвŵluaH_getcachemiss
+#define luaH_getcached(t,key,ic) \
+  (icachehit(t,key,ic) ? icacheval(t,ic) : luaH_getcachemiss(t,key,ic))
+
+
+/*
+** returns the key, given the value of a table entry (in the hash part;
+** values in a shape have no node)
+*/
 #define keyfromval(v) \
   (gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
 
 
+/* (results of 'luaH_getint' and 'luaH_get' may be the cell of 't') */
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 // ַӦĺ
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getcachemiss (Table *t, TString *key,
+                                           InlineCache *ic);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
+LUAI_FUNC void luaH_finishset (lua_State *L, Table *t, const TValue *key,
+                                const TValue *slot, TValue *value);
 LUAI_FUNC Table *luaH_new (lua_State *L);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
+LUAI_FUNC void luaH_packarray (lua_State *L, Table *t, int tag);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC void luaH_presize (lua_State *L, Table *t, unsigned int nasize,
+                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
+LUAI_FUNC void luaH_initshapes (lua_State *L);
+LUAI_FUNC void luaH_freeshapes (lua_State *L);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
 
@@ -248,6 +248,8 @@ LUA_API void        (lua_pushnumber) (lua_State *L, lua_Number n);
 LUA_API void        (lua_pushinteger) (lua_State *L, lua_Integer n);
 LUA_API const char *(lua_pushlstring) (lua_State *L, const char *s, size_t len);
 LUA_API const char *(lua_pushstring) (lua_State *L, const char *s);
+LUA_API const char *(lua_pushexternalstring) (lua_State *L, const char *s,
+                                  size_t len, lua_Alloc frel, void *ud);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
 LUA_API const char *(lua_pushfstring) (lua_State *L, const char *fmt, ...);
@@ -332,6 +334,13 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCSETMINORMUL	12
+#define LUA_GCSETMAJORMUL	13
+#define LUA_GCSTEPTIME		14
+#define LUA_GCBGFREE		15
+#define LUA_GCSETMARKTHREADS	16
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
@@ -351,6 +360,7 @@ LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void      (lua_setallocsafe) (lua_State *L, int safe);
 
 
 
@@ -103,7 +103,7 @@ static TString *LoadString (LoadState *S) {
   // ַ
   else {  /* long string */
     TString *ts = luaS_createlngstrobj(S->L, size);
-    LoadVector(S, getstr(ts), size);  /* load directly in final place */
+    LoadVector(S, getlngstr(ts), size);  /* load directly in final place */
     return ts;
   }
 }
@@ -116,6 +116,8 @@ static void LoadCode (LoadState *S, Proto *f) {
   f->code = luaM_newvector(S->L, n, Instruction);
   f->sizecode = n;
   LoadVector(S, f->code, n);
+  // ָ
+  luaF_initicache(S->L, f);
 }
 
 
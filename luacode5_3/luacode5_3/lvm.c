@@ -36,6 +36,21 @@
 #define MAXTAGLOOP	2000
 
 
+/*
+** By default, use jump tables in the main interpreter loop on gcc
+** and compatible compilers.
+*/
+// 默认在gcc及兼容的编译器（clang）上，解释器主循环使用跳转表分发指令，
+// 其他编译器（如MSVC）使用switch
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
 
 /*
 ** 'l_intfitsf' checks whether a given integer can be converted to a
@@ -262,15 +277,19 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
     const TValue *tm;  /* '__newindex' metamethod */
     if (slot != NULL) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
+      // 紧凑数组部分中已有的元素，不需要元方法
+      if (ispackedcell(h, slot)) {  /* element of a packed array part? */
+        luaH_finishset(L, h, key, slot, val);
+        luaC_barrierback(L, h, val);
+        return;
+      }
       lua_assert(ttisnil(slot));  /* old value must be nil */
 	  // 直接取原表
       tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
 	  // 如果没有元方法也就不需要尝试元方法了，直接创建一个条目
       if (tm == NULL) {  /* no metamethod? */
-        if (slot == luaO_nilobject)  /* no previous entry? */
-          slot = luaH_newkey(L, h, key);  /* create one */
-        /* no metamethod and (now) there is an entry with given key */
-        setobj2t(L, cast(TValue *, slot), val);  /* set its new value */
+        /* create the entry, if needed, and set its new value */
+        luaH_finishset(L, h, key, slot, val);
         invalidateTMcache(h);
         luaC_barrierback(L, h, val);
         return;
@@ -630,7 +649,7 @@ void luaV_concat (lua_State *L, int total) {
       }
       else {  /* long string; copy strings directly to final result */
         ts = luaS_createlngstrobj(L, tl);
-        copy2buff(top, n, getstr(ts));
+        copy2buff(top, n, getlngstr(ts));
       }
       setsvalue2s(L, top - n, ts);  /* create result */
     }
@@ -932,17 +951,41 @@ void luaV_finishOp (lua_State *L) {
 
 /*
 ** copy of 'luaV_gettable', but protecting the call to potential
-** metamethod (which can reallocate the stack)
+** metamethod (which can reallocate the stack); elements of a packed
+** array part are read directly
 */
+// luaV_gettable的副本，但是保护了可能的元方法调用（它可能重新分配栈）；紧凑数组部分的元素直接读取
 #define gettableProtected(L,t,k,v)  { const TValue *slot; \
-  if (luaV_fastget(L,t,k,slot,luaH_get)) { setobj2s(L, v, slot); } \
+  if (ttisinteger(k) && ttistable(t) && inpacked(hvalue(t), ivalue(k))) \
+    getpacked(hvalue(t), ivalue(k), v) \
+  else if (luaV_fastget(L,t,k,slot,luaH_get)) { setobj2s(L, v, slot); } \
   else Protect(luaV_finishget(L,t,k,v,slot)); }
 
 
+/*
+** version of 'gettableProtected' for instructions whose key is a
+** constant: a short-string key goes through the inline cache of the
+** current instruction
+*/
+// 键是常量的'gettableProtected'，短字符串键使用当前指令的内联缓存
+#define gettableCached(L,t,k,v)  { const TValue *slot; \
+  if (ttisshrstring(k) && ttistable(t)) { \
+    InlineCache *ic = cl->p->icache + pcRel(ci->u.l.savedpc, cl->p); \
+    Table *h = hvalue(t); \
+    slot = luaH_getcached(h, tsvalue(k), ic); \
+    if (!ttisnil(slot)) { setobj2s(L, v, slot); } \
+    else Protect(luaV_finishget(L,t,k,v,slot)); \
+  } \
+  else gettableProtected(L,t,k,v) }
+
+
 /* same for 'luaV_settable' */
 // 
 #define settableProtected(L,t,k,v) { const TValue *slot; \
-  if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
+  if (ttisinteger(k) && ttistable(t) && \
+      fastsetpacked(hvalue(t), ivalue(k), v)) \
+    { /* done */ } \
+  else if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
     Protect(luaV_finishset(L,t,k,v,slot)); }
 
 
@@ -952,6 +995,9 @@ void luaV_execute (lua_State *L) {
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
   // 帧改变时的重入点（调用/返回）
  newframe:  /* reentry point when frame changes (call/return) */
@@ -1031,7 +1077,10 @@ void luaV_execute (lua_State *L) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v;
         // 将指令C参数作为Key
         TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        if (ISK(GETARG_C(i)))
+          gettableCached(L, upval, rc, ra)
+        else
+          gettableProtected(L, upval, rc, ra)
         vmbreak;
       }
       // R(A) := R(B)[RK(C)]		
@@ -1040,7 +1089,10 @@ void luaV_execute (lua_State *L) {
         StkId rb = RB(i);
         // C参数为key
         TValue *rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+        if (ISK(GETARG_C(i)))
+          gettableCached(L, rb, rc, ra)
+        else
+          gettableProtected(L, rb, rc, ra)
         vmbreak;
       }
       // UpValue[A][RK(B)] := RK(C)
@@ -1083,7 +1135,7 @@ void luaV_execute (lua_State *L) {
         sethvalue(L, ra, t);
         // 重新设置大小
         if (b != 0 || c != 0)
-          luaH_resize(L, t, luaO_fb2int(b), luaO_fb2int(c));
+          luaH_presize(L, t, luaO_fb2int(b), luaO_fb2int(c));
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -1102,7 +1154,15 @@ void luaV_execute (lua_State *L) {
         // rb就是表，将ra+1赋值为表
         setobjs2s(L, ra + 1, rb);
         //  参数B取出的寄存器是table,参数C取出来的当key,取出来的值设置到A指向的寄存器
-        if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
+        // 常量短字符串键（通常的方法名）使用内联缓存
+        if (ISK(GETARG_C(i)) && key->tt == LUA_TSHRSTR && ttistable(rb)) {
+          InlineCache *ic = cl->p->icache + pcRel(ci->u.l.savedpc, cl->p);
+          Table *h = hvalue(rb);
+          aux = luaH_getcached(h, key, ic);
+          if (!ttisnil(aux)) { setobj2s(L, ra, aux); }
+          else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        }
+        else if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
           // ra是表里面通过索引取出来的值，如果是函数的话，就会出现，
           // ra是函数，ra+1是表，如果出现函数调用，那表就是函数的第一个参数
           setobj2s(L, ra, aux);
@@ -1657,6 +1717,7 @@ void luaV_execute (lua_State *L) {
         int n = GETARG_B(i);
         // rc为FPF（也就是前面提到的LFIELDS_PER_FLUSH常量）索引，即每次写入最多是LFIELDS_PER_FLUSH
         int c = GETARG_C(i);
+        int j;
         unsigned int last;
         Table *h;
         // 如果rb为零，直接取栈顶到ra的数目
@@ -1668,15 +1729,19 @@ void luaV_execute (lua_State *L) {
         }
         // 从ra取出表
         h = hvalue(ra);
+        // 构造函数的第一批值是数字时，把（还是空的）数组部分转换成紧凑的
+        if (c == 1 && n > 0 && ttisnumber(ra + 1) && !ispacked(h))
+          luaH_packarray(L, h, rttype(ra + 1));  /* a list of numbers? */
         // 得到最后需要设置得项
         last = ((c-1)*LFIELDS_PER_FLUSH) + n;
         // 需要更大得空间
         if (last > h->sizearray)  /* needs more space? */
           luaH_resizearray(L, h, last);  /* preallocate it at once */
-        // 将值写入
-        for (; n > 0; n--) {
-          TValue *val = ra+n;
-          luaH_setint(L, h, last--, val);
+        // 按顺序写入值，紧凑的数组部分只接受追加
+        last -= n;  /* in order, as a packed array part only takes appends */
+        for (j = 1; j <= n; j++) {
+          TValue *val = ra+j;
+          luaH_setint(L, h, last + j, val);
           luaC_barrierback(L, h, val);
         }
         // 修正堆栈
@@ -55,11 +55,12 @@
 ** return 1 with 'slot' pointing to 't[k]' (final result).  Otherwise,
 ** return 0 (meaning it will have to check metamethod) with 'slot'
 ** pointing to a nil 't[k]' (if 't' is a table) or NULL (otherwise).
-** 'f' is the raw get function to use.
+** 'f' is the raw get function to use. 'slot' may be the cell of a
+** packed array part (see 'ltable.h'): use it before the next read.
 */
 // ٻȡԪ(gettable)'t'һtable't[k]'nil,return 1slotָ't[k]'
 // ߷0ζŻȥԪ'slot'ָһnil't[k]''t'һtable)NULL
-// 'f'Ϊһԭʼĺȡֵ
+// 'f'Ϊһԭʼĺȡֵslotǽ鲿ֵĵԪltable.hҪһζȡ֮ǰõ
 // ܵ˵tһtable,t[k]ڵĻ1򷵻0ttablettableǲt[k])
 #define luaV_fastget(L,t,k,slot,f) \
   (!ttistable(t)  \
@@ -84,16 +85,18 @@
 ** return false with 'slot' equal to NULL (if 't' is not a table) or
 ** 'nil'. (This is needed by 'luaV_finishget'.) Note that, if the macro
 ** returns true, there is no need to 'invalidateTMcache', because the
-** call is not creating a new entry.
+** call is not creating a new entry. An element of a packed array part
+** (returned in its cell) is left to 'luaV_finishset', too.
 */
 // tabletǸtablet[k]nilĻʾԭֵGC barrierȻֱӽt[k]=vҷtrue
 // ttablefalseslotֵNULLttalbet[k]nil,ͽslotֵnilfalse
 // ע⣺귵trueʾҪinvalidateTMcacheΪεòҪһµĿ
+// 鲿ֵԪأ䵥ԪзأҲluaV_finishset
 #define luaV_fastset(L,t,k,slot,f,v) \
   (!ttistable(t) \
    ? (slot = NULL, 0) \
    : (slot = f(hvalue(t), k), \
-     ttisnil(slot) ? 0 \
+     ttisnil(slot) || ispackedcell(hvalue(t), slot) ? 0 \
      : (luaC_barrierback(L, hvalue(t), v), \
         setobj2t(L, cast(TValue *,slot), v), \
         1)))
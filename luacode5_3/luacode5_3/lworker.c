@@ -0,0 +1,420 @@
+/*
+** $Id: lworker.c $
+** Helper threads for the garbage collector
+** See Copyright Notice in lua.h
+*/
+
+#define lworker_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+
+#include "lua.h"
+
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lworker.h"
+
+
+/*
+** {======================================================
+** Thread primitives
+** =======================================================
+*/
+
+#if defined(LUA_USE_WINDOWS)	/* { */
+
+#include <windows.h>
+
+typedef HANDLE l_thread;
+typedef CRITICAL_SECTION l_mutex;
+typedef CONDITION_VARIABLE l_cond;
+
+#define l_threadfunc(f,a)	static DWORD WINAPI f (LPVOID a)
+#define l_threadret		return 0
+#define l_threadcreate(t,f,a)  \
+	((*(t) = CreateThread(NULL, 0, f, a, 0, NULL)) != NULL)
+#define l_threadjoin(t)  \
+	(WaitForSingleObject(t, INFINITE), CloseHandle(t))
+#define l_mutexinit(m)		InitializeCriticalSection(m)
+#define l_mutexdestroy(m)	DeleteCriticalSection(m)
+#define l_lock(m)		EnterCriticalSection(m)
+#define l_unlock(m)		LeaveCriticalSection(m)
+#define l_condinit(c)		InitializeConditionVariable(c)
+#define l_conddestroy(c)	((void)0)
+#define l_condwait(c,m)		SleepConditionVariableCS(c, m, INFINITE)
+#define l_condsignal(c)		WakeConditionVariable(c)
+#define l_condbroadcast(c)	WakeAllConditionVariable(c)
+
+#elif defined(LUA_USE_POSIX)	/* }{ */
+
+#include <pthread.h>
+
+typedef pthread_t l_thread;
+typedef pthread_mutex_t l_mutex;
+typedef pthread_cond_t l_cond;
+
+#define l_threadfunc(f,a)	static void *f (void *a)
+#define l_threadret		return NULL
+#define l_threadcreate(t,f,a)	(pthread_create(t, NULL, f, a) == 0)
+#define l_threadjoin(t)		pthread_join(t, NULL)
+#define l_mutexinit(m)		pthread_mutex_init(m, NULL)
+#define l_mutexdestroy(m)	pthread_mutex_destroy(m)
+#define l_lock(m)		pthread_mutex_lock(m)
+#define l_unlock(m)		pthread_mutex_unlock(m)
+#define l_condinit(c)		pthread_cond_init(c, NULL)
+#define l_conddestroy(c)	pthread_cond_destroy(c)
+#define l_condwait(c,m)		pthread_cond_wait(c, m)
+#define l_condsignal(c)		pthread_cond_signal(c)
+#define l_condbroadcast(c)	pthread_cond_broadcast(c)
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Parallel tasks
+** =======================================================
+*/
+
+#if defined(LUAI_HASTHREADS)	/* { */
+
+/*
+** Threads of a task share work through a list of chunks. A thread
+** with nothing to do waits in 'luaW_take'; when all threads are
+** waiting and there are no chunks, the task is over.
+*/
+// 任务的线程通过块链表共享工作。没事做的线程在luaW_take中等待；
+// 所有线程都在等待并且没有块时，任务就结束了
+struct WorkGroup {
+  l_mutex lock;
+  l_cond cond;
+  WorkChunk *chunks;  /* shared work */
+  int nworkers;  /* number of threads in the task */
+  int nidle;  /* number of threads waiting for work */
+  luaW_Task task;
+  void *ud;
+};
+
+
+typedef struct Worker {
+  WorkGroup *wg;
+  int id;
+  l_thread thread;
+} Worker;
+
+
+l_threadfunc(taskworker, arg) {
+  Worker *w = (Worker *)arg;
+  (*w->wg->task)(w->wg, w->wg->ud, w->id);
+  l_threadret;
+}
+
+
+/*
+** Run 'task' in 'nthreads' threads (the caller and up to 'nthreads - 1'
+** helpers) and wait for all of them. Returns the number of threads
+** that actually ran the task (fewer if some could not be created).
+*/
+// 在nthreads个线程中（调用者自己和最多nthreads-1个辅助线程）执行task并等待它们全部结束，
+// 返回实际执行任务的线程数（有些线程创建失败时会少一些）
+int luaW_runparallel (lua_State *L, int nthreads, luaW_Task task,
+                      void *ud) {
+  WorkGroup wg;
+  Worker w[LUAI_MAXWORKERS];
+  int i, n = 0;
+  UNUSED(L);
+  if (nthreads > LUAI_MAXWORKERS)
+    nthreads = LUAI_MAXWORKERS;
+  l_mutexinit(&wg.lock);
+  l_condinit(&wg.cond);
+  wg.chunks = NULL;
+  wg.nidle = 0;
+  wg.task = task;
+  wg.ud = ud;
+  l_lock(&wg.lock);  /* helpers cannot finish before 'nworkers' is set */
+  for (i = 1; i < nthreads; i++) {
+    w[n].wg = &wg;
+    w[n].id = n + 1;
+    if (l_threadcreate(&w[n].thread, taskworker, &w[n]))
+      n++;
+  }
+  wg.nworkers = n + 1;
+  l_unlock(&wg.lock);
+  (*task)(&wg, ud, 0);
+  for (i = 0; i < n; i++)
+    l_threadjoin(w[i].thread);
+  lua_assert(wg.chunks == NULL);
+  l_conddestroy(&wg.cond);
+  l_mutexdestroy(&wg.lock);
+  return n + 1;
+}
+
+
+/*
+** Whether some thread is waiting for work
+*/
+// 是否有线程在等待工作
+int luaW_hungry (WorkGroup *wg) {
+  int res;
+  l_lock(&wg->lock);
+  res = (wg->nidle > 0 && wg->chunks == NULL);
+  l_unlock(&wg->lock);
+  return res;
+}
+
+
+// 共享一块工作
+void luaW_share (WorkGroup *wg, WorkChunk *c) {
+  l_lock(&wg->lock);
+  c->next = wg->chunks;
+  wg->chunks = c;
+  l_condsignal(&wg->cond);
+  l_unlock(&wg->lock);
+}
+
+
+/*
+** Get a chunk of shared work, waiting for one if needed. Returns NULL
+** when all threads ran out of work.
+*/
+// 取一块共享的工作，需要时等待。所有线程都没有工作时返回NULL
+WorkChunk *luaW_take (WorkGroup *wg) {
+  WorkChunk *c;
+  l_lock(&wg->lock);
+  wg->nidle++;
+  while (wg->chunks == NULL && wg->nidle < wg->nworkers)
+    l_condwait(&wg->cond, &wg->lock);
+  c = wg->chunks;
+  if (c != NULL) {
+    wg->chunks = c->next;
+    wg->nidle--;
+  }
+  else  /* everybody is idle: work is over */
+    l_condbroadcast(&wg->cond);
+  l_unlock(&wg->lock);
+  return c;
+}
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Background freeing
+** =======================================================
+*/
+
+#if defined(LUAI_HASTHREADS)	/* { */
+
+/* number of batches in the ring */
+// 环形队列中批次的数量
+#define NBATCHES	16
+
+
+typedef struct FreeBatch {
+  int n;  /* number of blocks in the batch */
+  void *block[BGBATCH];
+  size_t size[BGBATCH];
+} FreeBatch;
+
+
+/*
+** Batches form a ring. The Lua thread fills batch 'cur'; batches
+** 'first' to 'first + nqueued - 1' wait for (or are being freed by)
+** the helper, which owns them until it takes them out of the queue.
+** The helper calls the allocator of the state; 'lua_setallocf' drains
+** the queue before changing it.
+*/
+// 批次组成一个环。Lua线程填充cur批次；从first开始的nqueued个批次交给了辅助线程，
+// 在辅助线程把它们移出队列之前都属于辅助线程。辅助线程调用状态机的分配器，lua_setallocf更换分配器前会先清空队列
+typedef struct BgFree {
+  l_thread thread;
+  l_mutex lock;
+  l_cond wake;  /* signals the helper that there is work (or 'stop') */
+  l_cond done;  /* signals the Lua thread that a batch was freed */
+  global_State *g;  /* state owning the blocks */
+  int first;  /* first queued batch */
+  int nqueued;  /* number of queued batches */
+  int cur;  /* batch being filled by the Lua thread */
+  int stop;  /* true to make the helper finish */
+  FreeBatch batch[NBATCHES];
+} BgFree;
+
+
+static void freebatch (global_State *g, FreeBatch *b) {
+  int i;
+  for (i = 0; i < b->n; i++)
+    (*g->frealloc)(g->ud, b->block[i], b->size[i], 0);
+  b->n = 0;
+}
+
+
+l_threadfunc(freeworker, arg) {
+  BgFree *bg = (BgFree *)arg;
+  global_State *g = bg->g;
+  l_lock(&bg->lock);
+  for (;;) {
+    FreeBatch *b;
+    while (bg->nqueued == 0 && !bg->stop)
+      l_condwait(&bg->wake, &bg->lock);
+    if (bg->nqueued == 0)  /* stopped and nothing left? */
+      break;
+    b = &bg->batch[bg->first];
+    l_unlock(&bg->lock);
+    freebatch(g, b);  /* free blocks without holding the lock */
+    l_lock(&bg->lock);
+    bg->first = (bg->first + 1) % NBATCHES;
+    bg->nqueued--;
+    l_condsignal(&bg->done);
+  }
+  l_unlock(&bg->lock);
+  l_threadret;
+}
+
+
+/*
+** Start the helper thread. Returns false if the allocator was not
+** declared thread safe or the thread could not be created.
+*/
+// 启动辅助线程，分配器没有声明为线程安全或者线程创建失败时返回假
+int luaW_startfree (lua_State *L) {
+  global_State *g = G(L);
+  BgFree *bg;
+  int i;
+  if (!threadsafealloc(g))
+    return 0;  /* helper would race with this thread in the allocator */
+  if (g->bgfree != NULL)
+    return 1;  /* already running */
+  bg = luaM_new(L, BgFree);
+  bg->g = g;
+  bg->first = bg->nqueued = bg->cur = bg->stop = 0;
+  for (i = 0; i < NBATCHES; i++)
+    bg->batch[i].n = 0;
+  l_mutexinit(&bg->lock);
+  l_condinit(&bg->wake);
+  l_condinit(&bg->done);
+  if (!l_threadcreate(&bg->thread, freeworker, bg)) {
+    l_conddestroy(&bg->done);
+    l_conddestroy(&bg->wake);
+    l_mutexdestroy(&bg->lock);
+    luaM_free(L, bg);
+    return 0;
+  }
+  g->bgfree = bg;
+  return 1;
+}
+
+
+/*
+** Free all pending blocks and stop the helper thread
+*/
+// 释放所有待释放的块，然后停止辅助线程
+void luaW_stopfree (lua_State *L) {
+  global_State *g = G(L);
+  BgFree *bg = g->bgfree;
+  if (bg == NULL) return;  /* not running */
+  lua_assert(!g->gcdeferfree);
+  luaW_flush(g);
+  l_lock(&bg->lock);
+  bg->stop = 1;
+  l_condsignal(&bg->wake);
+  l_unlock(&bg->lock);
+  l_threadjoin(bg->thread);  /* helper frees everything before leaving */
+  l_conddestroy(&bg->done);
+  l_conddestroy(&bg->wake);
+  l_mutexdestroy(&bg->lock);
+  g->bgfree = NULL;
+  luaM_free(L, bg);
+}
+
+
+/*
+** Queue the current batch to the helper. If the helper is behind (all
+** other batches are queued), free the batch here instead of waiting.
+*/
+// 把当前批次交给辅助线程。如果辅助线程跟不上（其他批次都在队列中），就在这里释放，而不是等待
+void luaW_flush (global_State *g) {
+  BgFree *bg = g->bgfree;
+  FreeBatch *b;
+  if (bg == NULL || bg->batch[bg->cur].n == 0)
+    return;  /* nothing to queue */
+  l_lock(&bg->lock);
+  if (bg->nqueued < NBATCHES - 1) {  /* is there a free batch after it? */
+    bg->nqueued++;
+    bg->cur = (bg->cur + 1) % NBATCHES;
+    l_condsignal(&bg->wake);
+    l_unlock(&bg->lock);
+    lua_assert(bg->batch[bg->cur].n == 0);
+    return;
+  }
+  l_unlock(&bg->lock);
+  b = &bg->batch[bg->cur];
+  freebatch(g, b);
+}
+
+
+/*
+** Queue the freeing of 'block' (of 'size' bytes). Called only while
+** 'gcdeferfree' is on, which implies that the helper is running.
+*/
+// 把块block的释放放进队列，只在gcdeferfree打开时调用（此时辅助线程一定在运行）
+void luaW_free (global_State *g, void *block, size_t size) {
+  BgFree *bg = g->bgfree;
+  FreeBatch *b = &bg->batch[bg->cur];
+  b->block[b->n] = block;
+  b->size[b->n] = size;
+  if (++b->n == BGBATCH)  /* batch is full? */
+    luaW_flush(g);
+}
+
+
+/*
+** Wait until the helper has freed all blocks queued so far (e.g.,
+** before an emergency collection retries an allocation, or before the
+** allocator changes)
+*/
+// 等待辅助线程释放完目前为止所有的块（比如紧急回收后重试分配之前，或者更换分配器之前）
+void luaW_drain (global_State *g) {
+  BgFree *bg = g->bgfree;
+  if (bg == NULL) return;
+  luaW_flush(g);
+  l_lock(&bg->lock);
+  while (bg->nqueued > 0)
+    l_condwait(&bg->done, &bg->lock);
+  l_unlock(&bg->lock);
+}
+
+#else				/* }{ */
+
+int luaW_startfree (lua_State *L) {
+  UNUSED(L);
+  return 0;  /* no threads */
+}
+
+void luaW_stopfree (lua_State *L) { UNUSED(L); }
+
+void luaW_free (global_State *g, void *block, size_t size) {
+  UNUSED(g); UNUSED(block); UNUSED(size);
+  lua_assert(0);  /* never deferring without a helper */
+}
+
+void luaW_flush (global_State *g) { UNUSED(g); }
+
+void luaW_drain (global_State *g) { UNUSED(g); }
+
+#endif				/* } */
+
+/* }====================================================== */
+
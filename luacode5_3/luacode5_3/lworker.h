@@ -0,0 +1,129 @@
+/*
+** $Id: lworker.h $
+** Helper threads for the garbage collector
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lworker_h
+#define lworker_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** Helper threads need the Windows API or POSIX threads. Without them,
+** 'luaW_startfree' always fails and the collector works alone.
+*/
+// 辅助线程需要Windows API或者POSIX线程，都没有时luaW_startfree总是失败，收集器自己完成所有工作
+#if defined(LUA_USE_WINDOWS) || defined(LUA_USE_POSIX)
+#define LUAI_HASTHREADS
+#endif
+
+
+/*
+** Atomic access to a byte, used by the parallel marker to claim
+** objects ('l_casbyte' returns true if it stored 'n'; 'o' must be a
+** variable, which it may overwrite) and to read or set flags other
+** markers may be looking at. Parallel marking needs
+** them as well as threads.
+*/
+// 对一个字节的原子操作，并行标记用它来抢占对象（l_casbyte存入n时返回真），
+// 以及读写其他标记线程可能同时访问的标志。并行标记需要它们和线程
+#if defined(_MSC_VER)
+
+#include <intrin.h>
+#define l_casbyte(p,o,n)  \
+	(_InterlockedCompareExchange8((char volatile *)(p), (char)(n), (char)(o)) \
+	 == (char)(o))
+#define l_loadbyte(p)		(*(volatile lu_byte *)(p))
+#define l_storebyte(p,v)	(*(volatile lu_byte *)(p) = (v))
+#define l_storeint(p,v)		(*(volatile int *)(p) = (v))
+
+#elif defined(__GNUC__)
+
+#define l_casbyte(p,o,n)  \
+	__atomic_compare_exchange_n(p, &(o), n, 0, __ATOMIC_ACQ_REL, \
+	                            __ATOMIC_RELAXED)
+#define l_loadbyte(p)		__atomic_load_n(p, __ATOMIC_RELAXED)
+#define l_storebyte(p,v)	__atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define l_storeint(p,v)		__atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+#endif
+
+#if defined(LUAI_HASTHREADS) && defined(l_casbyte)
+#define LUAI_PARMARK
+#endif
+
+
+/*
+** Dead objects found by a sweep are unlinked by the Lua thread as
+** usual, but the calls to the allocator that free their memory are
+** queued (in batches of BGBATCH blocks) and done by a helper thread.
+** The allocator of the state must then be thread safe, and the host
+** must have declared it so with 'lua_setallocsafe' ('luaL_newstate'
+** does); otherwise 'luaW_startfree' refuses to start.
+*/
+// 清扫找到的死对象还是由Lua线程从链表中摘除，但释放它们内存的分配器调用
+// 被放进队列（每批BGBATCH个块），由辅助线程完成。此时状态机的分配器必须是线程安全的，
+// 并且宿主已经用lua_setallocsafe声明过（luaL_newstate会声明），否则luaW_startfree拒绝启动
+#if !defined(BGBATCH)
+#define BGBATCH		256
+#endif
+
+
+/* whether the host declared the current allocator thread safe */
+// 宿主是否声明了当前的分配器是线程安全的
+#define threadsafealloc(g)	((g)->tsalloc != NULL && (g)->tsalloc == (g)->frealloc)
+
+
+/* whether frees are being deferred to the helper thread */
+// 是否正在把释放交给辅助线程
+#define isdeferringfree(g)	((g)->gcdeferfree)
+
+/* start/stop deferring frees (only with a helper running) */
+// 开始/停止推迟释放（只在辅助线程运行时）
+#define deferfree(g,b)	((g)->gcdeferfree = cast_byte((b) && (g)->bgfree != NULL))
+
+
+/*
+** Work shared among the threads of a parallel task goes in chunks of
+** up to WORKCHUNK items. A chunk is allocated by the thread sharing it
+** and freed by the one taking it.
+*/
+// 并行任务的线程之间共享的工作放在最多WORKCHUNK项的块中，块由共享它的线程分配，由取走它的线程释放
+#define WORKCHUNK	256
+
+/* maximum number of threads in a parallel task */
+// 一个并行任务最多使用的线程数
+#if !defined(LUAI_MAXWORKERS)
+#define LUAI_MAXWORKERS		16
+#endif
+
+typedef struct WorkChunk {
+  struct WorkChunk *next;
+  int n;  /* number of items */
+  void *item[WORKCHUNK];
+} WorkChunk;
+
+typedef struct WorkGroup WorkGroup;
+
+/* a parallel task; 'id' is 0 for the calling thread */
+typedef void (*luaW_Task) (WorkGroup *wg, void *ud, int id);
+
+
+LUAI_FUNC int luaW_runparallel (lua_State *L, int nthreads, luaW_Task task,
+                                void *ud);
+LUAI_FUNC int luaW_hungry (WorkGroup *wg);
+LUAI_FUNC void luaW_share (WorkGroup *wg, WorkChunk *c);
+LUAI_FUNC WorkChunk *luaW_take (WorkGroup *wg);
+
+LUAI_FUNC int luaW_startfree (lua_State *L);
+LUAI_FUNC void luaW_stopfree (lua_State *L);
+LUAI_FUNC void luaW_free (global_State *g, void *block, size_t size);
+LUAI_FUNC void luaW_flush (global_State *g);
+LUAI_FUNC void luaW_drain (global_State *g);
+
+
+#endif
@@ -0,0 +1,104 @@
+-- pattern matching benchmark (string.find/match/gmatch/gsub in lstrlib.c)
+-- log processing: the same literal patterns over a large buffer, so each
+-- pattern is compiled once and then served from the pattern cache
+
+local N = tonumber(arg and arg[1]) or 1
+
+-- a log of 20000 lines, about 1.5 MB
+local function makelog (count)
+  local levels = { "INFO", "INFO", "INFO", "WARN", "DEBUG", "ERROR" }
+  local ops = { "login", "logout", "move", "trade", "chat" }
+  local lines = {}
+  for i = 1, count do
+    lines[i] = string.format(
+      "2017-%02d-%02d %02d:%02d:%02d [%s] player=%d op=%s map=%d x=%d y=%d msg=\"%s\"",
+      i % 12 + 1, i % 28 + 1, i % 24, i % 60, (i * 7) % 60,
+      levels[i % #levels + 1], 100000 + i * 13, ops[i % #ops + 1],
+      i % 50, (i * 37) % 1024, (i * 91) % 1024,
+      string.rep("payload ", i % 5 + 1))
+  end
+  return table.concat(lines, "\n") .. "\n"
+end
+
+local log = makelog(20000)
+
+-- best of a few runs
+local function timeit (f)
+  local best = math.huge
+  local res
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    res = f()
+    best = math.min(best, os.clock() - t0)
+  end
+  return best, res
+end
+
+local cases = {
+  { "gmatch lines", function ()
+      local n = 0
+      for _ = 1, N do
+        for line in log:gmatch("[^\n]+") do n = n + 1 end
+      end
+      return n
+    end },
+  { "gmatch fields", function ()
+      local n = 0
+      for _ = 1, N do
+        for k, v in log:gmatch("(%w+)=(%d+)") do n = n + 1 end
+      end
+      return n
+    end },
+  { "gmatch errors", function ()
+      local n = 0
+      for _ = 1, N do
+        for id in log:gmatch("%[ERROR%] player=(%d+)") do n = n + 1 end
+      end
+      return n
+    end },
+  { "gsub spaces", function ()
+      local n = 0
+      for _ = 1, N do
+        local _, c = log:gsub("%s+", " ")
+        n = n + c
+      end
+      return n
+    end },
+  { "gsub quoted", function ()
+      local n = 0
+      for _ = 1, N do
+        local _, c = log:gsub('msg="[^"]*"', "msg=?")
+        n = n + c
+      end
+      return n
+    end },
+  { "match per line", function ()
+      local n = 0
+      local lines = {}
+      for line in log:gmatch("[^\n]+") do lines[#lines + 1] = line end
+      for _ = 1, N do
+        for i = 1, #lines do
+          local d, t, lv = lines[i]:match("^(%d+%-%d+%-%d+) ([%d:]+) %[(%u+)%]")
+          if lv == "WARN" then n = n + 1 end
+        end
+      end
+      return n
+    end },
+  { "find per line", function ()
+      local n = 0
+      local lines = {}
+      for line in log:gmatch("[^\n]+") do lines[#lines + 1] = line end
+      for _ = 1, N do
+        for i = 1, #lines do
+          if lines[i]:find("op=trade map=%d+") then n = n + 1 end
+        end
+      end
+      return n
+    end },
+}
+
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t, res = timeit(c[2])
+  print(string.format("%-15s %7.3f s   (%d)", c[1], t, res))
+end
@@ -0,0 +1,83 @@
+-- short string creation benchmark (hashing + interning in lstring.c)
+-- run with the same script on a build with LUAI_HASHWORD=1 (default, word
+-- at a time) and one with LUAI_HASHWORD=0 (byte loop) and compare
+
+local N = tonumber(arg and arg[1]) or 1
+
+-- key distributions: each returns the i-th key
+local sets = {
+  { "field names", function (i)
+      local names = { "name", "hp", "mp", "level", "exp", "position_x", "position_y",
+                      "guild_id", "last_login_time", "channel" }
+      return names[i % #names + 1] .. (i % 100)
+    end },
+  { "decimal ids", function (i) return tostring(1000000 + i * 7) end },
+  { "prefixed ids", function (i) return string.format("player_%07d", i) end },
+  { "composite 32+", function (i)
+      return string.format("account:%d:inventory:slot%d", i // 64, i % 64)
+    end },
+  { "uuid 36", function (i)
+      return string.format("%08x-%04x-%04x-%04x-%012x", i * 2654435761 % 0x100000000,
+                           i % 0x10000, (i * 7) % 0x10000, (i * 13) % 0x10000, i * 40503)
+    end },
+}
+
+-- the keys packed back to back in one string, like a network buffer;
+-- string.sub over it creates (or finds) each key as a short string
+local function buffer (key, count)
+  local parts, offs = {}, {}
+  local pos = 1
+  for i = 1, count do
+    local k = key(i)
+    parts[i] = k
+    offs[2 * i - 1], offs[2 * i] = pos, pos + #k - 1
+    pos = pos + #k
+  end
+  return table.concat(parts), offs
+end
+
+local sub = string.sub
+
+-- best of a few runs, the numbers are small
+local function timeit (f)
+  local best = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    f()
+    best = math.min(best, os.clock() - t0)
+  end
+  return best
+end
+
+-- sub(buf, offs[i], offs[i+1]) for every key, 'rounds' times
+local function subs (buf, offs, rounds)
+  for _ = 1, rounds do
+    for i = 1, #offs, 2 do
+      sub(buf, offs[i], offs[i + 1])
+    end
+  end
+end
+
+for _, set in ipairs(sets) do
+  local name, key = set[1], set[2]
+  collectgarbage()
+
+  -- new strings: 100000 keys, each created for the first time in each round
+  local buf, offs = buffer(key, 100000)
+  local tnew = timeit(function ()
+    for _ = 1, 2 * N do
+      collectgarbage()
+      collectgarbage("stop")
+      subs(buf, offs, 1)
+      collectgarbage("restart")
+    end
+  end)
+
+  -- existing strings, 1000 hot keys: each sub is a hash and a lookup in cache
+  local hbuf, hoffs = buffer(key, 1000)
+  local keep = {}
+  for i = 1, #hoffs, 2 do keep[#keep + 1] = sub(hbuf, hoffs[i], hoffs[i + 1]) end
+  local thot = timeit(function () subs(hbuf, hoffs, 1000 * N) end)
+
+  print(string.format("%-14s new %7.3f s   existing %7.3f s", name, tnew, thot))
+end
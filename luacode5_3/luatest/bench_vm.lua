@@ -0,0 +1,57 @@
+-- interpreter dispatch benchmark
+-- run with the same script on a build with LUA_USE_JUMPTABLE=1 (gcc/clang
+-- default) and one with LUA_USE_JUMPTABLE=0 (switch dispatch) and compare
+
+local N = tonumber(arg and arg[1]) or 1
+
+local function bench(name, f)
+  collectgarbage()
+  local t0 = os.clock()
+  local r = f()
+  print(string.format("%-12s %8.3f s  (%s)", name, os.clock() - t0, tostring(r)))
+end
+
+-- calls and returns
+bench("fib", function ()
+  local function fib(n) if n < 2 then return n end return fib(n-1) + fib(n-2) end
+  return fib(27 + N)
+end)
+
+-- arithmetic and numeric for loops
+bench("arith", function ()
+  local s = 0
+  for i = 1, 5000000 * N do
+    s = (s + i * 3 - (i // 7)) % 1000003
+  end
+  return s
+end)
+
+-- field access and method calls, the usual entity script shape
+bench("fields", function ()
+  local Entity = {}
+  Entity.__index = Entity
+  function Entity:move(dx, dy) self.x = self.x + dx; self.y = self.y + dy end
+  local es = {}
+  for i = 1, 100 do es[i] = setmetatable({x = i, y = -i, hp = 100}, Entity) end
+  for _ = 1, 20000 * N do
+    for i = 1, #es do
+      local e = es[i]
+      e:move(1, 2)
+      if e.hp < 0 then e.hp = 0 end
+    end
+  end
+  return es[1].x
+end)
+
+-- generic for, table reads and string concatenation
+bench("tables", function ()
+  local t = {}
+  for i = 1, 1000 do t[i] = i end
+  local s = 0
+  for _ = 1, 2000 * N do
+    for _, v in ipairs(t) do s = s + v end
+  end
+  local parts = {}
+  for i = 1, 100000 do parts[#parts + 1] = "k" .. (i % 100) end
+  return s + #parts
+end)
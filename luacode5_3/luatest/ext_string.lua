@@ -0,0 +1,77 @@
+-- external string check
+-- strings whose bytes stay in a buffer of the host (see
+-- lua_pushexternalstring) behave as any other string, and the host gets
+-- each buffer back exactly once: short ones at once (they are copied),
+-- long ones when they are collected or the state is closed; run it from
+-- a host that registers extstring(s) and extstrings() (luatest
+-- ext_string.lua, see luatest/main.cpp), which also checks the buffers
+-- left when the state is closed
+
+assert(extstring, "extstring(s) must be registered by the host")
+
+-- buffers the host has not got back yet
+local function alive ()
+  local created, released, badsize = extstrings()
+  assert(badsize == 0, "buffer released with a wrong size")
+  return created - released
+end
+
+-- contents, length, comparisons, table keys, string functions
+do
+  local long = string.rep("abcdefgh", 100) .. "\0tail"
+  local e = extstring(long)
+  assert(e == long and #e == #long and rawequal(e, e))
+  assert(e:sub(1, 8) == "abcdefgh" and e:sub(-4) == "tail")
+  assert(e < long .. "x" and not (e < long))
+  local t = { [long] = 1 }
+  assert(t[e] == 1)  -- the same key as a copy of the bytes
+  t[e] = 2
+  assert(t[long] == 2)
+  assert(e .. "!" == long .. "!" and (e:gsub("h", "")) == (long:gsub("h", "")))
+  assert(load("return " .. string.format("%q", e))() == long)
+end
+
+-- short strings are copied, and their buffers released at once
+do
+  local n = alive()
+  local s = extstring("short")
+  assert(s == "short" and s == "sh" .. "ort")
+  assert(extstring("") == "")
+  assert(alive() == n)
+end
+
+-- long strings keep their buffers while they are reachable
+do
+  collectgarbage()
+  local n = alive()
+  local keep = {}
+  for i = 1, 1000 do
+    local s = extstring(string.rep("x", 50) .. i)
+    if i % 10 == 0 then keep[#keep + 1] = s end
+  end
+  collectgarbage()
+  assert(alive() == n + 100)
+  for i, s in ipairs(keep) do assert(s == string.rep("x", 50) .. i * 10) end
+  -- unreachable, they are released once (strings are values: a weak
+  -- table keeps them)
+  local weak = setmetatable({}, { __mode = "v" })
+  for i = 1, 10 do weak[i] = keep[i] end
+  keep = nil
+  collectgarbage()
+  assert(alive() == n + 10 and weak[10] == string.rep("x", 50) .. 100)
+  weak = nil
+  collectgarbage()
+  assert(alive() == n)
+  collectgarbage()
+  assert(alive() == n)
+end
+
+-- strings alive when the state is closed, in locals, upvalues, tables
+-- and the registry, are released by lua_close (checked by the host)
+local last = extstring(string.rep("z", 100))
+local function up () return last end
+_G.ext_global = extstring(string.rep("g", 100))
+debug.getregistry().ext_reg = extstring(string.rep("r", 100))
+assert(alive() >= 3 and up() == string.rep("z", 100))
+
+print("external strings ok")
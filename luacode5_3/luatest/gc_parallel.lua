@@ -0,0 +1,100 @@
+-- parallel marking check and benchmark
+-- builds the same random object graph twice, collects it once with the
+-- serial marker and once with N marking threads, and checks that the
+-- same objects survive; then times full collections of a large heap
+-- the number of marking threads is a host setting: run it from a host
+-- that registers markthreads(n) (see luatest/main.cpp), as scripts
+-- cannot tell whether the allocator is thread safe
+
+local NT = tonumber(arg and arg[1]) or 4
+local SIZE = tonumber(arg and arg[2]) or 200000
+assert(markthreads, "markthreads(n) must be registered by the host")
+
+-- every object gets an id in a weak-keyed table, so that the ids still
+-- there after a collection tell which objects survived
+local function build(seed)
+  math.randomseed(seed)
+  local ids = setmetatable({}, {__mode = "k"})
+  local nid = 0
+  local function reg(o) nid = nid + 1; ids[o] = nid; return o end
+  local objs = {}
+  local weakv = setmetatable({}, {__mode = "v"})
+  local ephem = setmetatable({}, {__mode = "k"})
+  local roots = {weakv = weakv, ephem = ephem}
+  -- metatables shared by many objects, with removed fields (dead keys,
+  -- cleared by the marker of the metatable while the markers of its
+  -- objects check whether they are weak); one of them is weak
+  local classes = {}
+  for c = 1, 8 do
+    local cls = {__mode = (c == 1) and "k" or nil}
+    for k = 1, 100 do cls["f" .. k] = {} end
+    for k = 1, 100, 2 do cls["f" .. k] = nil end
+    classes[c] = reg(cls)
+  end
+  for i = 1, 20000 do
+    local r = math.random(9)
+    local o
+    if r == 1 then o = reg({x = i, y = -i, name = "n" .. i})  -- record shape
+    elseif r == 2 then o = reg({i, i + 1, tostring(i)})
+    elseif r == 3 then local up = {i}; reg(up)
+      o = reg(function () return up end)
+    elseif r == 4 then o = reg(coroutine.create(function (a)
+        local keep = a; coroutine.yield(); return keep end))
+      coroutine.resume(o, reg({i}))
+    elseif r == 5 then o = reg(setmetatable({}, {__index = objs[#objs]}))
+    elseif r == 6 then o = reg(setmetatable({}, {__mode = "k"}))
+    elseif r == 7 then o = reg(setmetatable({}, {__gc = function () end}))
+    elseif r == 8 then o = reg(setmetatable({}, classes[math.random(8)]))
+    else o = reg({})
+    end
+    objs[#objs + 1] = o
+  end
+  -- random edges, weak references and ephemerons between objects
+  for i = 1, 40000 do
+    local a, b = objs[math.random(#objs)], objs[math.random(#objs)]
+    if type(a) == "table" and not getmetatable(a) then a[#a + 1] = b end
+    local r = math.random(4)
+    if r == 1 then weakv[i] = b
+    elseif r == 2 then ephem[a] = b
+    end
+  end
+  -- keep a random part of the objects reachable from the roots
+  for i = 1, #objs, 3 do roots[#roots + 1] = objs[i] end
+  return ids, roots
+end
+
+local function survivors(threads)
+  markthreads(threads)
+  local ids, roots = build(42)
+  collectgarbage()
+  collectgarbage()
+  local alive = {}
+  for _, id in pairs(ids) do alive[#alive + 1] = id end
+  table.sort(alive)
+  local n = 0
+  for _ in pairs(roots.weakv) do n = n + 1 end
+  for _ in pairs(roots.ephem) do n = n + 1 end
+  return table.concat(alive, ","), #alive, n
+end
+
+collectgarbage("incremental")
+local s1, n1, w1 = survivors(1)
+local s2, n2, w2 = survivors(NT)
+print(string.format("serial: %d alive, %d weak entries", n1, w1))
+print(string.format("%d threads: %d alive, %d weak entries", NT, n2, w2))
+assert(s1 == s2 and w1 == w2, "parallel marker disagrees with serial marker")
+print("same reachability")
+
+-- timing on a large heap
+local heap = {}
+for i = 1, SIZE do
+  heap[i] = {id = i, s = "s" .. i, f = function () return i end, {i, {i}}}
+end
+for _, t in ipairs({1, NT}) do
+  markthreads(t)
+  collectgarbage()
+  local t0 = os.clock()
+  for _ = 1, 5 do collectgarbage() end
+  print(string.format("%2d threads: %.3f s per full collection", t,
+                      (os.clock() - t0) / 5))
+end
@@ -0,0 +1,72 @@
+-- time-budgeted GC step check and benchmark
+-- collectgarbage("steptime", usec) does incremental work for about usec
+-- microseconds and returns true when it finished a cycle; large tables
+-- are traversed in chunks across steps, so the checks below change
+-- them between steps and then compare them with what they should hold;
+-- then prints how long the calls with a 2 ms budget take
+
+local SIZE = math.floor((tonumber(arg and arg[1]) or 1) * 200000)
+
+collectgarbage("incremental")
+
+-- large tables written, grown and rehashed while they are traversed
+do
+  local big = {}
+  for i = 1, SIZE do big[i] = {i} end
+  local hbig = {}
+  for i = 1, SIZE // 4 do hbig["k" .. i] = {i} end
+  for round = 1, 40 do
+    for s = 1, 200 do
+      collectgarbage("steptime", 50)
+      local j = (s * 7919 + round) % SIZE + 1
+      big[j] = {j}                                -- write into the traversed part
+      big[#big + 1] = {#big + 1}                  -- grow (may resize)
+      hbig["n" .. round .. "_" .. s] = {s}        -- new keys (may rehash)
+      local k = "k" .. (s * 31) % (SIZE // 4) + 1
+      hbig[k] = {hbig[k][1]}                      -- replace a value
+      local t = big[j]; big[j] = nil; big[j] = t  -- remove and set again
+    end
+  end
+  collectgarbage()
+  for i = 1, #big do assert(big[i][1] == i) end
+  for k, v in pairs(hbig) do
+    assert(type(v) == "table" and (k:sub(1, 1) == "n" or "k" .. v[1] == k))
+  end
+end
+
+-- a stopped collector still does the steps asked for, and stays stopped
+do
+  collectgarbage("stop")
+  local cycles = 0
+  for i = 1, 10000 do
+    local t = {i}
+    if collectgarbage("steptime", 100) then cycles = cycles + 1 end
+    if cycles >= 2 then break end
+  end
+  assert(cycles >= 2, "steps did not finish a cycle")
+  assert(not collectgarbage("isrunning"))
+  collectgarbage("restart")
+end
+
+-- in generational mode a step is a (minor) collection when one is due
+do
+  collectgarbage("generational")
+  for i = 1, 100 do local t = {i}; collectgarbage("steptime", 100) end
+  collectgarbage("incremental")
+end
+
+-- timing: the longest call with a 2 ms budget, allocating between calls
+local heap = {}
+for i = 1, SIZE do heap[i] = {id = i, s = "s" .. i, {i}} end
+local maxt, n, cycles = 0, 0, 0
+local t0 = os.clock()
+while os.clock() - t0 < 2 do
+  local c = os.clock()
+  if collectgarbage("steptime", 2000) then cycles = cycles + 1 end
+  local d = os.clock() - c
+  if d > maxt then maxt = d end
+  n = n + 1
+  for i = 1, 1000 do local x = {i} end
+end
+print(string.format("calls %d   cycles %d   longest %.2f ms (budget 2 ms)",
+                    n, cycles, maxt * 1000))
@@ -0,0 +1,134 @@
+-- inline cache check
+-- GETTABLE, GETTABUP and SELF with a constant short string key remember
+-- where the key was found (shape slot or hash node) in a cache of the
+-- instruction; each check below runs one access instruction over tables
+-- that hit, miss and change under it, and compares with rawget and the
+-- metatable rules
+
+local function get (t) return t.k end             -- GETTABLE
+local function call (t) return t:m() end          -- SELF
+local function glob () return cached_global end   -- GETTABUP
+
+-- hits: objects of the same shape, and tables in hash mode
+do
+  local objs = {}
+  for i = 1, 100 do objs[i] = { a = i, k = i * 2 } end
+  for r = 1, 3 do
+    for i = 1, 100 do assert(get(objs[i]) == i * 2) end
+  end
+  local h = {}
+  for i = 1, 200 do h["x" .. i] = i end  -- too many keys for a shape
+  h.k = "hash"
+  for r = 1, 3 do assert(get(h) == "hash") end
+end
+
+-- misses: the same key at other slots, other shapes, absent keys
+do
+  local ts = {
+    { k = 1 }, { a = 0, k = 2 }, { a = 0, b = 0, k = 3 }, { k = 4, a = 0 },
+    { a = 0 }, {}, { [1] = "k" }, { k = false },
+  }
+  for i = 1, 200 do ts[#ts + 1] = { ["y" .. i] = i } end
+  local expect = { 1, 2, 3, 4, nil, nil, nil, false }
+  for r = 1, 5 do
+    for i, t in ipairs(ts) do assert(get(t) == expect[i]) end
+  end
+end
+
+-- invalidation: the hash part is rebuilt, the key removed and added
+-- again, the table leaves its shape
+do
+  local t = { k = "v" }
+  assert(get(t) == "v")
+  for i = 1, 300 do
+    t["z" .. i] = i  -- leaves the shape, then rehashes many times
+    assert(get(t) == "v")
+  end
+  for i = 1, 300 do t["z" .. i] = nil end
+  t.k = nil
+  assert(get(t) == nil)
+  for i = 1, 50 do t["w" .. i] = i end  -- rehash with 'k' gone
+  assert(get(t) == nil)
+  t.k = "again"
+  assert(get(t) == "again")
+  -- a key that moves to another node when the hash part shrinks
+  local h = {}
+  for i = 1, 64 do h["h" .. i] = i end
+  h.k = 1
+  assert(get(h) == 1)
+  for i = 1, 64 do h["h" .. i] = nil end
+  for i = 1, 40 do h[i + 0.5] = i end  -- insertions force a rehash
+  assert(get(h) == 1 and rawget(h, "k") == 1)
+  h.k = 2
+  assert(get(h) == 2)
+end
+
+-- a shape freed by the collector and a new one at the same address
+do
+  collectgarbage()  -- free the shapes of the tables above
+  for i = 1, 200 do
+    local t = {}
+    t["p" .. i] = 1
+    t.k = "old"
+    assert(get(t) == "old")
+    t = nil
+    collectgarbage()  -- frees the shape of 't'
+    for j = 1, 4 do  -- some new shape likely takes the freed memory
+      local u = {}
+      u["q" .. i .. "_" .. j] = 1
+      u["r" .. i .. "_" .. j] = 2
+      assert(get(u) == nil)
+    end
+  end
+end
+
+-- metatables: a cached slot holding nil still goes through __index,
+-- and changes of the metatable are seen at once
+do
+  local t = { k = 1 }
+  assert(get(t) == 1)
+  t.k = nil
+  assert(get(t) == nil)
+  setmetatable(t, { __index = { k = "base" } })
+  assert(get(t) == "base")
+  getmetatable(t).__index = function (_, key) return key .. "!" end
+  assert(get(t) == "k!")
+  t.k = 0
+  assert(get(t) == 0)
+  setmetatable(t, nil)
+  t.k = nil
+  assert(get(t) == nil)
+  -- methods found in a class through __index, class changed later
+  local A = { m = function () return "A" end }
+  A.__index = A
+  local B = setmetatable({}, { __index = A })
+  B.__index = B
+  local o = setmetatable({}, B)
+  for r = 1, 3 do assert(call(o) == "A") end
+  B.m = function () return "B" end
+  assert(call(o) == "B")
+  B.m = nil
+  assert(call(o) == "A")
+  o.m = function () return "own" end
+  assert(call(o) == "own")
+  setmetatable(o, A)
+  o.m = nil
+  assert(call(o) == "A")
+end
+
+-- globals: the environment table gets and loses the key
+do
+  assert(glob() == nil)
+  cached_global = 1
+  assert(glob() == 1)
+  for i = 1, 100 do _G["g" .. i] = i end  -- rehash of _G
+  assert(glob() == 1)
+  for i = 1, 100 do _G["g" .. i] = nil end
+  cached_global = nil
+  assert(glob() == nil)
+  setmetatable(_G, { __index = function (_, key) return key end })
+  assert(glob() == "cached_global")
+  setmetatable(_G, nil)
+end
+
+print("inline cache ok")
@@ -5,6 +5,8 @@ extern "C"
 #include "lualib.h"  
 }
 #include "../lua_tinker/lua_tinker.h"
+#include <stdlib.h>
+#include <string.h>
 
 //#define MAXBITS		26
 //#define MAXASIZE	(1 << MAXBITS)
@@ -265,12 +267,104 @@ extern "C"
 // ------------------ lua_thinker test ------------------ 
 
 #include "lopcodes.h"
-int main()
+
+// gc_parallel.luaõmarkthreads(n)ʱǵ֮߳ǰֵ
+// luaL_newstateķ̰߳ȫģԴ򿪲б
+static int markthreads(lua_State* L)
+{
+	int n = (int)luaL_checkinteger(L, 1);
+	lua_pushinteger(L, lua_gc(L, LUA_GCSETMARKTHREADS, n));
+	return 1;
+}
+
+// pool_alloc.luaõpoolstats()ڴصʹ״̬ڴشķnil
+static int poolstats(lua_State* L)
+{
+	luaL_PoolStats st;
+	if (!luaL_poolstats(L, &st))
+		return 0;
+	lua_createtable(L, 0, 5);
+	lua_pushinteger(L, (lua_Integer)st.slabbytes);
+	lua_setfield(L, -2, "slabbytes");
+	lua_pushinteger(L, (lua_Integer)st.usedbytes);
+	lua_setfield(L, -2, "usedbytes");
+	lua_pushinteger(L, (lua_Integer)st.reqbytes);
+	lua_setfield(L, -2, "reqbytes");
+	lua_pushinteger(L, (lua_Integer)st.largebytes);
+	lua_setfield(L, -2, "largebytes");
+	lua_pushinteger(L, (lua_Integer)st.nlarge);
+	lua_setfield(L, -2, "nlarge");
+	return 1;
+}
+
+// ext_string.luaõextstring(s)sƵĻΪⲿַѹ롣
+// extstrings()شĻѾͷŵĻͷʱСԵĴ
+static int extcreated, extreleased, extbadsize;
+
+static void* extfree(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	if (osize != (size_t)ud || nsize != 0)  // udѹʱlen + 1
+		++extbadsize;
+	free(ptr);
+	++extreleased;
+	return NULL;
+}
+
+static int extstring(lua_State* L)
+{
+	size_t len;
+	const char* s = luaL_checklstring(L, 1, &len);
+	char* buff = (char*)malloc(len + 1);
+	if (buff == NULL)
+		return luaL_error(L, "not enough memory");
+	memcpy(buff, s, len + 1);
+	++extcreated;
+	lua_pushexternalstring(L, buff, len, extfree, (void*)(len + 1));
+	return 1;
+}
+
+static int extstrings(lua_State* L)
+{
+	lua_pushinteger(L, extcreated);
+	lua_pushinteger(L, extreleased);
+	lua_pushinteger(L, extbadsize);
+	return 3;
+}
+
+// luaL_newstateluaL_newstatepool״̬һνűȽַ
+static void runboth(const char* script)
+{
+	lua_State* states[2] = { luaL_newstate(), luaL_newstatepool() };
+	for (int i = 0; i < 2; ++i)
+	{
+		lua_State* L = states[i];
+		luaL_openlibs(L);
+		lua_register(L, "poolstats", poolstats);
+		lua_register(L, "extstring", extstring);
+		lua_register(L, "extstrings", extstrings);
+		extcreated = extreleased = extbadsize = 0;
+		if (luaL_dofile(L, script) != LUA_OK)
+			printf("%s\n", lua_tostring(L, -1));
+		lua_close(L);
+		// ر״̬ʱʣµⲿַҲҪ
+		if (extreleased != extcreated || extbadsize != 0)
+			printf("external strings: %d created, %d released, %d with a wrong size\n",
+			       extcreated, extreleased, extbadsize);
+	}
+}
+
+int main(int argc, char* argv[])
 {
 	char buff[256];
 	int error;
+	if (argc > 1)
+	{
+		runboth(argv[1]);
+		return 0;
+	}
 	lua_State* L = luaL_newstate();
 	luaL_openlibs(L);
+	lua_register(L, "markthreads", markthreads);
 
 	luaL_dofile(L, "luatest.lua");
 
@@ -0,0 +1,79 @@
+-- numeric array benchmark: memory and speed of arrays of numbers
+-- (integers and floats keep a packed array part), compared with an
+-- array of strings, which always uses a plain one
+
+local N = (tonumber(arg and arg[1]) or 1) * 2000000
+
+local function bench(name, f)
+  collectgarbage()
+  collectgarbage()
+  local m0 = collectgarbage("count")
+  local t0 = os.clock()
+  local t, r = f()
+  local dt = os.clock() - t0
+  collectgarbage()
+  local kb = collectgarbage("count") - m0
+  print(string.format("%-10s %8.3f s %10.0f KB  %6.2f bytes/elem  (%s)",
+                      name, dt, kb, kb * 1024 / #t, tostring(r)))
+end
+
+-- fill by appending, then sum
+bench("integers", function ()
+  local t = {}
+  for i = 1, N do t[#t + 1] = i * 7 end
+  local s = 0
+  for r = 1, 5 do
+    for i = 1, #t do s = s + t[i] end
+  end
+  return t, s
+end)
+
+bench("floats", function ()
+  local t = {}
+  for i = 1, N do t[i] = i * 0.5 end
+  for i = 1, #t do t[i] = t[i] * 1.5 end  -- update in place
+  local s = 0.0
+  for _, v in ipairs(t) do s = s + v end
+  return t, s
+end)
+
+-- a heterogeneous store turns the array part plain
+bench("mixed", function ()
+  local t = {}
+  for i = 1, N do t[i] = i end
+  t[N // 2] = 0.5
+  local s = 0
+  for i = 1, #t do s = s + t[i] end
+  return t, s
+end)
+
+bench("strings", function ()
+  local t = {}
+  local s = "x"
+  for i = 1, N do t[i] = s end
+  local n = 0
+  for i = 1, #t do if t[i] then n = n + 1 end end
+  return t, n
+end)
+
+-- keys stored past the end of a full array part wait in the hash part
+-- (here with room to spare) and move into the array when it grows: the
+-- array stays packed
+bench("unordered", function ()
+  local t = {}
+  for i = 1, 40 do t["k" .. i] = i end  -- too many keys for a shape
+  local i = 1
+  while i <= N do
+    if i > 4 and (i - 1) & (i - 2) == 0 then  -- array part just full
+      t[i + 1] = i + 1
+      t[i] = i
+      i = i + 2
+    else
+      t[i] = i
+      i = i + 1
+    end
+  end
+  local s = 0
+  for i = 1, #t do s = s + t[i] end
+  return t, s
+end)
@@ -0,0 +1,98 @@
+-- pool allocator check and benchmark
+-- runs an allocation-heavy workload (strings, tables whose parts grow
+-- and shrink across the small/large limit, closures, coroutine stacks),
+-- checks the results, and prints time and memory; run it from a host that
+-- runs the script once with luaL_newstate and once with luaL_newstatepool
+-- (luatest pool_alloc.lua, see luatest/main.cpp); in the pool state the
+-- host registers poolstats(), and the pool counters are checked as well
+
+local N = tonumber(arg and arg[1]) or 1
+
+-- the pool counts every byte the state has allocated (read the count
+-- first: the table poolstats returns is allocated after the counters)
+local function stats ()
+  local total = collectgarbage("count") * 1024
+  local st = poolstats and poolstats()
+  if st then
+    assert(st.reqbytes + st.largebytes == total, "pool and state disagree on the memory in use")
+    assert(st.usedbytes >= st.reqbytes, "blocks smaller than requested")
+    assert(st.slabbytes >= st.usedbytes, "blocks outside the slabs")
+  end
+  return st
+end
+
+-- one round of the workload; returns what it keeps alive
+local function round (r)
+  local keep = {}
+  -- short and long strings of every size up to a few slabs
+  for i = 1, 2000 do
+    keep[#keep + 1] = string.rep("x", i % 700) .. r
+  end
+  -- arrays that grow large and shrink back into a size class
+  for j = 1, 200 do
+    local t = {}
+    for i = 1, 300 do t[i] = i * j end
+    for i = 17, 300 do t[i] = nil end
+    t[1000] = j  -- rehash: the array part shrinks to 16 slots
+    for i = 1, 16 do assert(t[i] == i * j) end
+    if j % 2 == 0 then keep[#keep + 1] = t end
+  end
+  -- hash parts, closures and upvalues
+  for j = 1, 500 do
+    local t = {}
+    for i = 1, j % 40 do t["k" .. i] = function () return i + j end end
+    if j % 5 == 0 then keep[#keep + 1] = t end
+  end
+  -- coroutine stacks grow with the recursion and shrink at collections
+  local function deep (n)
+    if n == 0 then coroutine.yield() return 0 end
+    return deep(n - 1) + 1
+  end
+  for j = 1, 20 do
+    local co = coroutine.wrap(function () deep(j * 10) coroutine.yield() return j end)
+    co() co()
+    keep[#keep + 1] = co
+  end
+  return keep
+end
+
+local function check (keep, r)
+  local n = 0
+  for _, v in ipairs(keep) do
+    if type(v) == "string" then
+      assert(v:sub(-#tostring(r)) == tostring(r))
+    elseif type(v) == "function" then
+      n = n + 1
+      assert(v() == n)
+    end
+  end
+end
+
+check(round(0), 0)  -- warm up: the string table and the caches reach their sizes
+collectgarbage()
+collectgarbage()
+local m0 = collectgarbage("count")
+local s0 = stats()
+local t0 = os.clock()
+local alive = {}
+for r = 1, 30 * N do
+  local keep = round(r)
+  check(keep, r)
+  alive[r % 4 + 1] = keep  -- some survive a few rounds
+  stats()
+end
+local t1 = os.clock()
+local peak = collectgarbage("count")
+alive = nil
+collectgarbage()
+collectgarbage()
+local m1 = collectgarbage("count")
+local s1 = stats()
+
+print(string.format("%-6s %8.3f s   peak %9.1f KB   after %8.1f KB (before %8.1f KB)",
+                    s0 and "pool" or "plain", t1 - t0, peak, m1, m0))
+if s0 then
+  print(string.format("       slabs %8.1f KB   used %8.1f KB   requested %8.1f KB   large %d (%.1f KB)",
+                      s1.slabbytes / 1024, s1.usedbytes / 1024, s1.reqbytes / 1024,
+                      s1.nlarge, s1.largebytes / 1024))
+end
@@ -0,0 +1,125 @@
+-- table shape check and benchmark
+-- tables whose keys are all short strings keep them in a shape shared
+-- by every table that got the same keys in the same order, and the
+-- values in slots; each check below compares what a table holds with
+-- what it was given while it moves between shapes and into a hash part;
+-- then prints the memory used by records with shapes and with a hash part
+
+local N = (tonumber(arg and arg[1]) or 1) * 100000
+
+-- the keys and values of 't', as "k=v" sorted
+local function dump (t)
+  local r = {}
+  for k, v in pairs(t) do r[#r + 1] = tostring(k) .. "=" .. tostring(v) end
+  table.sort(r)
+  return table.concat(r, " ")
+end
+
+-- tables sharing a shape, in any order of creation
+do
+  local objs = {}
+  for i = 1, 100 do
+    if i % 2 == 0 then objs[i] = { x = i, y = -i, name = "n" .. i }
+    else local o = {}; o.x = i; o.y = -i; o.name = "n" .. i; objs[i] = o
+    end
+  end
+  for i, o in ipairs(objs) do
+    assert(o.x == i and o.y == -i and o.name == "n" .. i and o.z == nil)
+    assert(dump(o) == "name=n" .. i .. " x=" .. i .. " y=" .. -i)
+  end
+  -- a table that got the keys in another order has another shape
+  local p = { name = "p" }
+  p.y = 2; p.x = 1
+  assert(dump(p) == "name=p x=1 y=2")
+end
+
+-- removed keys: a nil slot is an absent key, for 'next' and metamethods
+do
+  local t = { a = 1, b = 2, c = 3 }
+  t.b = nil
+  assert(t.b == nil and rawget(t, "b") == nil and dump(t) == "a=1 c=3")
+  t.b = 20
+  assert(dump(t) == "a=1 b=20 c=3")
+  t.b = nil
+  local seen = {}
+  setmetatable(t, { __newindex = function (t, k, v) seen[k] = v end,
+                    __index = function (t, k) return "?" .. k end })
+  t.b = 5  -- absent: goes to __newindex
+  assert(seen.b == 5 and rawget(t, "b") == nil and t.b == "?b")
+  t.a = 10  -- present: no metamethod
+  assert(seen.a == nil and t.a == 10)
+  -- assigning to present keys (and clearing them) while traversing
+  for k in pairs(t) do t[k] = nil end
+  assert(next(t) == nil)
+end
+
+-- leaving the shape: too many keys, keys of other types, many variants
+do
+  local t = {}
+  for i = 1, 20 do t["f" .. i] = i end  -- past the limit of keys
+  for i = 1, 20 do assert(t["f" .. i] == i) end
+  local u = { a = 1, b = 2 }
+  u[1] = "one"; u[2.5] = "float"; u[true] = "bool"
+  assert(dump(u) == "1=one 2.5=float a=1 b=2 true=bool")
+  u.c = 3  -- a new string key, now in the hash part
+  assert(u.a == 1 and u.c == 3 and u[1] == "one" and #u == 1)
+  local v = { a = 1 }
+  v.x = nil
+  v[#v + 1] = "x"  -- array part and shape together
+  assert(v[1] == "x" and v.a == 1 and #v == 1)
+  -- more variants of the same shape than it can have kids
+  local vs = {}
+  for i = 1, 100 do
+    local o = { base = i }
+    o["v" .. i] = i
+    vs[i] = o
+  end
+  for i, o in ipairs(vs) do assert(dump(o) == "base=" .. i .. " v" .. i .. "=" .. i) end
+end
+
+-- shapes of collected tables are freed, and new tables reuse the tree
+do
+  collectgarbage()
+  collectgarbage()
+  local m0 = collectgarbage("count")
+  for r = 1, 3 do
+    local ts = {}
+    for i = 1, 2000 do
+      local o = {}
+      o["s" .. (i % 50)] = i
+      o["t" .. (i % 7)] = r
+      ts[i] = o
+    end
+    for i, o in ipairs(ts) do assert(o["s" .. (i % 50)] == i) end
+  end
+  collectgarbage()
+  collectgarbage()
+  -- (strings created above may stay in the string table)
+  assert(collectgarbage("count") - m0 < 64, "shapes were not freed")
+end
+
+-- memory of records with the same keys, with shapes and with a hash part
+local function bench (name, make)
+  collectgarbage()
+  collectgarbage()
+  local m0 = collectgarbage("count")
+  local t0 = os.clock()
+  local objs = {}
+  for i = 1, N do objs[i] = make(i) end
+  local s = 0
+  for r = 1, 5 do
+    for i = 1, N do local o = objs[i]; s = s + o.x + o.y + o.z end
+  end
+  local dt = os.clock() - t0
+  collectgarbage()
+  local kb = collectgarbage("count") - m0
+  print(string.format("%-8s %8.3f s %10.0f KB  %6.1f bytes/record  (%d)",
+                      name, dt, kb, kb * 1024 / N, s))
+end
+
+bench("shape", function (i) return { x = i, y = 2 * i, z = 3 * i, name = "r" } end)
+bench("hash", function (i)  -- past the limit of keys for a shape
+  local o = { x = i, y = 2 * i, z = 3 * i, name = "r" }
+  for k = 1, 5 do o["pad" .. k] = false end
+  return o
+end)
@@ -0,0 +1,64 @@
+-- incremental string table resize check
+-- the string table grows and shrinks by moving a few buckets of strings
+-- at a time (for each new short string and each GC step) from its old
+-- array into the new one; the checks below start a resize and, while
+-- strings are in both arrays, find and collect strings and run full
+-- collections, which must not shrink the table in the middle of a move;
+-- the script ends with a resize in progress, for lua_close to free
+
+-- creates short strings (not kept, the collector is stopped) until the
+-- string table starts to grow, which shows as the memory of its new
+-- array; short strings found after this are equal only if there is one
+-- copy of each, in one of the arrays
+local function startresize (prefix)
+  collectgarbage("stop")
+  local i = 0
+  repeat
+    i = i + 1
+    local m = collectgarbage("count")
+    local s = prefix .. i
+  until collectgarbage("count") - m > 1
+  collectgarbage("restart")
+end
+
+do
+  local keep = {}
+  for i = 1, 100000 do keep[i] = "s" .. i end  -- a large table: a long move
+  startresize("t")
+  for i = 1, 1000 do assert("s" .. i == keep[i]) end
+  -- a full collection while strings are in both arrays: most of them die,
+  -- and the table is too big, but it is not shrunk before the move ends
+  local few = {}
+  for i = 1, 100000, 100 do few[#few + 1] = keep[i] end
+  keep = nil
+  collectgarbage()
+  for j, s in ipairs(few) do assert("s" .. (j - 1) * 100 + 1 == s) end
+  -- after the move, collections shrink the table (another move)
+  for i = 1, 20000 do local s = "u" .. i end
+  collectgarbage()
+  collectgarbage()
+  for j, s in ipairs(few) do assert("s" .. (j - 1) * 100 + 1 == s) end
+  for i = 1, 1000 do local s = "v" .. i end
+  collectgarbage()
+  for j, s in ipairs(few) do assert("s" .. (j - 1) * 100 + 1 == s) end
+end
+
+-- strings used as table keys and compared while the table grows again
+do
+  local t = {}
+  for i = 1, 50000 do t["k" .. i] = i end
+  startresize("w")
+  for i = 1, 50000, 7 do assert(t["k" .. i] == i) end
+  for i = 1, 50000 do t["k" .. i] = nil end
+  collectgarbage("generational")
+  collectgarbage()
+  for i = 1, 1000 do t["k" .. i] = i end
+  for i = 1, 1000 do assert(t["k" .. i] == i) end
+  collectgarbage("incremental")
+end
+
+-- leave a resize in progress when the state is closed
+local keep = {}
+for i = 1, 100000 do keep[i] = "z" .. i end
+startresize("y")
+print("string table ok")